@@ -23,6 +23,7 @@
 #include "http/handlers.hh"
 #include "http/function_handlers.hh"
 #include "http/file_handler.hh"
+#include "http/heap_profile_handler.hh"
 #include "apps/httpd/demo.json.hh"
 #include "http/api_docs.hh"
 
@@ -51,6 +52,7 @@ void set_routes(routes& r) {
     r.add(operation_type::GET, url("/jf"), h2);
     r.add(operation_type::GET, url("/file").remainder("path"),
             new directory_handler("/"));
+    r.add(operation_type::GET, url("/heap_profile"), new heap_profile_handler());
     demo_json::hello_world.set(r, [] (const_req req) {
         demo_json::my_object obj;
         obj.var1 = req.param.at("var1");
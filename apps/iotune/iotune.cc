@@ -34,6 +34,7 @@
 #include <deque>
 #include <queue>
 #include <fstream>
+#include <iomanip>
 #include "core/sstring.hh"
 #include "core/posix.hh"
 #include "core/reactor.hh"
@@ -132,6 +133,7 @@ class iotune_manager {
     iotune_manager::clock::time_point _maximum_end_time;
 
     run_stats issue_reads(size_t cpu_id, unsigned this_concurrency);
+    double measure_rate(io_direction dir, size_t size, bool sequential, unsigned concurrency, clock::duration duration);
 
     run_stats current_result(size_t cpu_id) {
         assert(cpu_id == 0);
@@ -423,6 +425,27 @@ class iotune_manager {
         // Empirically, we will just allow three times as much as the number we have found.
         return _best_critical_concurrency * 3;
     }
+
+    // Measures the disk's random 4k IOPS and sequential bandwidth, for reads
+    // and writes separately, at the concurrency that gave the best throughput.
+    // Must be called after finish_estimate().
+    io_properties measure_properties() {
+        auto concurrency = std::max<unsigned>(_best_result.concurrency, 1);
+        auto duration = 2s;
+        std::cout << "Measuring disk properties at concurrency " << concurrency << "..." << std::flush;
+        io_properties p;
+        p.read_iops = measure_rate(io_direction::read, rbuffer_size, false, concurrency, duration);
+        p.write_iops = measure_rate(io_direction::write, rbuffer_size, false, concurrency, duration);
+        p.read_bandwidth = measure_rate(io_direction::read, wbuffer_size, true, concurrency, duration) * wbuffer_size;
+        p.write_bandwidth = measure_rate(io_direction::write, wbuffer_size, true, concurrency, duration) * wbuffer_size;
+        std::cout << std::endl;
+        auto to_mb = [] (double b) {
+            return uint64_t(b / (1 << 20));
+        };
+        std::cout << "Read: " << uint64_t(p.read_iops) << " IOPS, " << to_mb(p.read_bandwidth) << " MB/s" << std::endl;
+        std::cout << "Write: " << uint64_t(p.write_iops) << " IOPS, " << to_mb(p.write_bandwidth) << " MB/s" << std::endl;
+        return p;
+    }
 };
 
 constexpr uint64_t iotune_manager::wbuffer_size;
@@ -547,6 +570,74 @@ run_stats iotune_manager::issue_reads(size_t cpu_id, unsigned concurrency) {
     return result;
 }
 
+// Keeps `concurrency` requests of `size` bytes in flight against the test file
+// for `duration`, at random aligned positions or sequentially, and returns the
+// number of requests completed per second.
+double iotune_manager::measure_rate(io_direction dir, size_t size, bool sequential, unsigned concurrency, clock::duration duration) {
+    io_context_t io_context = {0};
+    auto r = ::io_setup(concurrency, &io_context);
+    assert(r >= 0);
+    auto destroyer = defer([&io_context] { ::io_destroy(io_context); });
+
+    // The contents don't matter, so all requests share one buffer.
+    auto buf = allocate_aligned_buffer<char>(size, 4096);
+    memset(buf.get(), 0, size);
+    auto nr_blocks = file_size / size;
+    std::uniform_int_distribution<uint64_t> pos_distribution(0, nr_blocks - 1);
+    uint64_t next_block = 0;
+    auto prepare = [&] (iocb& io) {
+        uint64_t block;
+        if (sequential) {
+            block = next_block;
+            next_block = (next_block + 1) % nr_blocks;
+        } else {
+            block = pos_distribution(random_generator);
+        }
+        if (dir == io_direction::read) {
+            io_prep_pread(&io, _test_file.file.get(), buf.get(), size, block * size);
+        } else {
+            io_prep_pwrite(&io, _test_file.file.get(), buf.get(), size, block * size);
+        }
+    };
+
+    std::vector<iocb> iocbs(concurrency);
+    std::vector<iocb*> iocb_vecptr;
+    std::vector<io_event> ev(concurrency);
+    for (auto& io : iocbs) {
+        prepare(io);
+        iocb_vecptr.push_back(&io);
+    }
+
+    auto start = clock::now();
+    auto end = start + duration;
+    r = ::io_submit(io_context, iocb_vecptr.size(), iocb_vecptr.data());
+    throw_kernel_error(r);
+    unsigned outstanding = concurrency;
+    uint64_t completed = 0;
+    while (outstanding) {
+        int n = ::io_getevents(io_context, 1, ev.size(), ev.data(), nullptr);
+        throw_kernel_error(n);
+        auto now = clock::now();
+        unsigned new_req = 0;
+        for (auto i = 0ul; i < size_t(n); ++i) {
+            sanity_check_ev(ev[i], size);
+            ++completed;
+            --outstanding;
+            if (now < end) {
+                prepare(*ev[i].obj);
+                iocb_vecptr[new_req++] = ev[i].obj;
+            }
+        }
+        if (new_req) {
+            r = ::io_submit(io_context, new_req, iocb_vecptr.data());
+            throw_kernel_error(r);
+            outstanding += new_req;
+        }
+    }
+    std::cout << "." << std::flush;
+    return completed / std::chrono::duration<double>(clock::now() - start).count();
+}
+
 void test_file::generate(iotune_manager& iotune_manager, std::chrono::seconds timeout) {
     auto to_gb = [] (auto b) {
         return float(b) / (1ull << 30);
@@ -636,7 +727,12 @@ void test_file::generate(iotune_manager& iotune_manager, std::chrono::seconds ti
               << " seconds" << std::endl;
 }
 
-uint32_t io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono::seconds timeout) {
+struct iotune_result {
+    uint32_t max_io_requests;
+    io_properties properties;
+};
+
+iotune_result io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono::seconds timeout) {
     iotune_manager iotune_manager(cpus.size(), dir, timeout);
 
     for (auto i = 0ul; i < cpus.size(); ++i) {
@@ -649,25 +745,47 @@ uint32_t io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono
         });
     }
 
-    return iotune_manager.finish_estimate();
+    iotune_result result;
+    result.max_io_requests = iotune_manager.finish_estimate();
+    result.properties = iotune_manager.measure_properties();
+    return result;
 }
 
-int write_configuration_file(std::string conf_file, std::string format, unsigned max_io_requests, std::experimental::optional<unsigned> num_io_queues = {}) {
-    std::cout << "Recommended --max-io-requests: " << max_io_requests << std::endl;
-    if (num_io_queues) {
-        std::cout << "Recommended --num-io-queues: " << *num_io_queues << std::endl;
-    }
-
+boost::filesystem::path expand_path(std::string path) {
     wordexp_t k;
     // Do tilde expansion if needed, but since we get the directory from the user, it
     // can be anything. So just rely on posix for that.
-    wordexp(conf_file.c_str(), &k, 0);
+    wordexp(path.c_str(), &k, 0);
     assert(k.we_wordc == 1);
-    boost::filesystem::path conf_path(k.we_wordv[0]);
+    boost::filesystem::path ret(k.we_wordv[0]);
     wordfree(&k);
+    return ret;
+}
+
+int write_configuration_file(std::string conf_file, std::string format, unsigned max_io_requests,
+        std::string properties_file, const io_properties& properties, std::experimental::optional<unsigned> num_io_queues = {}) {
+    std::cout << "Recommended --max-io-requests: " << max_io_requests << std::endl;
+    if (num_io_queues) {
+        std::cout << "Recommended --num-io-queues: " << *num_io_queues << std::endl;
+    }
+
+    auto conf_path = expand_path(conf_file);
+    auto properties_path = expand_path(properties_file);
 
     auto error_msg = " when writing configuration file. Please add them to your seastar command line";
     try {
+        boost::filesystem::create_directories(properties_path.parent_path());
+        std::ofstream ofs_props;
+        ofs_props.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        ofs_props.open(properties_path.string(), std::ofstream::trunc);
+        ofs_props << std::fixed << std::setprecision(0);
+        ofs_props << "read-iops=" << properties.read_iops << std::endl;
+        ofs_props << "read-bandwidth=" << properties.read_bandwidth << std::endl;
+        ofs_props << "write-iops=" << properties.write_iops << std::endl;
+        ofs_props << "write-bandwidth=" << properties.write_bandwidth << std::endl;
+        ofs_props.close();
+        std::cout << "Written the disk properties to " << properties_path.string() << std::endl;
+
         boost::filesystem::create_directories(conf_path.parent_path());
         std::ofstream ofs_io;
         ofs_io.exceptions(std::ofstream::failbit | std::ofstream::badbit);
@@ -678,11 +796,13 @@ int write_configuration_file(std::string conf_file, std::string format, unsigned
                 if (num_io_queues) {
                     ofs_io << "num-io-queues=" << *num_io_queues << std::endl;
                 }
+                ofs_io << "io-properties-file=" << properties_path.string() << std::endl;
             } else {
                 ofs_io << "SEASTAR_IO=\"--max-io-requests=" << max_io_requests;
                 if (num_io_queues) {
                     ofs_io << " --num-io-queues=" << *num_io_queues;
                 }
+                ofs_io << " --io-properties-file=" << properties_path.string();
                 ofs_io << "\"" << std::endl;
             }
         }
@@ -708,6 +828,7 @@ int main(int ac, char** av) {
         ("evaluation-directory", bpo::value<sstring>()->required(), "directory where to execute the evaluation")
         ("cpuset", bpo::value<cpuset_bpo_wrapper>(), "CPUs to use (in cpuset(7) format; default: all))")
         ("options-file", bpo::value<sstring>()->default_value("~/.config/seastar/io.conf"), "Output configuration file")
+        ("properties-file", bpo::value<sstring>()->default_value("~/.config/seastar/io-properties.conf"), "Output file for the measured disk IOPS and bandwidth, referenced from the configuration file")
         ("format", bpo::value<sstring>()->default_value("seastar"), "Configuration file format (seastar | envfile)")
         ("timeout", bpo::value<uint64_t>()->default_value(60 * 6), "Maximum time to wait for iotune to finish (seconds)")
         ("fs-check", bpo::bool_switch(&fs_check), "perform FS check only")
@@ -732,6 +853,7 @@ int main(int ac, char** av) {
     bpo::notify(configuration);
 
     auto conf_file = configuration["options-file"].as<sstring>();
+    auto properties_file = configuration["properties-file"].as<sstring>();
 
     std::vector<unsigned> cpuvec;
     sstring directory;
@@ -758,7 +880,8 @@ int main(int ac, char** av) {
     auto timeout = std::chrono::seconds(configuration["timeout"].as<uint64_t>());
 
     try {
-        auto iodepth = io_queue_discovery(directory, cpuvec, timeout);
+        auto result = io_queue_discovery(directory, cpuvec, timeout);
+        auto iodepth = result.max_io_requests;
         auto num_io_queues = cpuvec.size();
         if (iodepth / num_io_queues < 4) {
             num_io_queues = iodepth / 4;
@@ -766,9 +889,9 @@ int main(int ac, char** av) {
 
         if (num_io_queues != cpuvec.size()) {
             iodepth = (iodepth / num_io_queues) * num_io_queues;
-            return write_configuration_file(conf_file, format, iodepth, num_io_queues);
+            return write_configuration_file(conf_file, format, iodepth, properties_file, result.properties, num_io_queues);
         } else {
-            return write_configuration_file(conf_file, format, iodepth);
+            return write_configuration_file(conf_file, format, iodepth, properties_file, result.properties);
         }
     } catch (iotune_timeout_exception &e) {
         // Otherwise we'll coredump on the exception, but this can happen
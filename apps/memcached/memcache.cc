@@ -31,6 +31,7 @@
 #include "core/timer-set.hh"
 #include "core/shared_ptr.hh"
 #include "core/stream.hh"
+#include "core/cord.hh"
 #include "core/memory.hh"
 #include "core/units.hh"
 #include "core/distributed.hh"
@@ -502,7 +503,7 @@ class cache {
         }
     }
 public:
-    cache(uint64_t per_cpu_slab_size, uint64_t slab_page_size)
+    cache(uint64_t per_cpu_slab_size, uint64_t slab_page_size, uint64_t per_cpu_slab_budget)
         : _buckets(new cache_type::bucket_type[initial_bucket_count])
         , _cache(cache_type::bucket_traits(_buckets, initial_bucket_count))
     {
@@ -517,6 +518,9 @@ class cache {
         // initialize per-thread slab allocator.
         slab = new slab_allocator<item>(default_slab_growth_factor, per_cpu_slab_size, slab_page_size,
                 [this](item& item_ref) { erase<true, true, false>(item_ref); _stats._evicted++; });
+        if (per_cpu_slab_budget) {
+            slab->budget().set_limit(per_cpu_slab_budget);
+        }
 #ifdef __DEBUG__
         static bool print_slab_classes = true;
         if (print_slab_classes) {
@@ -929,12 +933,12 @@ class ascii_protocol {
     }
 
     template <typename Value>
-    static future<> print_stat(output_stream<char>& out, const char* key, Value value) {
-        return out.write(msg_stat)
-                .then([&out, key] { return out.write(key); })
-                .then([&out] { return out.write(" "); })
-                .then([&out, value] { return out.write(to_sstring(value)); })
-                .then([&out] { return out.write(msg_crlf); });
+    static void print_stat(cord& response, const char* key, Value value) {
+        response.append(msg_stat);
+        response.append(key);
+        response.append(" ", 1);
+        response.append(to_sstring(value));
+        response.append(msg_crlf);
     }
 
     future<> print_stats(output_stream<char>& out) {
@@ -944,78 +948,47 @@ class ascii_protocol {
                     auto now = clock_type::now();
                     auto total_items = all_cache_stats._set_replaces + all_cache_stats._set_adds
                         + all_cache_stats._cas_hits;
-                    return print_stat(out, "pid", getpid())
-                        .then([this, now, &out, uptime = now - all_system_stats._start_time] {
-                            return print_stat(out, "uptime",
-                                std::chrono::duration_cast<std::chrono::seconds>(uptime).count());
-                        }).then([this, now, &out] {
-                            return print_stat(out, "time",
-                                std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
-                        }).then([this, &out] {
-                            return print_stat(out, "version", VERSION_STRING);
-                        }).then([this, &out] {
-                            return print_stat(out, "pointer_size", sizeof(void*)*8);
-                        }).then([this, &out, v = all_system_stats._curr_connections] {
-                            return print_stat(out, "curr_connections", v);
-                        }).then([this, &out, v = all_system_stats._total_connections] {
-                            return print_stat(out, "total_connections", v);
-                        }).then([this, &out, v = all_system_stats._curr_connections] {
-                            return print_stat(out, "connection_structures", v);
-                        }).then([this, &out, v = all_system_stats._cmd_get] {
-                            return print_stat(out, "cmd_get", v);
-                        }).then([this, &out, v = all_system_stats._cmd_set] {
-                            return print_stat(out, "cmd_set", v);
-                        }).then([this, &out, v = all_system_stats._cmd_flush] {
-                            return print_stat(out, "cmd_flush", v);
-                        }).then([this, &out] {
-                            return print_stat(out, "cmd_touch", 0);
-                        }).then([this, &out, v = all_cache_stats._get_hits] {
-                            return print_stat(out, "get_hits", v);
-                        }).then([this, &out, v = all_cache_stats._get_misses] {
-                            return print_stat(out, "get_misses", v);
-                        }).then([this, &out, v = all_cache_stats._delete_misses] {
-                            return print_stat(out, "delete_misses", v);
-                        }).then([this, &out, v = all_cache_stats._delete_hits] {
-                            return print_stat(out, "delete_hits", v);
-                        }).then([this, &out, v = all_cache_stats._incr_misses] {
-                            return print_stat(out, "incr_misses", v);
-                        }).then([this, &out, v = all_cache_stats._incr_hits] {
-                            return print_stat(out, "incr_hits", v);
-                        }).then([this, &out, v = all_cache_stats._decr_misses] {
-                            return print_stat(out, "decr_misses", v);
-                        }).then([this, &out, v = all_cache_stats._decr_hits] {
-                            return print_stat(out, "decr_hits", v);
-                        }).then([this, &out, v = all_cache_stats._cas_misses] {
-                            return print_stat(out, "cas_misses", v);
-                        }).then([this, &out, v = all_cache_stats._cas_hits] {
-                            return print_stat(out, "cas_hits", v);
-                        }).then([this, &out, v = all_cache_stats._cas_badval] {
-                            return print_stat(out, "cas_badval", v);
-                        }).then([this, &out] {
-                            return print_stat(out, "touch_hits", 0);
-                        }).then([this, &out] {
-                            return print_stat(out, "touch_misses", 0);
-                        }).then([this, &out] {
-                            return print_stat(out, "auth_cmds", 0);
-                        }).then([this, &out] {
-                            return print_stat(out, "auth_errors", 0);
-                        }).then([this, &out] {
-                            return print_stat(out, "threads", smp::count);
-                        }).then([this, &out, v = all_cache_stats._size] {
-                            return print_stat(out, "curr_items", v);
-                        }).then([this, &out, v = total_items] {
-                            return print_stat(out, "total_items", v);
-                        }).then([this, &out, v = all_cache_stats._expired] {
-                            return print_stat(out, "seastar.expired", v);
-                        }).then([this, &out, v = all_cache_stats._resize_failure] {
-                            return print_stat(out, "seastar.resize_failure", v);
-                        }).then([this, &out, v = all_cache_stats._evicted] {
-                            return print_stat(out, "evictions", v);
-                        }).then([this, &out, v = all_cache_stats._bytes] {
-                            return print_stat(out, "bytes", v);
-                        }).then([&out] {
-                            return out.write(msg_end);
-                        });
+                    // Built as a cord, the whole response is a few chunks
+                    // handed over in a single write.
+                    cord response;
+                    print_stat(response, "pid", getpid());
+                    print_stat(response, "uptime", std::chrono::duration_cast<std::chrono::seconds>(
+                            now - all_system_stats._start_time).count());
+                    print_stat(response, "time", std::chrono::duration_cast<std::chrono::seconds>(
+                            now.time_since_epoch()).count());
+                    print_stat(response, "version", VERSION_STRING);
+                    print_stat(response, "pointer_size", sizeof(void*)*8);
+                    print_stat(response, "curr_connections", all_system_stats._curr_connections);
+                    print_stat(response, "total_connections", all_system_stats._total_connections);
+                    print_stat(response, "connection_structures", all_system_stats._curr_connections);
+                    print_stat(response, "cmd_get", all_system_stats._cmd_get);
+                    print_stat(response, "cmd_set", all_system_stats._cmd_set);
+                    print_stat(response, "cmd_flush", all_system_stats._cmd_flush);
+                    print_stat(response, "cmd_touch", 0);
+                    print_stat(response, "get_hits", all_cache_stats._get_hits);
+                    print_stat(response, "get_misses", all_cache_stats._get_misses);
+                    print_stat(response, "delete_misses", all_cache_stats._delete_misses);
+                    print_stat(response, "delete_hits", all_cache_stats._delete_hits);
+                    print_stat(response, "incr_misses", all_cache_stats._incr_misses);
+                    print_stat(response, "incr_hits", all_cache_stats._incr_hits);
+                    print_stat(response, "decr_misses", all_cache_stats._decr_misses);
+                    print_stat(response, "decr_hits", all_cache_stats._decr_hits);
+                    print_stat(response, "cas_misses", all_cache_stats._cas_misses);
+                    print_stat(response, "cas_hits", all_cache_stats._cas_hits);
+                    print_stat(response, "cas_badval", all_cache_stats._cas_badval);
+                    print_stat(response, "touch_hits", 0);
+                    print_stat(response, "touch_misses", 0);
+                    print_stat(response, "auth_cmds", 0);
+                    print_stat(response, "auth_errors", 0);
+                    print_stat(response, "threads", smp::count);
+                    print_stat(response, "curr_items", all_cache_stats._size);
+                    print_stat(response, "total_items", total_items);
+                    print_stat(response, "seastar.expired", all_cache_stats._expired);
+                    print_stat(response, "seastar.resize_failure", all_cache_stats._resize_failure);
+                    print_stat(response, "evictions", all_cache_stats._evicted);
+                    print_stat(response, "bytes", all_cache_stats._bytes);
+                    response.append(msg_end);
+                    return out.write(std::move(response));
                 });
         });
     }
@@ -1416,6 +1389,8 @@ int main(int ac, char** av) {
              "Maximum memory to be used for items (value in megabytes) (reclaimer is disabled if set)")
         ("slab-page-size", bpo::value<uint64_t>()->default_value(memcache::default_slab_page_size/MB),
              "Size of slab page (value in megabytes)")
+        ("slab-budget", bpo::value<uint64_t>()->default_value(0),
+             "Memory for items beyond which the cache is reclaimed from before anything else when memory runs low (value in megabytes) (0 for no preference; ignored with max-slab-size)")
         ("stats",
              "Print basic statistics periodically (every second)")
         ("port", bpo::value<uint16_t>()->default_value(11211),
@@ -1432,7 +1407,8 @@ int main(int ac, char** av) {
         uint16_t port = config["port"].as<uint16_t>();
         uint64_t per_cpu_slab_size = config["max-slab-size"].as<uint64_t>() * MB;
         uint64_t slab_page_size = config["slab-page-size"].as<uint64_t>() * MB;
-        return cache_peers.start(std::move(per_cpu_slab_size), std::move(slab_page_size)).then([&system_stats] {
+        uint64_t per_cpu_slab_budget = config["slab-budget"].as<uint64_t>() * MB;
+        return cache_peers.start(std::move(per_cpu_slab_size), std::move(slab_page_size), std::move(per_cpu_slab_budget)).then([&system_stats] {
             return system_stats.start(memcache::clock_type::now());
         }).then([&] {
             std::cout << PLATFORM << " memcached " << VERSION << "\n";
@@ -174,6 +174,7 @@ tests = [
     'tests/timertest',
     'tests/tcp_test',
     'tests/futures_test',
+    'tests/coroutines_test',
     'tests/alloc_test',
     'tests/foreign_ptr_test',
     'tests/smp_test',
@@ -197,13 +198,21 @@ tests = [
     'tests/rpc',
     'tests/semaphore_test',
     'tests/packet_test',
+    'tests/cord_test',
     'tests/tls_test',
     'tests/fair_queue_test',
+    'tests/io_queue_test',
     'tests/rpc_test',
     'tests/connect_test',
+    'tests/receive_buffer_test',
     'tests/chunked_fifo_test',
+    'tests/timer_wheel_test',
+    'tests/stall_detector_test',
     'tests/scollectd_test',
     'tests/perf/perf_fstream',
+    'tests/perf/perf_timers',
+    'tests/perf/perf_future',
+    'tests/perf/perf_cross_cpu_free',
     ]
 
 apps = [
@@ -244,6 +253,8 @@ arg_parser.add_argument('--enable-dpdk', action = 'store_true', dest = 'dpdk', d
                         help = 'Enable dpdk (from included dpdk sources)')
 arg_parser.add_argument('--dpdk-target', action = 'store', dest = 'dpdk_target', default = '',
                         help = 'Path to DPDK SDK target location (e.g. <DPDK SDK dir>/x86_64-native-linuxapp-gcc)')
+arg_parser.add_argument('--enable-coroutines', dest = 'coroutines', action = 'store_true', default = False,
+                        help = 'Enable co_await support for futures (core/coroutine.hh); needs g++ >= 10 or clang with coroutines TS')
 arg_parser.add_argument('--debuginfo', action = 'store', dest = 'debuginfo', type = int, default = 1,
                         help = 'Enable(1)/disable(0)compiler debug information generation')
 arg_parser.add_argument('--tests-debuginfo', action='store', dest='tests_debuginfo', type=int, default=0,
@@ -252,6 +263,7 @@ arg_parser.add_argument('--static-stdc++', dest = 'staticcxx', action = 'store_t
                         help = 'Link libgcc and libstdc++ statically')
 add_tristate(arg_parser, name = 'hwloc', dest = 'hwloc', help = 'hwloc support')
 add_tristate(arg_parser, name = 'xen', dest = 'xen', help = 'Xen support')
+add_tristate(arg_parser, name = 'liburing', dest = 'liburing', help = 'io_uring reactor backend')
 args = arg_parser.parse_args()
 
 libnet = [
@@ -374,6 +386,7 @@ deps = {
     'tests/tcp_test': ['tests/tcp_test.cc'] + core + libnet,
     'tests/timertest': ['tests/timertest.cc'] + core,
     'tests/futures_test': ['tests/futures_test.cc'] + core + boost_test_lib,
+    'tests/coroutines_test': ['tests/coroutines_test.cc'] + core + boost_test_lib,
     'tests/alloc_test': ['tests/alloc_test.cc'] + core + boost_test_lib,
     'tests/foreign_ptr_test': ['tests/foreign_ptr_test.cc'] + core + boost_test_lib,
     'tests/semaphore_test': ['tests/semaphore_test.cc'] + core + boost_test_lib,
@@ -386,6 +399,7 @@ deps = {
     'tests/tcp_sctp_client': ['tests/tcp_sctp_client.cc'] + core + libnet,
     'tests/tls_test': ['tests/tls_test.cc'] + core + libnet + boost_test_lib,
     'tests/fair_queue_test': ['tests/fair_queue_test.cc'] + core + boost_test_lib,
+    'tests/io_queue_test': ['tests/io_queue_test.cc'] + core + boost_test_lib,
     'apps/seawreck/seawreck': ['apps/seawreck/seawreck.cc', 'http/http_response_parser.rl'] + core + libnet,
     'apps/fair_queue_tester/fair_queue_tester': ['apps/fair_queue_tester/fair_queue_tester.cc'] + core,
     'apps/iotune/iotune': ['apps/iotune/iotune.cc', 'apps/iotune/fsqual.cc'] + core,
@@ -421,10 +435,17 @@ deps = {
     'tests/rpc': ['tests/rpc.cc'] + core + libnet,
     'tests/rpc_test': ['tests/rpc_test.cc'] + core + libnet + boost_test_lib,
     'tests/packet_test': ['tests/packet_test.cc'] + core + libnet,
+    'tests/cord_test': ['tests/cord_test.cc'] + core + libnet,
     'tests/connect_test': ['tests/connect_test.cc'] + core + libnet + boost_test_lib,
+    'tests/receive_buffer_test': ['tests/receive_buffer_test.cc'] + core + libnet + boost_test_lib,
     'tests/chunked_fifo_test': ['tests/chunked_fifo_test.cc'] + core,
+    'tests/timer_wheel_test': ['tests/timer_wheel_test.cc'] + core,
+    'tests/stall_detector_test': ['tests/stall_detector_test.cc'] + core + boost_test_lib,
     'tests/scollectd_test': ['tests/scollectd_test.cc'] + core + boost_test_lib,
     'tests/perf/perf_fstream': ['tests/perf/perf_fstream.cc'] + core,
+    'tests/perf/perf_timers': ['tests/perf/perf_timers.cc'] + core,
+    'tests/perf/perf_future': ['tests/perf/perf_future.cc'] + core,
+    'tests/perf/perf_cross_cpu_free': ['tests/perf/perf_cross_cpu_free.cc'] + core,
 }
 
 warnings = [
@@ -444,6 +465,7 @@ warnings = [
 if args.with_osv:
     args.so = True
     args.hwloc = False
+    args.liburing = False
     args.user_cflags = (args.user_cflags +
         ' -DDEFAULT_ALLOCATOR -fvisibility=default -DHAVE_OSV -I' +
         args.with_osv + ' -I' + args.with_osv + '/include -I' +
@@ -555,6 +577,25 @@ if apply_tristate(args.hwloc, test = have_hwloc,
     defines.append('HAVE_HWLOC')
     defines.append('HAVE_NUMA')
 
+def have_liburing():
+    return try_compile(compiler = args.cxx, source = '#include <liburing.h>\nint x = IORING_OP_SENDMSG;')
+
+if apply_tristate(args.liburing, test = have_liburing,
+                  note = 'Note: liburing-devel not installed.  No io_uring reactor backend.',
+                  missing = 'Error: required package liburing-devel not installed.'):
+    libs += ' -luring'
+    defines.append('HAVE_LIBURING')
+
+if args.coroutines:
+    coroutine_test = '#if __has_include(<coroutine>)\n#include <coroutine>\n#else\n#include <experimental/coroutine>\n#endif\n'
+    coroutine_flags = [f for f in ['-fcoroutines', '-fcoroutines-ts']
+                       if try_compile(compiler = args.cxx, source = coroutine_test, flags = ['-std=gnu++1y', f])]
+    if not coroutine_flags:
+        print('Error: --enable-coroutines: {} does not support coroutines.'.format(args.cxx))
+        sys.exit(1)
+    args.user_cflags += ' ' + coroutine_flags[0]
+    defines.append('SEASTAR_COROUTINES_ENABLED')
+
 if args.so:
     args.pie = '-shared'
     args.fpie = '-fpic'
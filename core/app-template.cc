@@ -86,6 +86,11 @@ app_template::run_deprecated(int ac, char ** av, std::function<void ()>&& func)
 #ifdef DEBUG
     print("WARNING: debug mode. Not for benchmarking or production\n");
 #endif
+    using clock = std::chrono::steady_clock;
+    auto ms = [] (clock::time_point from, clock::time_point to) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+    };
+    auto start = clock::now();
     bpo::variables_map configuration;
     try {
         bpo::store(bpo::command_line_parser(ac, av)
@@ -114,10 +119,19 @@ app_template::run_deprecated(int ac, char ** av, std::function<void ()>&& func)
         return 1;
     }
     configuration.emplace("argv0", boost::program_options::variable_value(std::string(av[0]), false));
+    auto options_parsed = clock::now();
+    // Includes setting up (and, with --lock-memory, faulting in) the
+    // memory of all shards.
     smp::configure(configuration);
+    auto smp_configured = clock::now();
     _configuration = {std::move(configuration)};
-    engine().when_started().then([this] {
+    engine().when_started().then([=] {
+        auto started = clock::now();
         scollectd::configure( this->configuration());
+        auto done = clock::now();
+        seastar_logger.info("Startup took {} ms: options {} ms, smp and memory {} ms, reactor start {} ms, collectd {} ms",
+                ms(start, done), ms(start, options_parsed), ms(options_parsed, smp_configured),
+                ms(smp_configured, started), ms(started, done));
     }).then(
         std::move(func)
     ).then_wrapped([] (auto&& f) {
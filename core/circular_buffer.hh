@@ -59,7 +59,7 @@ class circular_buffer {
     circular_buffer(const circular_buffer& X) = delete;
     ~circular_buffer();
     circular_buffer& operator=(const circular_buffer&) = delete;
-    circular_buffer& operator=(circular_buffer&&) = delete;
+    circular_buffer& operator=(circular_buffer&&) noexcept;
     void push_front(const T& data);
     void push_front(T&& data);
     template <typename... A>
@@ -227,6 +227,17 @@ circular_buffer<T, Alloc>::circular_buffer(circular_buffer&& x)
     x._impl = {};
 }
 
+template <typename T, typename Alloc>
+inline
+circular_buffer<T, Alloc>&
+circular_buffer<T, Alloc>::operator=(circular_buffer&& x) noexcept {
+    if (this != &x) {
+        circular_buffer tmp(std::move(x));
+        std::swap(_impl, tmp._impl);
+    }
+    return *this;
+}
+
 template <typename T, typename Alloc>
 template <typename Func>
 inline
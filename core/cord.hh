@@ -0,0 +1,254 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "core/temporary_buffer.hh"
+#include "core/circular_buffer.hh"
+#include "core/scattered_message.hh"
+#include "core/sstring.hh"
+#include "net/packet.hh"
+#include <algorithm>
+#include <cstring>
+
+/// \addtogroup memory-module
+/// @{
+
+/// A string made of a chain of \ref temporary_buffer fragments.
+///
+/// A \c basic_cord is meant for building output, such as a response, out of
+/// many pieces: buffers and strings that are already owned are added as
+/// fragments of their own, without copying, on either end of the cord.  Small
+/// pieces that have to be copied (formatted numbers, separators) are packed
+/// into shared chunks instead, so that they do not each cost a fragment and an
+/// allocation.
+///
+/// The result is handed over as a \ref net::packet or a
+/// \ref scattered_message, or written directly to an \ref output_stream,
+/// without ever being linearized.
+///
+/// \tparam CharType underlying character type (must be a variant of \c char).
+template <typename CharType>
+class basic_cord {
+    static_assert(sizeof(CharType) == 1, "must hold a string of bytes");
+public:
+    using char_type = CharType;
+    using buffer_type = temporary_buffer<char_type>;
+    using const_iterator = typename circular_buffer<buffer_type>::const_iterator;
+    /// Pieces up to this size are copied into a shared chunk instead of being
+    /// added as fragments of their own.
+    static constexpr size_t max_copy_size = 128;
+    static constexpr size_t chunk_size = 512;
+private:
+    circular_buffer<buffer_type> _fragments;
+    size_t _size = 0;
+    // Chunk the small copied pieces are packed into, and how much of it is used.
+    buffer_type _chunk;
+    size_t _chunk_used = 0;
+    // Set when the last fragment is the end of _chunk, so that the next copied
+    // piece can extend it instead of adding a fragment.
+    bool _last_in_chunk = false;
+    size_t _last_start = 0;
+public:
+    basic_cord() = default;
+    basic_cord(basic_cord&&) = default;
+    basic_cord(const basic_cord&) = delete;
+    basic_cord& operator=(basic_cord&&) = default;
+
+    /// Appends a buffer as a fragment, without copying it.
+    void append(buffer_type buf) {
+        if (buf.empty()) {
+            return;
+        }
+        _size += buf.size();
+        _fragments.push_back(std::move(buf));
+        _last_in_chunk = false;
+    }
+
+    /// Appends a copy of \c n characters starting at \c s.
+    void append(const char_type* s, size_t n) {
+        if (!n) {
+            return;
+        }
+        if (n > max_copy_size) {
+            append(buffer_type(s, n));
+            return;
+        }
+        if (_chunk.size() - _chunk_used < n) {
+            _chunk = buffer_type(chunk_size);
+            _chunk_used = 0;
+            _last_in_chunk = false;
+        }
+        std::copy_n(s, n, _chunk.get_write() + _chunk_used);
+        if (!_last_in_chunk) {
+            _last_start = _chunk_used;
+            _fragments.push_back(buffer_type());
+            _last_in_chunk = true;
+        }
+        _chunk_used += n;
+        _size += n;
+        _fragments.back() = _chunk.share(_last_start, _chunk_used - _last_start);
+    }
+
+    /// Appends a copy of a null-terminated string.
+    void append(const char_type* s) {
+        append(s, strlen(s));
+    }
+
+    /// Appends a string; long strings are moved in as a fragment, short ones
+    /// are copied.
+    template <typename size_type, size_type max_size>
+    void append(basic_sstring<char_type, size_type, max_size> s) {
+        if (s.size() <= max_copy_size) {
+            append(s.begin(), s.size());
+        } else {
+            append(std::move(s).release());
+        }
+    }
+
+    /// Appends data that outlives the cord (such as a string literal),
+    /// without copying it.
+    void append_static(const char_type* s, size_t n) {
+        append(buffer_type(const_cast<char_type*>(s), n, deleter()));
+    }
+
+    template <size_t N>
+    void append_static(const char_type(&s)[N]) {
+        append_static(s, N - 1);
+    }
+
+    /// Prepends a buffer as a fragment, without copying it.
+    void prepend(buffer_type buf) {
+        if (buf.empty()) {
+            return;
+        }
+        _size += buf.size();
+        if (_fragments.empty()) {
+            _last_in_chunk = false;
+        }
+        _fragments.push_front(std::move(buf));
+    }
+
+    /// Prepends a copy of \c n characters starting at \c s.
+    void prepend(const char_type* s, size_t n) {
+        prepend(buffer_type(s, n));
+    }
+
+    /// Prepends a string, without copying it.
+    template <typename size_type, size_type max_size>
+    void prepend(basic_sstring<char_type, size_type, max_size> s) {
+        prepend(std::move(s).release());
+    }
+
+    /// Prepends data that outlives the cord, without copying it.
+    void prepend_static(const char_type* s, size_t n) {
+        prepend(buffer_type(const_cast<char_type*>(s), n, deleter()));
+    }
+
+    template <size_t N>
+    void prepend_static(const char_type(&s)[N]) {
+        prepend_static(s, N - 1);
+    }
+
+    /// Appends the fragments of another cord, without copying them.
+    void append(basic_cord&& x) {
+        for (auto&& buf : x._fragments) {
+            append(std::move(buf));
+        }
+        x.clear();
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return !_size;
+    }
+
+    size_t fragment_count() const {
+        return _fragments.size();
+    }
+
+    /// Iterates over the fragments, in order.
+    const_iterator begin() const {
+        return _fragments.begin();
+    }
+
+    const_iterator end() const {
+        return _fragments.end();
+    }
+
+    void clear() {
+        while (!_fragments.empty()) {
+            _fragments.pop_back();
+        }
+        _size = 0;
+        _chunk = buffer_type();
+        _chunk_used = 0;
+        _last_in_chunk = false;
+    }
+
+    /// Returns a cord sharing the fragments of this one.
+    basic_cord share() {
+        basic_cord ret;
+        for (auto& buf : _fragments) {
+            ret.append(buf.share());
+        }
+        return ret;
+    }
+
+    /// Copies the contents into a single string.  Meant for tests and
+    /// diagnostics; output should be sent with release() instead.
+    basic_sstring<char_type, uint32_t, 15> linearize() const {
+        basic_sstring<char_type, uint32_t, 15> ret(
+                typename basic_sstring<char_type, uint32_t, 15>::initialized_later(), _size);
+        auto p = ret.begin();
+        for (auto& buf : _fragments) {
+            p = std::copy_n(buf.get(), buf.size(), p);
+        }
+        return ret;
+    }
+
+    /// Converts the cord into a packet with one fragment per cord fragment.
+    net::packet release() && {
+        static_assert(std::is_same<char_type, char>::value, "packet works on char");
+        net::packet p(_fragments.size());
+        for (auto&& buf : _fragments) {
+            p = net::packet(std::move(p), std::move(buf));
+        }
+        clear();
+        return p;
+    }
+
+    /// Moves the fragments to the end of a \ref scattered_message.
+    void release_into(scattered_message<char_type>& msg) && {
+        msg.reserve(_fragments.size());
+        for (auto&& buf : _fragments) {
+            msg.append(std::move(buf));
+        }
+        clear();
+    }
+};
+
+using cord = basic_cord<char>;
+
+/// @}
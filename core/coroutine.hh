@@ -0,0 +1,182 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "future.hh"
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define SEASTAR_COROUTINE_NAMESPACE std
+#elif defined(__cpp_coroutines)
+#include <experimental/coroutine>
+#define SEASTAR_COROUTINE_NAMESPACE std::experimental
+#else
+#error "Coroutines support disabled (configure with --enable-coroutines)"
+#endif
+
+/// \file
+/// \brief Coroutine support for \ref future.
+///
+/// Including this header makes a function returning \c future<T...> a
+/// valid coroutine:
+///
+/// \code
+/// future<int> read_length(input_stream<char>& in) {
+///     auto buf = co_await in.read();
+///     co_return buf.size();
+/// }
+/// \endcode
+///
+/// The coroutine frame is the only allocation on the fast path: awaiting an
+/// available future continues the coroutine directly, without scheduling a
+/// task. Awaiting a future that is not yet available suspends the
+/// coroutine until the future resolves, at the cost of one continuation.
+///
+/// \c co_await of a \c future<> yields nothing, of a \c future<T> yields
+/// the value, and of a \c future<T1, T2...> yields a \c std::tuple. A
+/// failed future rethrows its exception at the \c co_await; an exception
+/// escaping the coroutine fails the returned future.
+
+namespace seastar {
+
+/// \cond internal
+namespace internal {
+
+template <typename T = void>
+using coroutine_handle = SEASTAR_COROUTINE_NAMESPACE::coroutine_handle<T>;
+using suspend_never = SEASTAR_COROUTINE_NAMESPACE::suspend_never;
+
+template <typename... T>
+class coroutine_promise_base {
+protected:
+    promise<T...> _promise;
+public:
+    future<T...> get_return_object() noexcept {
+        return _promise.get_future();
+    }
+    suspend_never initial_suspend() noexcept {
+        return { };
+    }
+    suspend_never final_suspend() noexcept {
+        return { };
+    }
+    void unhandled_exception() noexcept {
+        _promise.set_exception(std::current_exception());
+    }
+};
+
+template <typename... T>
+class coroutine_traits_base {
+public:
+    class promise_type final : public coroutine_promise_base<T...> {
+    public:
+        void return_value(std::tuple<T...>&& value) noexcept {
+            this->_promise.set_value(std::move(value));
+        }
+    };
+};
+
+template <typename T>
+class coroutine_traits_base<T> {
+public:
+    class promise_type final : public coroutine_promise_base<T> {
+    public:
+        template <typename U>
+        void return_value(U&& value) {
+            this->_promise.set_value(std::forward<U>(value));
+        }
+    };
+};
+
+template <>
+class coroutine_traits_base<> {
+public:
+    class promise_type final : public coroutine_promise_base<> {
+    public:
+        void return_void() noexcept {
+            this->_promise.set_value();
+        }
+    };
+};
+
+template <typename... T>
+class awaiter_base {
+protected:
+    future<T...> _future;
+public:
+    explicit awaiter_base(future<T...>&& f) noexcept : _future(std::move(f)) { }
+    bool await_ready() noexcept {
+        return _future.available();
+    }
+    void await_suspend(coroutine_handle<> h) {
+        _future.schedule_resume(h);
+    }
+};
+
+template <typename... T>
+class awaiter : public awaiter_base<T...> {
+public:
+    using awaiter_base<T...>::awaiter_base;
+    std::tuple<T...> await_resume() {
+        return this->_future.get_available();
+    }
+};
+
+template <typename T>
+class awaiter<T> : public awaiter_base<T> {
+public:
+    using awaiter_base<T>::awaiter_base;
+    T await_resume() {
+        return future_state<T>::get0(this->_future.get_available());
+    }
+};
+
+template <>
+class awaiter<> : public awaiter_base<> {
+public:
+    using awaiter_base<>::awaiter_base;
+    void await_resume() {
+        _future.get_available();
+    }
+};
+
+}
+/// \endcond
+
+}
+
+namespace SEASTAR_COROUTINE_NAMESPACE {
+
+template <typename... T, typename... Args>
+class coroutine_traits<future<T...>, Args...> : public seastar::internal::coroutine_traits_base<T...> {
+};
+
+}
+
+template <typename... T>
+inline
+seastar::internal::awaiter<T...>
+operator co_await(future<T...> f) noexcept {
+    return seastar::internal::awaiter<T...>(std::move(f));
+}
+
+#undef SEASTAR_COROUTINE_NAMESPACE
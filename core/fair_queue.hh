@@ -22,10 +22,10 @@
 #pragma once
 
 #include "future.hh"
-#include "semaphore.hh"
 #include "shared_ptr.hh"
 #include "print.hh"
 #include "circular_buffer.hh"
+#include "timer.hh"
 #include <queue>
 #include <type_traits>
 #include <experimental/optional>
@@ -38,18 +38,90 @@
 
 /// \cond internal
 class priority_class {
+    using clock_type = std::chrono::steady_clock;
     struct request {
         promise<> pr;
         unsigned weight;
+        size_t size;
     };
     friend class fair_queue;
     uint32_t _shares = 0;
     float _accumulated = 0;
     circular_buffer<request> _queue;
+    // In fair_queue::_handles
     bool _queued = false;
+    // Held back by the rate limits, see fair_queue::_parked_classes
+    bool _parked = false;
+
+    // Token buckets for the optional rate limits (zero means unlimited).
+    // They are allowed to go into debt, so that a request larger than the
+    // burst still goes through, and the class then waits for the debt to be
+    // paid back.
+    double _bytes_per_second = 0;
+    double _ops_per_second = 0;
+    double _byte_tokens = 0;
+    double _op_tokens = 0;
+    clock_type::time_point _last_refill;
+    bool _throttled = false;
+    clock_type::time_point _throttled_since;
+    clock_type::duration _throttled_time = clock_type::duration(0);
+
+    // How much a bucket can accumulate while the class is idle, in seconds
+    // worth of its rate.
+    static constexpr double burst_window = 0.01;
 
     friend struct shared_ptr_no_esft<priority_class>;
     explicit priority_class(uint32_t shares) : _shares(shares) {}
+
+    static double burst(double rate) {
+        return rate * burst_window;
+    }
+
+    void refill(clock_type::time_point now) {
+        auto elapsed = std::chrono::duration<double>(now - _last_refill).count();
+        _last_refill = now;
+        if (_bytes_per_second) {
+            _byte_tokens = std::min(_byte_tokens + elapsed * _bytes_per_second, burst(_bytes_per_second));
+        }
+        if (_ops_per_second) {
+            _op_tokens = std::min(_op_tokens + elapsed * _ops_per_second, burst(_ops_per_second));
+        }
+    }
+
+    bool may_dispatch() const {
+        return (!_bytes_per_second || _byte_tokens >= 0) && (!_ops_per_second || _op_tokens >= 0);
+    }
+
+    void consume(size_t size) {
+        if (_bytes_per_second) {
+            _byte_tokens -= size;
+        }
+        if (_ops_per_second) {
+            _op_tokens -= 1;
+        }
+    }
+
+    // Time until may_dispatch() becomes true again.
+    clock_type::duration time_to_dispatch() const {
+        double t = 0;
+        if (_bytes_per_second && _byte_tokens < 0) {
+            t = std::max(t, -_byte_tokens / _bytes_per_second);
+        }
+        if (_ops_per_second && _op_tokens < 0) {
+            t = std::max(t, -_op_tokens / _ops_per_second);
+        }
+        return std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(t))
+                + clock_type::duration(1);
+    }
+
+    void set_throttled(bool throttled, clock_type::time_point now) {
+        if (throttled && !_throttled) {
+            _throttled_since = now;
+        } else if (!throttled && _throttled) {
+            _throttled_time += now - _throttled_since;
+        }
+        _throttled = throttled;
+    }
 };
 /// \endcond
 
@@ -82,6 +154,10 @@ using priority_class_ptr = lw_shared_ptr<priority_class>;
 /// When the classes that lag behind start seeing requests, the fair queue will serve
 /// them first, until balance is restored. This balancing is expected to happen within
 /// a certain time window that obeys an exponential decay.
+///
+/// A class can also be capped in bytes and operations per second, regardless of
+/// how idle the queue is. Requests of a class over its limits are held back, and
+/// the capacity they would have used goes to the other classes meanwhile.
 class fair_queue {
     friend priority_class;
 
@@ -91,17 +167,25 @@ class fair_queue {
         }
     };
 
-    semaphore _sem;
     unsigned _capacity;
+    unsigned _requests_executing = 0;
+    unsigned _requests_queued = 0;
     using clock_type = std::chrono::steady_clock::time_point;
     clock_type _base;
     std::chrono::microseconds _tau;
     using prioq = std::priority_queue<priority_class_ptr, std::vector<priority_class_ptr>, class_compare>;
     prioq _handles;
     std::unordered_set<priority_class_ptr> _all_classes;
+    // Classes with requests queued but over their rate limits. They are kept
+    // out of _handles, so that dispatching does not look at them again, until
+    // _throttle_timer finds that their buckets have refilled.
+    std::vector<priority_class_ptr> _parked_classes;
+    timer<> _throttle_timer;
+    uint64_t _dispatch_attempts = 0;
+    uint64_t _capacity_waits = 0;
 
     void push_priority_class(priority_class_ptr pc) {
-        if (!pc->_queued) {
+        if (!pc->_queued && !pc->_parked) {
             _handles.push(pc);
             pc->_queued = true;
         }
@@ -116,35 +200,109 @@ class fair_queue {
         return h;
     }
 
-    void execute_one() {
-        _sem.wait().then([this] {
-            priority_class_ptr h;
-            do {
-                h = pop_priority_class();
-            } while (h->_queue.empty());
-
-            auto req = std::move(h->_queue.front());
-            h->_queue.pop_front();
-
-            req.pr.set_value();
-            auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-            auto req_cost  = float(req.weight) / h->_shares;
-            auto cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
-            float next_accumulated = h->_accumulated + cost;
-            while (std::isinf(next_accumulated)) {
-                normalize_stats();
-                // If we have renormalized, our time base will have changed. This should happen very infrequently
-                delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-                cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
-                next_accumulated = h->_accumulated + cost;
+    void park(priority_class_ptr pc, std::chrono::steady_clock::time_point now) {
+        pc->set_throttled(true, now);
+        pc->_parked = true;
+        auto when = now + pc->time_to_dispatch();
+        if (!_throttle_timer.armed() || when < _throttle_timer.get_timeout()) {
+            _throttle_timer.rearm(when);
+        }
+        _parked_classes.push_back(std::move(pc));
+    }
+
+    void unpark_ready_classes() {
+        auto now = std::chrono::steady_clock::now();
+        std::experimental::optional<std::chrono::steady_clock::time_point> next;
+        auto it = _parked_classes.begin();
+        while (it != _parked_classes.end()) {
+            auto& pc = *it;
+            pc->refill(now);
+            if (pc->may_dispatch()) {
+                pc->_parked = false;
+                push_priority_class(std::move(pc));
+                it = _parked_classes.erase(it);
+            } else {
+                auto when = now + pc->time_to_dispatch();
+                next = next ? std::min(*next, when) : when;
+                ++it;
             }
-            h->_accumulated = next_accumulated;
+        }
+        if (next) {
+            _throttle_timer.rearm(*next);
+        }
+        dispatch_requests();
+    }
+
+    // Dispatches queued requests while there is capacity for them.
+    void dispatch_requests() {
+        while (_requests_executing < _capacity && !_handles.empty()) {
+            dispatch_one();
+        }
+        if (_requests_executing >= _capacity && has_dispatchable_class()) {
+            _capacity_waits++;
+        }
+    }
 
-            if (!h->_queue.empty()) {
-                push_priority_class(h);
+    // Whether a queued class is within its rate limits. Classes found over
+    // them on the way are parked, as dispatch_one() would, so that requests
+    // held back by the rate limits do not count as waiting for capacity.
+    bool has_dispatchable_class() {
+        if (_handles.empty()) {
+            return false;
+        }
+        auto now = std::chrono::steady_clock::now();
+        while (!_handles.empty()) {
+            auto& h = _handles.top();
+            if (h->_queue.empty()) {
+                pop_priority_class();
+                continue;
             }
-            return make_ready_future<>();
-        });
+            h->refill(now);
+            if (h->may_dispatch()) {
+                return true;
+            }
+            park(pop_priority_class(), now);
+        }
+        return false;
+    }
+
+    void dispatch_one() {
+        _dispatch_attempts++;
+        auto now = std::chrono::steady_clock::now();
+        auto h = pop_priority_class();
+        if (h->_queue.empty()) {
+            return;
+        }
+        h->refill(now);
+        if (!h->may_dispatch()) {
+            park(std::move(h), now);
+            return;
+        }
+        h->set_throttled(false, now);
+
+        auto req = std::move(h->_queue.front());
+        h->_queue.pop_front();
+        h->consume(req.size);
+        _requests_queued--;
+        _requests_executing++;
+
+        req.pr.set_value();
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+        auto req_cost  = float(req.weight) / h->_shares;
+        auto cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
+        float next_accumulated = h->_accumulated + cost;
+        while (std::isinf(next_accumulated)) {
+            normalize_stats();
+            // If we have renormalized, our time base will have changed. This should happen very infrequently
+            delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+            cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
+            next_accumulated = h->_accumulated + cost;
+        }
+        h->_accumulated = next_accumulated;
+
+        if (!h->_queue.empty()) {
+            push_priority_class(h);
+        }
     }
 
     float normalize_factor() const {
@@ -165,10 +323,10 @@ class fair_queue {
     /// \param capacity how many concurrent requests are allowed in this queue.
     /// \param tau the queue exponential decay parameter, as in exp(-1/tau * t)
     explicit fair_queue(unsigned capacity, std::chrono::microseconds tau = std::chrono::milliseconds(100))
-                                           : _sem(capacity)
-                                           , _capacity(capacity)
+                                           : _capacity(capacity)
                                            , _base(std::chrono::steady_clock::now())
                                            , _tau(tau) {
+        _throttle_timer.set_callback([this] { unpark_ready_classes(); });
     }
 
     /// Registers a priority class against this fair queue.
@@ -190,7 +348,20 @@ class fair_queue {
 
     /// \return how many waiters are currently queued for all classes.
     size_t waiters() const {
-        return _sem.waiters();
+        return _requests_queued;
+    }
+
+    /// \return how many times a class was looked at to dispatch a request,
+    /// whether or not one could be dispatched.
+    uint64_t dispatch_attempts() const {
+        return _dispatch_attempts;
+    }
+
+    /// \return how many times dispatching stopped at the capacity while a
+    /// class within its rate limits had requests queued. Requests held back
+    /// only by their rate limits are not counted.
+    uint64_t capacity_waits() const {
+        return _capacity_waits;
     }
 
     /// Executes the function \c func through this class' \ref fair_queue, with weight \c weight
@@ -198,32 +369,84 @@ class fair_queue {
     /// \return \c func's return value, if \c func returns a future, or future<T> if \c func returns a non-future of type T.
     template <typename Func>
     futurize_t<std::result_of_t<Func()>> queue(priority_class_ptr pc, unsigned weight, Func func) {
+        return queue(std::move(pc), weight, 0, std::move(func));
+    }
+
+    /// Executes the function \c func through this class' \ref fair_queue, with weight \c weight,
+    /// accounting \c size bytes against the class' bandwidth limit.
+    ///
+    /// \return \c func's return value, if \c func returns a future, or future<T> if \c func returns a non-future of type T.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> queue(priority_class_ptr pc, unsigned weight, size_t size, Func func) {
         // We need to return a future in this function on which the caller can wait.
         // Since we don't know which queue we will use to execute the next request - if ours or
         // someone else's, we need a separate promise at this point.
         promise<> pr;
         auto fut = pr.get_future();
 
+        pc->_queue.push_back(priority_class::request{std::move(pr), weight, size});
+        _requests_queued++;
         push_priority_class(pc);
-        pc->_queue.push_back(priority_class::request{std::move(pr), weight});
-        try {
-            execute_one();
-        } catch (...) {
-            pc->_queue.pop_back();
-            throw;
-        }
+        dispatch_requests();
         return fut.then([func = std::move(func)] {
             return func();
         }).finally([this] {
-            _sem.signal();
+            _requests_executing--;
+            dispatch_requests();
         });
     }
 
+    /// \return how many concurrent requests are currently allowed in this queue.
+    unsigned capacity() const {
+        return _capacity;
+    }
+
+    /// Changes how many concurrent requests are allowed in this queue.
+    ///
+    /// Lowering the capacity does not affect requests already executing;
+    /// new requests are held back until enough of them complete.
+    void set_capacity(unsigned capacity) {
+        _capacity = capacity;
+        dispatch_requests();
+    }
+
     /// Updates the current shares of this priority class
     ///
     /// \param new_shares the new number of shares for this priority class
     static void update_shares(priority_class_ptr pc, uint32_t new_shares) {
         pc->_shares = new_shares;
     }
+
+    /// Caps the rate at which requests of this priority class are executed
+    ///
+    /// \param bytes_per_second bandwidth limit, as accounted by the \c size of requests; 0 for unlimited
+    /// \param ops_per_second request rate limit; 0 for unlimited
+    void set_rate_limits(priority_class_ptr pc, double bytes_per_second, double ops_per_second) {
+        pc->refill(std::chrono::steady_clock::now());
+        if (!pc->_bytes_per_second) {
+            pc->_byte_tokens = priority_class::burst(bytes_per_second);
+        }
+        if (!pc->_ops_per_second) {
+            pc->_op_tokens = priority_class::burst(ops_per_second);
+        }
+        pc->_bytes_per_second = bytes_per_second;
+        pc->_ops_per_second = ops_per_second;
+        pc->_byte_tokens = std::min(pc->_byte_tokens, priority_class::burst(bytes_per_second));
+        pc->_op_tokens = std::min(pc->_op_tokens, priority_class::burst(ops_per_second));
+        // The limits may have been lifted: don't wait for the timer.
+        if (pc->_parked) {
+            unpark_ready_classes();
+        }
+    }
+
+    /// \return how long this priority class has spent with requests queued but held
+    /// back by its rate limits.
+    static std::chrono::steady_clock::duration throttled_time(const priority_class_ptr& pc) {
+        auto t = pc->_throttled_time;
+        if (pc->_throttled) {
+            t += std::chrono::steady_clock::now() - pc->_throttled_since;
+        }
+        return t;
+    }
 };
 /// @}
@@ -27,6 +27,15 @@
 #include <malloc.h>
 #include <string.h>
 
+// Read-ahead memory taken by file_data_source_impl::dynamic_adjustments
+// beyond what the streams' options asked for, and its limit.
+static thread_local size_t read_ahead_memory_used = 0;
+static thread_local size_t read_ahead_memory_budget = 16 << 20;
+
+void set_file_input_stream_read_ahead_budget(size_t bytes) {
+    read_ahead_memory_budget = bytes;
+}
+
 class file_data_source_impl : public data_source_impl {
     file _file;
     file_input_stream_options _options;
@@ -35,13 +44,26 @@ class file_data_source_impl : public data_source_impl {
     circular_buffer<future<temporary_buffer<char>>> _read_buffers;
     unsigned _reads_in_progress = 0;
     std::experimental::optional<promise<>> _done;
+    // Current buffer size and read-ahead; they only differ from _options
+    // with dynamic_adjustments.
+    size_t _buffer_size;
+    unsigned _read_ahead;
+    // Share of read_ahead_memory_used held by this stream.
+    size_t _extra_memory = 0;
 public:
     file_data_source_impl(file f, uint64_t offset, uint64_t len, file_input_stream_options options)
-            : _file(std::move(f)), _options(options), _pos(offset), _remain(len) {
+            : _file(std::move(f)), _options(options), _pos(offset), _remain(len)
+            , _buffer_size(options.buffer_size), _read_ahead(options.read_ahead) {
         // prevent wraparounds
         _remain = std::min(std::numeric_limits<uint64_t>::max() - _pos, _remain);
     }
+    virtual ~file_data_source_impl() {
+        read_ahead_memory_used -= _extra_memory;
+    }
     virtual future<temporary_buffer<char>> get() override {
+        if (_options.dynamic_adjustments) {
+            adjust_read_ahead();
+        }
         if (_read_buffers.empty()) {
             issue_read_aheads(1);
         }
@@ -61,11 +83,51 @@ class file_data_source_impl : public data_source_impl {
         });
     }
 private:
+    static size_t footprint(size_t buffer_size, unsigned read_ahead) {
+        return buffer_size * (read_ahead + 1);
+    }
+
+    // Switches to a new buffer size and read-ahead, unless that takes the
+    // shard over its read-ahead budget.
+    bool resize_window(size_t buffer_size, unsigned read_ahead) {
+        auto base = footprint(_options.buffer_size, _options.read_ahead);
+        auto size = footprint(buffer_size, read_ahead);
+        auto extra = size > base ? size - base : 0;
+        if (extra > _extra_memory && read_ahead_memory_used + extra - _extra_memory > read_ahead_memory_budget) {
+            return false;
+        }
+        read_ahead_memory_used = read_ahead_memory_used + extra - _extra_memory;
+        _extra_memory = extra;
+        _buffer_size = buffer_size;
+        _read_ahead = read_ahead;
+        return true;
+    }
+
+    void adjust_read_ahead() {
+        if (_read_buffers.empty() || !_read_buffers.front().available()) {
+            // The reader is waiting for the disk: read in larger buffers
+            // first, then further ahead.
+            if (_buffer_size < _options.max_buffer_size) {
+                resize_window(std::min(_buffer_size * 2, _options.max_buffer_size), _read_ahead);
+            } else if (_read_ahead < _options.max_read_ahead) {
+                resize_window(_buffer_size, _read_ahead + 1);
+            }
+        } else if (!_reads_in_progress && _read_buffers.size() > 1) {
+            // All the read-ahead is done and waiting for the reader: it is
+            // the bottleneck, so give back memory in the reverse order.
+            if (_read_ahead > _options.read_ahead) {
+                resize_window(_buffer_size, _read_ahead - 1);
+            } else if (_buffer_size > _options.buffer_size) {
+                resize_window(std::max(_buffer_size / 2, _options.buffer_size), _read_ahead);
+            }
+        }
+    }
+
     void issue_read_aheads(unsigned min_ra = 0) {
         if (_done) {
             return;
         }
-        auto ra = std::max(min_ra, _options.read_ahead);
+        auto ra = std::max(min_ra, _read_ahead);
         _read_buffers.reserve(ra); // prevent push_back() failure
         while (_read_buffers.size() < ra) {
             if (!_remain) {
@@ -80,7 +142,7 @@ class file_data_source_impl : public data_source_impl {
             // Also avoid reading beyond _remain.
             uint64_t align = _file.disk_read_dma_alignment();
             auto start = align_down(_pos, align);
-            auto end = align_up(std::min(start + _options.buffer_size, _pos + _remain), align);
+            auto end = align_up(std::min(start + _buffer_size, _pos + _remain), align);
             auto len = end - start;
             _read_buffers.push_back(futurize<future<temporary_buffer<char>>>::apply([&] {
                     return _file.dma_read_bulk<char>(start, len, _options.io_priority_class);
@@ -40,8 +40,19 @@ struct file_input_stream_options {
     size_t buffer_size = 8192;    ///< I/O buffer size
     unsigned read_ahead = 0;      ///< Number of extra read-ahead operations
     ::io_priority_class io_priority_class = default_priority_class();
+    /// Adapt the buffer size and read-ahead to the reader: starting from
+    /// \c buffer_size and \c read_ahead, they grow while the reader waits for
+    /// the disk and shrink back while read-ahead buffers are left unread.
+    bool dynamic_adjustments = false;
+    size_t max_buffer_size = 128 << 10; ///< Limit of \c buffer_size growth, with \c dynamic_adjustments
+    unsigned max_read_ahead = 8;  ///< Limit of \c read_ahead growth, with \c dynamic_adjustments
 };
 
+/// Limits the memory the file input streams of this shard may take, in
+/// total, by growing past their options with
+/// \ref file_input_stream_options::dynamic_adjustments.  Defaults to 16MB.
+void set_file_input_stream_read_ahead_budget(size_t bytes);
+
 /// \brief Creates an input_stream to read a portion of a file.
 ///
 /// \param file File to read; multiple streams for the same file may coexist
@@ -32,6 +32,7 @@
 #include <tuple>
 #include <iterator>
 #include <vector>
+#include <stdexcept>
 #include <experimental/optional>
 
 /// \cond internal
@@ -386,6 +387,115 @@ future<> do_for_each(Container& c, AsyncAction&& action) {
     return do_for_each(std::begin(c), std::end(c), std::forward<AsyncAction>(action));
 }
 
+/// Run tasks in parallel, with bounded concurrency (iterator version).
+///
+/// Given a range [\c begin, \c end) of objects, run \c func on each \c *i in
+/// the range, and return a future<> that resolves when all the functions
+/// complete.  \c func should return a future<> that indicates when it is
+/// complete.  At most \c max_concurrent invocations are in flight at any
+/// time; as each one completes, \c func is invoked on the next element.
+/// Memory use is proportional to \c max_concurrent, not to the size of the
+/// range, so this is suitable for very long (or generated) ranges.
+///
+/// Once an invocation fails, no new invocations are started; the returned
+/// future resolves after the ones already in flight complete.
+///
+/// \param begin an \c InputIterator designating the beginning of the range
+/// \param end an \c InputIterator designating the end of the range
+/// \param max_concurrent maximum number of invocations of \c func allowed
+///             to run concurrently; must be positive, or the returned
+///             future fails with \c std::invalid_argument
+/// \param func Function to apply to each element in the range (returning
+///             a \c future<>).  It is kept alive until the returned
+///             future resolves.
+/// \return a \c future<> that resolves when all the function invocations
+///         complete.  If one or more return an exception, the return value
+///         contains one of the exceptions.
+template <typename Iterator, typename Func>
+inline
+future<>
+max_concurrent_for_each(Iterator begin, Iterator end, size_t max_concurrent, Func func) {
+    using futurator = futurize<decltype(func(*begin))>;
+    struct state {
+        Iterator begin;
+        Iterator end;
+        Func func;
+        bool failed;
+        parallel_for_each_state workers;
+    };
+    if (!max_concurrent) {
+        return make_exception_future<>(std::invalid_argument("max_concurrent_for_each: max_concurrent must be positive"));
+    }
+    if (begin == end) {
+        return make_ready_future<>();
+    }
+    auto s = make_lw_shared(state{std::move(begin), std::move(end), std::move(func), false, {}});
+    // Each worker pulls elements off the shared iterator until it runs out,
+    // so the only per-element allocation is the continuation of the
+    // invocation in flight.
+    auto worker = [s] {
+        return repeat([s] {
+            if (s->failed || s->begin == s->end) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return futurator::apply(s->func, *s->begin++).then_wrapped([s] (future<> f) {
+                if (f.failed()) {
+                    s->failed = true;
+                    return make_exception_future<stop_iteration>(f.get_exception());
+                }
+                return make_ready_future<stop_iteration>(stop_iteration::no);
+            });
+        });
+    };
+    // increase ref count to ensure all workers are started
+    ++s->workers.waiting;
+    // A worker whose invocations all complete immediately drains the range
+    // before returning, so there are never more workers than elements.
+    while (s->workers.waiting <= max_concurrent && !s->failed && s->begin != s->end) {
+        ++s->workers.waiting;
+        worker().then_wrapped([s] (future<> f) {
+            if (f.failed()) {
+                // We can only store one exception.  For more, use when_all().
+                if (!s->workers.ex) {
+                    s->workers.ex = f.get_exception();
+                } else {
+                    f.ignore_ready_future();
+                }
+            }
+            s->workers.complete();
+        });
+    }
+    // match increment on top
+    s->workers.complete();
+    return s->workers.pr.get_future();
+}
+
+/// Run tasks in parallel, with bounded concurrency (range version).
+///
+/// Given a \c range of objects, apply \c func to each object
+/// in the range, keeping at most \c max_concurrent invocations in
+/// flight, and return a future<> that resolves when all the functions
+/// complete.  See the iterator version for details.
+///
+/// \param range A range of objects to iterate run \c func on.  It must
+///              remain valid until the returned future resolves.
+/// \param max_concurrent maximum number of invocations of \c func allowed
+///              to run concurrently; must be positive, or the returned
+///              future fails with \c std::invalid_argument
+/// \param func  A callable, accepting reference to the range's
+///              \c value_type, and returning a \c future<>.
+/// \return a \c future<> that becomes ready when the entire range
+///         was processed.  If one or more of the invocations of
+///         \c func returned an exceptional future, then the return
+///         value will contain one of those exceptions.
+template <typename Range, typename Func>
+inline
+future<>
+max_concurrent_for_each(Range&& range, size_t max_concurrent, Func func) {
+    return max_concurrent_for_each(std::begin(range), std::end(range), max_concurrent,
+            std::move(func));
+}
+
 /// \cond internal
 template<typename... Futures>
 class when_all_state : public enable_lw_shared_from_this<when_all_state<Futures...>> {
@@ -673,6 +783,80 @@ map_reduce(Range&& range, Mapper&& mapper, Initial initial, Reduce reduce) {
             std::move(initial), std::move(reduce));
 }
 
+/// Asynchronous map/reduce transformation, with bounded concurrency.
+///
+/// Like map_reduce(begin, end, mapper, initial, reduce), but at most
+/// \c max_concurrent invocations of \c mapper are in flight at any time,
+/// so memory use does not grow with the size of the range.  Results are
+/// reduced as they become available, in completion order rather than in
+/// range order, so \c reduce should be commutative as well as associative.
+///
+/// Example:
+///
+/// Calculate the total size of many files, opening at most 16 at a time:
+///
+/// \code
+///  map_reduce(names.begin(), names.end(), 16,
+///             [] (sstring name) { return file_size(name); },
+///             uint64_t(0),
+///             std::plus<uint64_t>())
+/// \endcode
+///
+/// \param begin beginning of object range to operate on
+/// \param end end of object range to operate on
+/// \param max_concurrent maximum number of invocations of \c mapper allowed
+///        to run concurrently; must be positive, or the returned future
+///        fails with \c std::invalid_argument
+/// \param mapper map function to call on each object, returning a future
+/// \param initial initial input value to reduce function
+/// \param reduce binary function for merging two result values from \c mapper
+///
+/// \return equivalent to \c reduce(reduce(initial, mapper(obj0)), mapper(obj1)) ...
+///         with the \c mapper results taken in some order
+template <typename Iterator, typename Mapper, typename Initial, typename Reduce>
+inline
+future<Initial>
+map_reduce(Iterator begin, Iterator end, size_t max_concurrent, Mapper&& mapper, Initial initial, Reduce reduce) {
+    struct state {
+        Initial result;
+        Reduce reduce;
+    };
+    auto s = make_lw_shared(state{std::move(initial), std::move(reduce)});
+    using futurator = futurize<decltype(mapper(*begin))>;
+    return max_concurrent_for_each(std::move(begin), std::move(end), max_concurrent,
+            [s, mapper = std::forward<Mapper>(mapper)] (auto&& obj) mutable {
+        return futurator::apply(mapper, std::forward<decltype(obj)>(obj)).then([s] (auto result) {
+            s->result = s->reduce(std::move(s->result), std::move(result));
+        });
+    }).then([s] {
+        return make_ready_future<Initial>(std::move(s->result));
+    });
+}
+
+/// Asynchronous map/reduce transformation, with bounded concurrency
+/// (range version).
+///
+/// See the iterator version for details.
+///
+/// \param range object range to operate on.  It must remain valid until the
+///        returned future resolves.
+/// \param max_concurrent maximum number of invocations of \c mapper allowed
+///        to run concurrently; must be positive, or the returned future
+///        fails with \c std::invalid_argument
+/// \param mapper map function to call on each object, returning a future
+/// \param initial initial input value to reduce function
+/// \param reduce binary function for merging two result values from \c mapper
+///
+/// \return equivalent to \c reduce(reduce(initial, mapper(obj0)), mapper(obj1)) ...
+///         with the \c mapper results taken in some order
+template <typename Range, typename Mapper, typename Initial, typename Reduce>
+inline
+future<Initial>
+map_reduce(Range&& range, size_t max_concurrent, Mapper&& mapper, Initial initial, Reduce reduce) {
+    return map_reduce(std::begin(range), std::end(range), max_concurrent, std::forward<Mapper>(mapper),
+            std::move(initial), std::move(reduce));
+}
+
 // Implements @Reducer concept. Calculates the result by
 // adding elements to the accumulator.
 template <typename Result, typename Addend = Result>
@@ -697,6 +881,31 @@ future<> now() {
 // Returns a future which is not ready but is scheduled to resolve soon.
 future<> later();
 
+/// \brief Runs a function in a scheduling group.
+///
+/// \c func is run from a task of \c sg (or directly, if \c sg is
+/// already current), so it and all the continuations it attaches are
+/// accounted to that group.
+///
+/// \param sg scheduling group to run \c func in
+/// \param func function to run; may return a future
+/// \return the value returned by \c func, as a future
+template <typename Func>
+inline
+auto
+with_scheduling_group(scheduling_group sg, Func func) {
+    using futurator = futurize<std::result_of_t<Func()>>;
+    if (sg == current_scheduling_group()) {
+        return futurator::apply(std::move(func));
+    }
+    typename futurator::promise_type pr;
+    auto f = pr.get_future();
+    schedule(make_task(sg, [pr = std::move(pr), func = std::move(func)] () mutable {
+        futurator::apply(std::move(func)).forward_to(std::move(pr));
+    }));
+    return f;
+}
+
 /// @}
 
 #endif /* CORE_FUTURE_UTIL_HH_ */
@@ -793,6 +793,23 @@ class future {
         });
         seastar::thread_impl::switch_out(thread);
     }
+
+    // Resumes a coroutine suspended on this future once it becomes
+    // available; the future must stay in place until then (it lives in
+    // the coroutine frame). See core/coroutine.hh.
+    template <typename CoroutineHandle>
+    void schedule_resume(CoroutineHandle h) {
+        schedule([this, h] (future_state<T...>&& new_state) mutable {
+            *state() = std::move(new_state);
+            h.resume();
+        });
+    }
+
+    // get() for a coroutine resuming on an available future: unlike get(),
+    // never yields a seastar::thread the coroutine happens to run on.
+    std::tuple<T...> get_available() {
+        return get_available_state().get();
+    }
     /// \endcond
 
     /// \brief Checks whether the future is available.
@@ -89,6 +89,18 @@ future<> output_stream<CharType>::write(temporary_buffer<CharType> p) {
     });
 }
 
+template<typename CharType>
+future<> output_stream<CharType>::write(basic_cord<CharType> c) {
+    if (_end) {
+        // Send what is buffered as the head of the cord, rather than
+        // copying either of them.
+        _buf.trim(_end);
+        _end = 0;
+        c.prepend(std::move(_buf));
+    }
+    return write(std::move(c).release());
+}
+
 template <typename CharType>
 future<temporary_buffer<CharType>>
 input_stream<CharType>::read_exactly_part(size_t n, tmp_buf out, size_t completed) {
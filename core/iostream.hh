@@ -38,6 +38,7 @@
 #include "future.hh"
 #include "temporary_buffer.hh"
 #include "scattered_message.hh"
+#include "cord.hh"
 
 namespace net { class packet; }
 
@@ -208,6 +209,7 @@ class output_stream final {
     future<> write(net::packet p);
     future<> write(scattered_message<char_type> msg);
     future<> write(temporary_buffer<char_type>);
+    future<> write(basic_cord<char_type> c);
     future<> flush();
     future<> close();
 private:
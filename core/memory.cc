@@ -69,8 +69,13 @@
 #include <experimental/optional>
 #include <functional>
 #include <cstring>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <unordered_map>
 #include <boost/intrusive/list.hpp>
 #include <sys/mman.h>
+#include <execinfo.h>
 #ifdef HAVE_NUMA
 #include <numaif.h>
 #endif
@@ -105,6 +110,10 @@ static thread_local uint64_t g_allocs;
 static thread_local uint64_t g_frees;
 static thread_local uint64_t g_cross_cpu_frees;
 static thread_local uint64_t g_reclaims;
+static thread_local uint64_t g_released_bytes;
+static thread_local uint64_t g_refaulted_bytes;
+static thread_local uint64_t g_large_allocs[nr_large_allocation_buckets];
+static thread_local uint64_t g_large_allocation_warnings;
 
 using std::experimental::optional;
 
@@ -167,6 +176,7 @@ class page_list {
 public:
     page& front(page* ary) { return ary[_front]; }
     page& back(page* ary) { return ary[_back]; }
+    page* next(page* ary, page& span) { return span.link._next ? &ary[span.link._next] : nullptr; }
     bool empty() const { return !_front; }
     void erase(page* ary, page& span) {
         if (span.link._next) {
@@ -219,6 +229,8 @@ class small_pool {
     unsigned _min_free;
     unsigned _max_free;
     unsigned _spans_in_use = 0;
+    uint64_t _allocs = 0;
+    uint64_t _frees = 0;
     page_list _span_list;
     static constexpr unsigned idx_frac_bits = 2;
 private:
@@ -229,6 +241,7 @@ class small_pool {
     void* allocate();
     void deallocate(void* object);
     unsigned object_size() const { return _object_size; }
+    size_class_stats stats() const;
     static constexpr unsigned size_to_idx(unsigned size);
     static constexpr unsigned idx_to_size(unsigned idx);
 private:
@@ -287,13 +300,74 @@ struct cross_cpu_free_item {
     cross_cpu_free_item* next;
 };
 
+// Sampling heap profiler.
+//
+// On average one allocation is sampled per _interval bytes allocated:
+// allocations are charged against a byte countdown, and the one that
+// takes it below zero is recorded along with its backtrace. The countdown
+// is then reset to an exponentially distributed value, so that periodic
+// allocation patterns do not alias with the sampling interval. While
+// profiling is disabled the countdown never runs out, so the allocation
+// path pays one subtraction and a branch.
+//
+// Live samples are kept in a hash table keyed by address. To keep the
+// table lookup off the common free path, a count of live samples is kept
+// for every page of the cpu's address range, in a lazily populated
+// mapping; a free only looks in the table if its page has samples.
+class heap_profiler {
+public:
+    static constexpr unsigned max_frames = 32;
+    struct sample {
+        size_t size;
+        unsigned nr_frames;
+        void* frames[max_frames];
+    };
+private:
+    int64_t _countdown = std::numeric_limits<int64_t>::max();
+    size_t _interval = 0;
+    uint64_t _rng = 88172645463325252ull;
+    // Set while the profiler itself allocates or frees memory, so that it
+    // does not recurse into itself.
+    bool _busy = false;
+    uint16_t* _page_samples = nullptr;
+    // Never destroyed: objects may be freed after the thread exits.
+    std::unordered_map<void*, sample>* _samples = nullptr;
+private:
+    void reset_countdown();
+public:
+    // Returns true if an allocation of this size should be sampled.
+    bool account(size_t size) {
+        return (_countdown -= size) < 0;
+    }
+    bool may_be_sampled(pageidx idx) const {
+        return _page_samples && _page_samples[idx];
+    }
+    size_t interval() const {
+        return _interval;
+    }
+    void set_interval(size_t interval);
+    void record(void* ptr, pageidx idx, size_t size);
+    void forget(void* ptr, pageidx idx);
+    std::string profile();
+};
+
 struct cpu_pages {
     static constexpr unsigned min_free_pages = 20000000 / page_size;
+    static constexpr unsigned huge_page_pages = huge_page_size / page_size;
     char* memory;
     page* pages;
     uint32_t nr_pages;
     uint32_t nr_free_pages;
     uint32_t current_min_free_pages = 0;
+    // Free memory release: whole free hugepages within free spans of at
+    // least release_threshold_pages are returned to the OS when the cpu is
+    // idle.  released_hugepages has a bit per hugepage of our memory that
+    // is currently released.
+    uint32_t release_threshold_pages = 0;
+    uint32_t nr_released_hugepages = 0;
+    bool release_pending = false;
+    bool hugetlbfs_backed = false;
+    std::vector<bool> released_hugepages;
     unsigned cpu_id = -1U;
     std::function<void (std::function<void ()>)> reclaim_hook;
     std::vector<reclaimer*> reclaimers;
@@ -310,7 +384,23 @@ struct cpu_pages {
         page_list free_spans[nr_span_lists];  // contains spans with span_size >= 2^idx
     } fsu;
     small_pool_array small_pools;
+    heap_profiler heap_prof;
     alignas(cache_line_size) std::atomic<cross_cpu_free_item*> xcpu_freelist;
+    // Objects freed on this cpu but owned by another one are collected
+    // here per owner, and handed over a batch at a time (one atomic
+    // operation per batch instead of per object) when the reactor polls
+    // or when a batch fills up.
+    struct cross_cpu_free_batch {
+        cross_cpu_free_item* head;
+        cross_cpu_free_item* tail;
+        unsigned count;
+        bool listed;   // in xcpu_batch_cpus
+    };
+    static constexpr unsigned max_cross_cpu_free_batch = 64;
+    bool batch_cross_cpu_frees = false;
+    unsigned nr_xcpu_batch_cpus = 0;
+    unsigned xcpu_batch_cpus[max_cpus];
+    cross_cpu_free_batch xcpu_batches[max_cpus] = {};
     alignas(cache_line_size) std::vector<physical_address> virt_to_phys_map;
     static std::atomic<unsigned> cpu_id_gen;
     static cpu_pages* all_cpus[max_cpus];
@@ -332,20 +422,40 @@ struct cpu_pages {
     void free_span(pageidx start, uint32_t nr_pages);
     void free_span_no_merge(pageidx start, uint32_t nr_pages);
     void* allocate_small(unsigned size);
+    void note_reuse(pageidx start, uint32_t nr_pages);
+    bool release_free_memory(size_t max_bytes);
+    void set_release_threshold(size_t bytes);
     void free(void* ptr);
     void free(void* ptr, size_t size);
     bool try_cross_cpu_free(void* ptr);
     void shrink(void* ptr, size_t new_size);
     void free_cross_cpu(unsigned cpu_id, void* ptr);
+    void publish_cross_cpu_frees(unsigned cpu_id, cross_cpu_free_item* head, cross_cpu_free_item* tail);
+    bool flush_cross_cpu_frees();
+    void set_cross_cpu_free_batching(bool enable);
     bool drain_cross_cpu_freelist();
     size_t object_size(void* ptr);
+    pageidx to_page_index(void* p) {
+        return (reinterpret_cast<char*>(p) - mem()) / page_size;
+    }
     page* to_page(void* p) {
-        return &pages[(reinterpret_cast<char*>(p) - mem()) / page_size];
+        return &pages[to_page_index(p)];
+    }
+    void sample_allocation(void* ptr, size_t size) {
+        if (ptr) {
+            heap_prof.record(ptr, to_page_index(ptr), size);
+        }
+    }
+    void maybe_forget_sample(void* ptr) {
+        auto idx = to_page_index(ptr);
+        if (__builtin_expect(heap_prof.may_be_sampled(idx), false)) {
+            heap_prof.forget(ptr, idx);
+        }
     }
 
     bool is_initialized() const;
     bool initialize();
-    reclaiming_result run_reclaimers(reclaimer_scope);
+    reclaiming_result run_reclaimers(reclaimer_scope, unsigned pages_needed = 1);
     void schedule_reclaim();
     void set_reclaim_hook(std::function<void (std::function<void ()>)> hook);
     void resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
@@ -396,6 +506,9 @@ void cpu_pages::free_span_no_merge(uint32_t span_start, uint32_t nr_pages) {
     span->span_size = span_end->span_size = nr_pages;
     auto idx = index_of(nr_pages);
     link(fsu.free_spans[idx], span);
+    if (release_threshold_pages && nr_pages >= release_threshold_pages) {
+        release_pending = true;
+    }
 }
 
 void cpu_pages::free_span(uint32_t span_start, uint32_t nr_pages) {
@@ -455,7 +568,7 @@ cpu_pages::find_and_unlink_span_reclaiming(unsigned n_pages) {
         if (span) {
             return span;
         }
-        if (run_reclaimers(reclaimer_scope::sync) == reclaiming_result::reclaimed_nothing) {
+        if (run_reclaimers(reclaimer_scope::sync, n_pages) == reclaiming_result::reclaimed_nothing) {
             return nullptr;
         }
     }
@@ -476,7 +589,7 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
     auto span_size = span->span_size;
     auto span_idx = span - pages;
     nr_free_pages -= span->span_size;
-    trim t = trimmer(span_idx, nr_pages);
+    trim t = trimmer(span_idx, span_size);
     if (t.offset) {
         free_span_no_merge(span_idx, t.offset);
         span_idx += t.offset;
@@ -492,6 +605,9 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
     span->free = span_end->free = false;
     span->span_size = span_end->span_size = t.nr_pages;
     span->pool = nullptr;
+    if (nr_released_hugepages) {
+        note_reuse(span_idx, t.nr_pages);
+    }
     if (nr_free_pages < current_min_free_pages) {
         drain_cross_cpu_freelist();
         run_reclaimers(reclaimer_scope::sync);
@@ -502,10 +618,27 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
     return mem() + span_idx * page_size;
 }
 
+// Where to carve a small (below hugepage size) allocation out of a free
+// span so as not to break up an aligned hugepage, if there is a choice:
+// from the unaligned head or tail of the span, if either is large enough.
+static inline
+unsigned hugepage_friendly_offset(pageidx idx, unsigned span_size, unsigned n_pages) {
+    constexpr unsigned hp = cpu_pages::huge_page_pages;
+    auto end = idx + span_size;
+    auto first_boundary = align_up(idx, hp);
+    if (n_pages >= hp || first_boundary + hp > end || first_boundary - idx >= n_pages) {
+        return 0;
+    }
+    if (end - align_down(end, hp) >= n_pages) {
+        return span_size - n_pages;
+    }
+    return 0;
+}
+
 void*
 cpu_pages::allocate_large(unsigned n_pages) {
     return allocate_large_and_trim(n_pages, [n_pages] (unsigned idx, unsigned n) {
-        return trim{0, std::min(n, n_pages)};
+        return trim{hugepage_friendly_offset(idx, n, n_pages), n_pages};
     });
 }
 
@@ -540,19 +673,64 @@ size_t cpu_pages::object_size(void* ptr) {
     }
 }
 
-void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
+void cpu_pages::publish_cross_cpu_frees(unsigned cpu_id, cross_cpu_free_item* head, cross_cpu_free_item* tail) {
     if (!live_cpus[cpu_id].load(std::memory_order_relaxed)) {
-        // Thread was destroyed; leak object
+        // Thread was destroyed; leak objects
         // should only happen for boost unit-tests.
         return;
     }
-    auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
     auto& list = all_cpus[cpu_id]->xcpu_freelist;
     auto old = list.load(std::memory_order_relaxed);
     do {
-        p->next = old;
-    } while (!list.compare_exchange_weak(old, p, std::memory_order_release, std::memory_order_relaxed));
+        tail->next = old;
+    } while (!list.compare_exchange_weak(old, head, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
+    auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
     ++g_cross_cpu_frees;
+    if (!batch_cross_cpu_frees) {
+        publish_cross_cpu_frees(cpu_id, p, p);
+        return;
+    }
+    auto& b = xcpu_batches[cpu_id];
+    if (!b.listed) {
+        b.listed = true;
+        xcpu_batch_cpus[nr_xcpu_batch_cpus++] = cpu_id;
+    }
+    if (!b.count) {
+        b.tail = p;
+    }
+    p->next = b.head;
+    b.head = p;
+    if (++b.count == max_cross_cpu_free_batch) {
+        publish_cross_cpu_frees(cpu_id, b.head, b.tail);
+        b.head = nullptr;
+        b.count = 0;
+    }
+}
+
+bool cpu_pages::flush_cross_cpu_frees() {
+    if (!nr_xcpu_batch_cpus) {
+        return false;
+    }
+    for (unsigned i = 0; i < nr_xcpu_batch_cpus; ++i) {
+        auto cpu = xcpu_batch_cpus[i];
+        auto& b = xcpu_batches[cpu];
+        if (b.count) {
+            publish_cross_cpu_frees(cpu, b.head, b.tail);
+        }
+        b = cross_cpu_free_batch{};
+    }
+    nr_xcpu_batch_cpus = 0;
+    return true;
+}
+
+void cpu_pages::set_cross_cpu_free_batching(bool enable) {
+    if (!enable) {
+        flush_cross_cpu_frees();
+    }
+    batch_cross_cpu_frees = enable;
 }
 
 bool cpu_pages::drain_cross_cpu_freelist() {
@@ -570,6 +748,7 @@ bool cpu_pages::drain_cross_cpu_freelist() {
 }
 
 void cpu_pages::free(void* ptr) {
+    maybe_forget_sample(ptr);
     page* span = to_page(ptr);
     if (span->pool) {
         span->pool->deallocate(ptr);
@@ -579,6 +758,7 @@ void cpu_pages::free(void* ptr) {
 }
 
 void cpu_pages::free(void* ptr, size_t size) {
+    maybe_forget_sample(ptr);
     // match action on allocate() so hit the right pool
     if (size <= sizeof(free_object)) {
         size = sizeof(free_object);
@@ -774,15 +954,30 @@ void cpu_pages::resize(size_t new_size, allocate_system_memory_fn alloc_memory)
     }
 }
 
-reclaiming_result cpu_pages::run_reclaimers(reclaimer_scope scope) {
-    auto target = std::max(nr_free_pages + 1, min_free_pages);
+// Reclaimers over budget are asked first.  Then reclaimers are asked a
+// priority level at a time (reclaimers is sorted by priority), moving on
+// to the next level only if the previous ones freed nothing.
+reclaiming_result cpu_pages::run_reclaimers(reclaimer_scope scope, unsigned pages_needed) {
+    auto target = std::max(nr_free_pages + pages_needed, min_free_pages);
     reclaiming_result result = reclaiming_result::reclaimed_nothing;
+    auto reclaim_from = [&] (reclaimer& r) {
+        if (r.scope() < scope || nr_free_pages >= target) {
+            return false;
+        }
+        return r.do_reclaim(size_t(target - nr_free_pages) * page_size) == reclaiming_result::reclaimed_something;
+    };
     while (nr_free_pages < target) {
         bool made_progress = false;
         ++g_reclaims;
         for (auto&& r : reclaimers) {
-            if (r->scope() >= scope) {
-                made_progress |= r->do_reclaim() == reclaiming_result::reclaimed_something;
+            if (r->over_budget()) {
+                made_progress |= reclaim_from(*r);
+            }
+        }
+        for (auto i = reclaimers.begin(); !made_progress && i != reclaimers.end(); ) {
+            auto priority = (*i)->priority();
+            for (; i != reclaimers.end() && (*i)->priority() == priority; ++i) {
+                made_progress |= reclaim_from(**i);
             }
         }
         if (!made_progress) {
@@ -821,6 +1016,197 @@ void cpu_pages::set_reclaim_hook(std::function<void (std::function<void ()>)> ho
     current_min_free_pages = min_free_pages;
 }
 
+// Called when pages [start, start + nr_pages) are allocated: any released
+// hugepages among them will be faulted back in as they are touched.
+void cpu_pages::note_reuse(pageidx start, uint32_t nr_pages) {
+    auto end = std::min<size_t>((start + nr_pages + huge_page_pages - 1) / huge_page_pages,
+            released_hugepages.size());
+    for (auto hp = start / huge_page_pages; hp < end; ++hp) {
+        if (released_hugepages[hp]) {
+            released_hugepages[hp] = false;
+            --nr_released_hugepages;
+            g_refaulted_bytes += huge_page_size;
+        }
+    }
+}
+
+// Releases whole hugepages of large free spans, up to max_bytes at a time.
+// Returns true if there may be more to release.
+bool cpu_pages::release_free_memory(size_t max_bytes) {
+    if (!release_pending) {
+        return false;
+    }
+    released_hugepages.resize(nr_pages / huge_page_pages);
+    size_t released = 0;
+    for (auto idx = nr_span_lists; idx-- > index_of(release_threshold_pages); ) {
+        auto& list = fsu.free_spans[idx];
+        for (auto span = list.empty() ? nullptr : &list.front(pages); span; span = list.next(pages, *span)) {
+            if (span->span_size < release_threshold_pages) {
+                continue;
+            }
+            pageidx start = span - pages;
+            auto first = align_up(start, huge_page_pages) / huge_page_pages;
+            auto last = std::min<size_t>((start + span->span_size) / huge_page_pages, released_hugepages.size());
+            for (auto hp = first; hp < last; ++hp) {
+                if (released_hugepages[hp]) {
+                    continue;
+                }
+                if (released >= max_bytes) {
+                    return true;
+                }
+                auto addr = mem() + size_t(hp) * huge_page_size;
+                int r = -1;
+#ifdef MADV_FREE
+                // Lazy: the kernel takes the pages only under memory pressure.
+                r = ::madvise(addr, huge_page_size, MADV_FREE);
+#endif
+                if (r == -1) {
+                    r = ::madvise(addr, huge_page_size, MADV_DONTNEED);
+                }
+                if (r == -1) {
+                    // e.g. locked memory; don't try again
+                    release_threshold_pages = 0;
+                    release_pending = false;
+                    return false;
+                }
+                released_hugepages[hp] = true;
+                ++nr_released_hugepages;
+                g_released_bytes += huge_page_size;
+                released += huge_page_size;
+            }
+        }
+    }
+    release_pending = false;
+    return false;
+}
+
+void cpu_pages::set_release_threshold(size_t bytes) {
+    if (hugetlbfs_backed) {
+        // hugetlbfs pages are not returned by madvise()
+        return;
+    }
+    release_threshold_pages = bytes ? align_up(std::max(bytes, huge_page_size), huge_page_size) / page_size : 0;
+    release_pending = release_threshold_pages != 0;
+}
+
+void heap_profiler::reset_countdown() {
+    if (!_interval) {
+        _countdown = std::numeric_limits<int64_t>::max();
+        return;
+    }
+    // xorshift64*; the top 53 bits make a uniform double in [0, 1)
+    _rng ^= _rng >> 12;
+    _rng ^= _rng << 25;
+    _rng ^= _rng >> 27;
+    auto u = ((_rng * 2685821657736338717ull) >> 11) * (1.0 / (uint64_t(1) << 53));
+    _countdown = -std::log1p(-u) * _interval;
+}
+
+void heap_profiler::set_interval(size_t interval) {
+    if (interval && !_page_samples) {
+        size_t bytes = sizeof(uint16_t) << (cpu_id_shift - page_bits);
+        auto r = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (r == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category());
+        }
+        _page_samples = reinterpret_cast<uint16_t*>(r);
+        _busy = true;
+        _samples = new std::unordered_map<void*, sample>();
+        _busy = false;
+    }
+    _interval = interval;
+    reset_countdown();
+}
+
+void heap_profiler::record(void* ptr, pageidx idx, size_t size) {
+    reset_countdown();
+    if (!_interval || _busy) {
+        return;
+    }
+    _busy = true;
+    sample s;
+    s.size = size;
+    // backtrace() may allocate the first time it is called, hence _busy.
+    s.nr_frames = ::backtrace(s.frames, max_frames);
+    try {
+        if (_samples->emplace(ptr, s).second) {
+            ++_page_samples[idx];
+        }
+    } catch (std::bad_alloc&) {
+        // drop the sample
+    }
+    _busy = false;
+}
+
+void heap_profiler::forget(void* ptr, pageidx idx) {
+    if (_busy) {
+        // one of our own allocations; those are never sampled
+        return;
+    }
+    _busy = true;
+    if (_samples->erase(ptr)) {
+        --_page_samples[idx];
+    }
+    _busy = false;
+}
+
+// Formats live samples in the legacy gperftools heap profile format, which
+// pprof understands:
+//
+//   heap profile: <objects>: <bytes> [<objects>: <bytes>] @ heap_v2/<interval>
+//   <objects>: <bytes> [<objects>: <bytes>] @ <pc> <pc> ...
+//   ...
+//
+//   MAPPED_LIBRARIES:
+//   <contents of /proc/self/maps>
+//
+// Counts are of raw samples; pprof scales them using the sampling interval.
+// Only live objects are tracked, so the in-use and allocated fields are
+// the same.
+std::string heap_profiler::profile() {
+    struct busy_guard {
+        bool& busy;
+        explicit busy_guard(bool& b) : busy(b) { busy = true; }
+        ~busy_guard() { busy = false; }
+    } guard(_busy);
+    struct totals {
+        size_t objects = 0;
+        size_t bytes = 0;
+    };
+    std::map<std::vector<void*>, totals> stacks;
+    totals all;
+    if (_samples) {
+        for (auto&& e : *_samples) {
+            auto& s = e.second;
+            auto& t = stacks[std::vector<void*>(s.frames, s.frames + s.nr_frames)];
+            ++t.objects;
+            t.bytes += s.size;
+            ++all.objects;
+            all.bytes += s.size;
+        }
+    }
+    std::string out;
+    char buf[100];
+    std::snprintf(buf, sizeof(buf), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+            all.objects, all.bytes, all.objects, all.bytes, _interval);
+    out += buf;
+    for (auto&& e : stacks) {
+        std::snprintf(buf, sizeof(buf), "%zu: %zu [%zu: %zu] @",
+                e.second.objects, e.second.bytes, e.second.objects, e.second.bytes);
+        out += buf;
+        for (auto pc : e.first) {
+            std::snprintf(buf, sizeof(buf), " %p", pc);
+            out += buf;
+        }
+        out += '\n';
+    }
+    out += "\nMAPPED_LIBRARIES:\n";
+    std::ifstream maps("/proc/self/maps");
+    out.append(std::istreambuf_iterator<char>(maps), std::istreambuf_iterator<char>());
+    return out;
+}
+
 small_pool::small_pool(unsigned object_size) noexcept
     : _object_size(object_size), _span_size(1) {
     while (_object_size > span_bytes()
@@ -851,11 +1237,13 @@ small_pool::allocate() {
     auto* obj = _free;
     _free = _free->next;
     --_free_count;
+    ++_allocs;
     return obj;
 }
 
 void
 small_pool::deallocate(void* object) {
+    ++_frees;
     auto o = reinterpret_cast<free_object*>(object);
     o->next = _free;
     _free = o;
@@ -930,6 +1318,11 @@ float small_pool::waste() {
     return (span_bytes() % _object_size) / (1.0 * span_bytes());
 }
 
+size_class_stats small_pool::stats() const {
+    return size_class_stats{_object_size, _allocs, _frees, _free_count,
+            _spans_in_use, _spans_in_use * span_bytes()};
+}
+
 void
 abort_on_underflow(size_t size) {
     if (std::make_signed_t<size_t>(size) < 0) {
@@ -938,10 +1331,61 @@ abort_on_underflow(size_t size) {
     }
 }
 
+static inline
+void account_large_allocation(unsigned size_in_pages) {
+    ++g_large_allocs[std::min(log2floor(size_in_pages), nr_large_allocation_buckets - 1)];
+}
+
+// Allocations larger than this are counted, and logged with a backtrace
+// (at most max_large_allocation_warnings_per_minute times a minute).
+static thread_local size_t g_large_allocation_warning_threshold = std::numeric_limits<size_t>::max();
+static constexpr unsigned max_large_allocation_warnings_per_minute = 10;
+
+static void warn_large_allocation(size_t size) {
+    ++g_large_allocation_warnings;
+    // Logging allocates; don't recurse if the threshold is that low.
+    static thread_local bool warning;
+    static thread_local unsigned warnings_in_window;
+    static thread_local std::chrono::steady_clock::time_point window_end;
+    if (warning) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now >= window_end) {
+        window_end = now + std::chrono::minutes(1);
+        warnings_in_window = 0;
+    }
+    if (warnings_in_window >= max_large_allocation_warnings_per_minute) {
+        return;
+    }
+    ++warnings_in_window;
+    warning = true;
+    void* addrs[64];
+    auto n = ::backtrace(addrs, 64);
+    std::string bt;
+    char buf[24];
+    for (int i = 0; i < n; ++i) {
+        std::snprintf(buf, sizeof(buf), " %p", addrs[i]);
+        bt += buf;
+    }
+    seastar_logger.warn("Large allocation of {} bytes (threshold {}), backtrace:{}",
+            size, g_large_allocation_warning_threshold, bt);
+    warning = false;
+}
+
+static inline
+void maybe_warn_large_allocation(size_t size) {
+    if (__builtin_expect(size > g_large_allocation_warning_threshold, false)) {
+        warn_large_allocation(size);
+    }
+}
+
 void* allocate_large(size_t size) {
     abort_on_underflow(size);
     unsigned size_in_pages = (size + page_size - 1) >> page_bits;
     assert((size_t(size_in_pages) << page_bits) >= size);
+    account_large_allocation(size_in_pages);
+    maybe_warn_large_allocation(size);
     return cpu_mem.allocate_large(size_in_pages);
 
 }
@@ -950,6 +1394,8 @@ void* allocate_large_aligned(size_t align, size_t size) {
     abort_on_underflow(size);
     unsigned size_in_pages = (size + page_size - 1) >> page_bits;
     unsigned align_in_pages = std::max(align, page_size) >> page_bits;
+    account_large_allocation(size_in_pages);
+    maybe_warn_large_allocation(size);
     return cpu_mem.allocate_large_aligned(align_in_pages, size_in_pages);
 }
 
@@ -975,6 +1421,9 @@ void* allocate(size_t size) {
         on_allocation_failure(size);
     }
     ++g_allocs;
+    if (__builtin_expect(cpu_mem.heap_prof.account(size), false)) {
+        cpu_mem.sample_allocation(ptr, size);
+    }
     return ptr;
 }
 
@@ -996,6 +1445,9 @@ void* allocate_aligned(size_t align, size_t size) {
         on_allocation_failure(size);
     }
     ++g_allocs;
+    if (__builtin_expect(cpu_mem.heap_prof.account(size), false)) {
+        cpu_mem.sample_allocation(ptr, size);
+    }
     return ptr;
 }
 
@@ -1025,10 +1477,19 @@ void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
     cpu_mem.set_reclaim_hook(hook);
 }
 
-reclaimer::reclaimer(reclaim_fn reclaim, reclaimer_scope scope)
+reclaimer::reclaimer(reclaim_fn reclaim, reclaimer_scope scope, int priority, const budget* b)
+    : reclaimer([reclaim = std::move(reclaim)] (request) { return reclaim(); }, scope, priority, b) {
+}
+
+reclaimer::reclaimer(reclaim_request_fn reclaim, reclaimer_scope scope, int priority, const budget* b)
     : _reclaim(std::move(reclaim))
-    , _scope(scope) {
-    cpu_mem.reclaimers.push_back(this);
+    , _scope(scope)
+    , _priority(priority)
+    , _budget(b) {
+    auto& r = cpu_mem.reclaimers;
+    r.insert(std::upper_bound(r.begin(), r.end(), this, [] (reclaimer* a, reclaimer* b) {
+        return a->priority() < b->priority();
+    }), this);
 }
 
 reclaimer::~reclaimer() {
@@ -1037,7 +1498,7 @@ reclaimer::~reclaimer() {
 }
 
 void configure(std::vector<resource::memory> m,
-        optional<std::string> hugetlbfs_path) {
+        optional<std::string> hugetlbfs_path, bool numa_bind, bool lock_memory) {
     size_t total = 0;
     for (auto&& x : m) {
         total += x.bytes;
@@ -1051,26 +1512,35 @@ void configure(std::vector<resource::memory> m,
             return allocate_hugetlbfs_memory(*fdp, where, how_much);
         };
         cpu_mem.replace_memory_backing(sys_alloc);
+        cpu_mem.hugetlbfs_backed = true;
     }
     cpu_mem.resize(total, sys_alloc);
     size_t pos = 0;
     for (auto&& x : m) {
 #ifdef HAVE_NUMA
-        unsigned long nodemask = 1UL << x.nodeid;
-        auto r = ::mbind(cpu_mem.mem() + pos, x.bytes,
-                        MPOL_PREFERRED,
-                        &nodemask, std::numeric_limits<unsigned long>::digits,
-                        MPOL_MF_MOVE);
-
-        if (r == -1) {
-            char err[1000] = {};
-            strerror_r(errno, err, sizeof(err));
-            std::cerr << "WARNING: unable to mbind shard memory; performance may suffer: "
-                    << err << std::endl;
+        if (numa_bind) {
+            unsigned long nodemask = 1UL << x.nodeid;
+            auto r = ::mbind(cpu_mem.mem() + pos, x.bytes,
+                            MPOL_PREFERRED,
+                            &nodemask, std::numeric_limits<unsigned long>::digits,
+                            MPOL_MF_MOVE);
+
+            if (r == -1) {
+                char err[1000] = {};
+                strerror_r(errno, err, sizeof(err));
+                std::cerr << "WARNING: unable to mbind shard memory; performance may suffer: "
+                        << err << std::endl;
+            }
         }
 #endif
         pos += x.bytes;
     }
+    if (lock_memory && !hugetlbfs_path) {
+        // Fault in (and lock) everything now that it is placed; hugetlbfs
+        // memory is populated when mapped.  Failure was already reported
+        // by mlockall(), and is not fatal either.
+        ::mlock(cpu_mem.mem(), cpu_mem.nr_pages * page_size);
+    }
     if (hugetlbfs_path) {
         cpu_mem.init_virt_to_phys_map();
     }
@@ -1078,13 +1548,67 @@ void configure(std::vector<resource::memory> m,
 
 statistics stats() {
     return statistics{g_allocs, g_frees, g_cross_cpu_frees,
-        cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims};
+        cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims,
+        size_t(cpu_mem.nr_released_hugepages) * huge_page_size, g_released_bytes, g_refaulted_bytes,
+        g_large_allocation_warnings};
+}
+
+// Pools for sizes below this are never used, since allocate() rounds up.
+static constexpr unsigned first_size_class = small_pool::size_to_idx(sizeof(free_object));
+
+unsigned nr_size_classes() {
+    return small_pool_array::nr_small_pools - first_size_class;
+}
+
+size_class_stats get_size_class_stats(unsigned idx) {
+    return cpu_mem.small_pools[first_size_class + idx].stats();
+}
+
+size_t large_allocation_bucket_size(unsigned idx) {
+    return page_size << idx;
+}
+
+uint64_t large_allocations(unsigned idx) {
+    return g_large_allocs[idx];
+}
+
+void set_large_allocation_warning_threshold(size_t bytes) {
+    g_large_allocation_warning_threshold = bytes ? bytes : std::numeric_limits<size_t>::max();
+}
+
+size_t large_allocation_warning_threshold() {
+    auto t = g_large_allocation_warning_threshold;
+    return t == std::numeric_limits<size_t>::max() ? 0 : t;
+}
+
+void set_free_memory_release_threshold(size_t bytes) {
+    cpu_mem.set_release_threshold(bytes);
+}
+
+bool release_free_memory(size_t max_bytes) {
+    return cpu_mem.release_free_memory(max_bytes);
+}
+
+reclaiming_result reclaim(size_t bytes) {
+    return cpu_mem.run_reclaimers(reclaimer_scope::async, (bytes + page_size - 1) / page_size);
 }
 
 bool drain_cross_cpu_freelist() {
     return cpu_mem.drain_cross_cpu_freelist();
 }
 
+void set_cross_cpu_free_batching(bool enable) {
+    cpu_mem.set_cross_cpu_free_batching(enable);
+}
+
+bool flush_cross_cpu_frees() {
+    return cpu_mem.flush_cross_cpu_frees();
+}
+
+bool is_local(const void* ptr) {
+    return object_cpu_id(ptr) == cpu_mem.cpu_id;
+}
+
 translation
 translate(const void* addr, size_t size) {
     auto cpu_id = object_cpu_id(addr);
@@ -1102,6 +1626,18 @@ memory_layout get_memory_layout() {
     return cpu_mem.memory_layout();
 }
 
+void set_heap_profiling_interval(size_t bytes) {
+    cpu_mem.heap_prof.set_interval(bytes);
+}
+
+size_t heap_profiling_interval() {
+    return cpu_mem.heap_prof.interval();
+}
+
+std::string heap_profile() {
+    return cpu_mem.heap_prof.profile();
+}
+
 }
 
 using namespace memory;
@@ -1388,7 +1924,10 @@ void enable_abort_on_allocation_failure() {
     seastar_logger.warn("Seastar compiled with default allocator, will not abort on bad_alloc");
 }
 
-reclaimer::reclaimer(reclaim_fn reclaim, reclaimer_scope) {
+reclaimer::reclaimer(reclaim_fn reclaim, reclaimer_scope, int, const budget*) {
+}
+
+reclaimer::reclaimer(reclaim_request_fn reclaim, reclaimer_scope, int, const budget*) {
 }
 
 reclaimer::~reclaimer() {
@@ -1397,17 +1936,65 @@ reclaimer::~reclaimer() {
 void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
 }
 
-void configure(std::vector<resource::memory> m, std::experimental::optional<std::string> hugepages_path) {
+void configure(std::vector<resource::memory> m, std::experimental::optional<std::string> hugepages_path, bool numa_bind, bool lock_memory) {
 }
 
 statistics stats() {
-    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0};
+    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0, 0, 0, 0, 0};
+}
+
+unsigned nr_size_classes() {
+    return 0;
+}
+
+size_class_stats get_size_class_stats(unsigned idx) {
+    abort();
+}
+
+size_t large_allocation_bucket_size(unsigned idx) {
+    return size_t(4096) << idx;
+}
+
+uint64_t large_allocations(unsigned idx) {
+    return 0;
+}
+
+void set_large_allocation_warning_threshold(size_t bytes) {
+    if (bytes) {
+        seastar_logger.warn("Seastar compiled with default allocator, large allocation warnings not available");
+    }
+}
+
+size_t large_allocation_warning_threshold() {
+    return 0;
+}
+
+void set_free_memory_release_threshold(size_t bytes) {
+}
+
+bool release_free_memory(size_t max_bytes) {
+    return false;
+}
+
+reclaiming_result reclaim(size_t bytes) {
+    return reclaiming_result::reclaimed_nothing;
 }
 
 bool drain_cross_cpu_freelist() {
     return false;
 }
 
+void set_cross_cpu_free_batching(bool enable) {
+}
+
+bool flush_cross_cpu_frees() {
+    return false;
+}
+
+bool is_local(const void* ptr) {
+    return true;
+}
+
 translation
 translate(const void* addr, size_t size) {
     return {};
@@ -1417,6 +2004,20 @@ memory_layout get_memory_layout() {
     throw std::runtime_error("get_memory_layout() not supported");
 }
 
+void set_heap_profiling_interval(size_t bytes) {
+    if (bytes) {
+        seastar_logger.warn("Seastar compiled with default allocator, heap profiling not available");
+    }
+}
+
+size_t heap_profiling_interval() {
+    return 0;
+}
+
+std::string heap_profile() {
+    throw std::runtime_error("heap_profile() not supported");
+}
+
 }
 
 void* operator new(size_t size, with_alignment wa) {
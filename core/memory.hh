@@ -26,6 +26,8 @@
 #include <new>
 #include <functional>
 #include <vector>
+#include <string>
+#include <algorithm>
 
 
 /// \defgroup memory-module Memory management
@@ -57,8 +59,13 @@ static constexpr size_t page_bits = 12;
 static constexpr size_t page_size = 1 << page_bits;       // 4K
 static constexpr size_t huge_page_size = 512 * page_size; // 2M
 
+// Sets up this cpu's memory, placing each part of it on the NUMA node
+// given by \c m, unless \c numa_bind is false (as on single-node machines).
+// With \c lock_memory, also faults in and locks all of it; call it on
+// the cpu's own thread so that this runs in parallel with other cpus.
 void configure(std::vector<resource::memory> m,
-        std::experimental::optional<std::string> hugetlbfs_path = {});
+        std::experimental::optional<std::string> hugetlbfs_path = {},
+        bool numa_bind = true, bool lock_memory = false);
 
 void enable_abort_on_allocation_failure();
 
@@ -88,27 +95,124 @@ enum class reclaimer_scope {
     sync
 };
 
+// A per-lcore memory budget of a subsystem (a cache, network buffers...).
+//
+// The subsystem accounts the memory it holds against the budget, under
+// the budget's name (scollectd::add_budget_metrics() reports it), and
+// checks try_consume() before growing.  When
+// memory runs low, reclaimers attached to a budget that is over its
+// limit are asked to free memory before any other reclaimer, so that
+// subsystems which stay within their budget keep their memory.
+//
+// A budget is not thread safe; use one per lcore.
+class budget {
+    std::string _name;
+    size_t _limit;
+    size_t _used = 0;
+public:
+    budget(std::string name, size_t limit) : _name(std::move(name)), _limit(limit) {}
+    budget(const budget&) = delete;
+    budget& operator=(const budget&) = delete;
+    const std::string& name() const { return _name; }
+    size_t limit() const { return _limit; }
+    void set_limit(size_t limit) { _limit = limit; }
+    // Memory accounted against the budget (in bytes)
+    size_t used() const { return _used; }
+    // Memory that can still be consumed without going over the limit
+    size_t available() const { return _used < _limit ? _limit - _used : 0; }
+    bool over_limit() const { return _used > _limit; }
+    // Accounts \c bytes if that does not go over the limit.
+    bool try_consume(size_t bytes) {
+        if (bytes > available()) {
+            return false;
+        }
+        _used += bytes;
+        return true;
+    }
+    // Accounts \c bytes even if that goes over the limit, for memory
+    // the subsystem cannot refuse (it will be reclaimed from first).
+    void consume(size_t bytes) { _used += bytes; }
+    void release(size_t bytes) { _used -= std::min(bytes, _used); }
+};
+
 class reclaimer {
 public:
+    struct request {
+        // Memory the reclaimer is asked to free.  It may free less, in
+        // which case other reclaimers are asked too, or more.
+        size_t bytes_to_reclaim;
+    };
     using reclaim_fn = std::function<reclaiming_result ()>;
+    using reclaim_request_fn = std::function<reclaiming_result (request)>;
+    static constexpr int default_priority = 0;
 private:
-    reclaim_fn _reclaim;
+    reclaim_request_fn _reclaim;
     reclaimer_scope _scope;
+    int _priority;
+    const budget* _budget;
 public:
     // Installs new reclaimer which will be invoked when system is falling
     // low on memory. 'scope' determines when reclaimer can be executed.
-    reclaimer(reclaim_fn reclaim, reclaimer_scope scope = reclaimer_scope::async);
+    //
+    // Reclaimers are asked to free memory in order of increasing
+    // 'priority'; reclaimers of a higher priority are only asked once all
+    // reclaimers of lower priorities have nothing left to free.  Give
+    // memory that is cheap to recreate a low priority.  A reclaimer
+    // attached to a 'budget' that is over its limit is asked first.
+    reclaimer(reclaim_fn reclaim, reclaimer_scope scope = reclaimer_scope::async,
+            int priority = default_priority, const budget* b = nullptr);
+    // As above, but the reclaimer is told how much memory to free.
+    reclaimer(reclaim_request_fn reclaim, reclaimer_scope scope = reclaimer_scope::async,
+            int priority = default_priority, const budget* b = nullptr);
     ~reclaimer();
-    reclaiming_result do_reclaim() { return _reclaim(); }
+    reclaiming_result do_reclaim(size_t bytes_to_reclaim) { return _reclaim(request{bytes_to_reclaim}); }
     reclaimer_scope scope() const { return _scope; }
+    int priority() const { return _priority; }
+    bool over_budget() const { return _budget && _budget->over_limit(); }
 };
 
+// Asks this cpu's reclaimers to free \c bytes, in the order used when
+// memory runs low (see reclaimer), whatever their scope.  Call it from a
+// task, not while allocating.
+reclaiming_result reclaim(size_t bytes);
+
 // Call periodically to recycle objects that were freed
 // on cpu other than the one they were allocated on.
 //
 // Returns @true if any work was actually performed.
 bool drain_cross_cpu_freelist();
 
+// While enabled, objects freed on this cpu but allocated on another are
+// buffered per owning cpu, and handed over in batches by
+// flush_cross_cpu_frees() (or when a batch fills up) rather than one at
+// a time.  The reactor enables it while it runs, and flushes from its
+// poll loop.  Disabling flushes the buffered objects.
+void set_cross_cpu_free_batching(bool enable);
+
+// Hands objects buffered by cross-cpu free batching over to their
+// owning cpus.
+//
+// Returns @true if any objects were buffered.
+bool flush_cross_cpu_frees();
+
+// Whether \c ptr was allocated by this cpu, so that caching it here for
+// reuse does not take memory from another cpu.  Always true with the
+// default allocator.
+bool is_local(const void* ptr);
+
+// Enables returning free memory to the OS: whole hugepages within free
+// spans of at least \c bytes (rounded up to a hugepage) are released by
+// release_free_memory().  Zero disables.  Has no effect when memory is
+// backed by hugetlbfs.
+void set_free_memory_release_threshold(size_t bytes);
+
+// Releases free memory to the OS, according to the threshold set by
+// set_free_memory_release_threshold(); at most \c max_bytes are released
+// per call.  Meant to be called when the cpu is idle.
+//
+// Returns @true if there may be more memory to release.
+bool release_free_memory(size_t max_bytes);
+
 
 // We don't want the memory code calling back into the rest of
 // the system, so allow the rest of the system to tell the memory
@@ -150,11 +254,20 @@ class statistics {
     size_t _total_memory;
     size_t _free_memory;
     uint64_t _reclaims;
+    size_t _released_memory;
+    uint64_t _total_released_memory;
+    uint64_t _total_refaulted_memory;
+    uint64_t _large_allocations_over_threshold;
 private:
     statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees,
-            uint64_t total_memory, uint64_t free_memory, uint64_t reclaims)
+            uint64_t total_memory, uint64_t free_memory, uint64_t reclaims,
+            size_t released_memory, uint64_t total_released_memory, uint64_t total_refaulted_memory,
+            uint64_t large_allocations_over_threshold)
         : _mallocs(mallocs), _frees(frees), _cross_cpu_frees(cross_cpu_frees)
-        , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims) {}
+        , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims)
+        , _released_memory(released_memory), _total_released_memory(total_released_memory)
+        , _total_refaulted_memory(total_refaulted_memory)
+        , _large_allocations_over_threshold(large_allocations_over_threshold) {}
 public:
     /// Total number of memory allocations calls since the system was started.
     uint64_t mallocs() const { return _mallocs; }
@@ -173,9 +286,77 @@ class statistics {
     size_t total_memory() const { return _total_memory; }
     /// Number of reclaims performed due to low memory
     uint64_t reclaims() const { return _reclaims; }
+    /// Free memory currently returned to the OS (in bytes)
+    size_t released_memory() const { return _released_memory; }
+    /// Total memory returned to the OS since the system was started (in bytes)
+    uint64_t total_released_memory() const { return _total_released_memory; }
+    /// Total memory that was returned to the OS and then allocated again,
+    /// and so faulted back in (in bytes)
+    uint64_t total_refaulted_memory() const { return _total_refaulted_memory; }
+    /// Total number of allocations larger than the large allocation
+    /// warning threshold (see set_large_allocation_warning_threshold())
+    uint64_t large_allocations_over_threshold() const { return _large_allocations_over_threshold; }
     friend statistics stats();
 };
 
+/// Allocation statistics of one size class of small objects, on this lcore.
+struct size_class_stats {
+    /// Size of objects in this class (in bytes)
+    size_t object_size;
+    /// Total number of objects allocated from this class
+    uint64_t allocs;
+    /// Total number of objects freed to this class
+    uint64_t frees;
+    /// Number of objects kept in the class's free list for reuse
+    size_t free_objects;
+    /// Number of spans (runs of pages) the class holds
+    size_t spans;
+    /// Memory held by the class's spans (in bytes)
+    size_t span_memory;
+    /// Number of objects which were allocated but not freed
+    size_t objects_in_use() const { return allocs - frees; }
+    /// Fraction of span memory not used by live objects, either free
+    /// or lost to rounding
+    double fragmentation() const {
+        return span_memory ? 1 - double(objects_in_use() * object_size) / span_memory : 0;
+    }
+};
+
+/// Number of size classes of small objects.
+unsigned nr_size_classes();
+
+/// Capture a snapshot of the statistics of size class \c idx, in
+/// [0, nr_size_classes()), for this lcore.  Classes are ordered by
+/// increasing object size.
+size_class_stats get_size_class_stats(unsigned idx);
+
+/// Number of buckets of the large allocation size histogram.
+constexpr unsigned nr_large_allocation_buckets = 20;
+
+/// Smallest allocation size (in bytes) counted in bucket \c idx of the
+/// large allocation size histogram.  Bucket sizes are powers of two; the
+/// last bucket also counts all larger allocations.
+size_t large_allocation_bucket_size(unsigned idx);
+
+/// Total number of allocations too large for a size class, whose size
+/// falls into bucket \c idx of the histogram, on this lcore.
+uint64_t large_allocations(unsigned idx);
+
+/// Sets the large allocation warning threshold of this lcore: allocations
+/// larger than \c bytes are counted (see
+/// statistics::large_allocations_over_threshold()) and logged with a
+/// backtrace, at most a few times a minute.  Zero disables.
+///
+/// Large allocations search for a free span and fragment memory, so this
+/// is meant to find the occasional huge std::vector or sstring.
+///
+/// Supported only when seastar allocator is enabled.
+void set_large_allocation_warning_threshold(size_t bytes);
+
+/// Returns the large allocation warning threshold of this lcore, or zero
+/// if large allocation warnings are disabled.
+size_t large_allocation_warning_threshold();
+
 struct memory_layout {
     uintptr_t start;
     uintptr_t end;
@@ -185,6 +366,26 @@ struct memory_layout {
 // Supported only when seastar allocator is enabled.
 memory::memory_layout get_memory_layout();
 
+/// Enables sampling heap profiling on this lcore.
+///
+/// On average one allocation is recorded, with its backtrace, for every
+/// \c bytes bytes allocated; recorded allocations are tracked until they
+/// are freed.  Larger intervals cost less and record less.  Zero disables
+/// sampling (allocations already recorded are still tracked).
+///
+/// Supported only when seastar allocator is enabled.
+void set_heap_profiling_interval(size_t bytes);
+
+/// Returns the current heap profiling interval of this lcore, or zero if
+/// heap profiling is disabled.
+size_t heap_profiling_interval();
+
+/// Returns the live sampled allocations of this lcore, as a heap profile
+/// in the format understood by pprof (\c pprof \c <binary> \c <file>).
+///
+/// Supported only when seastar allocator is enabled.
+std::string heap_profile();
+
 }
 
 class with_alignment {
@@ -107,6 +107,11 @@ class file_desc {
         return file_desc(fd);
     }
     static file_desc temporary(sstring directory);
+    // Takes ownership of a descriptor returned by an asynchronous interface
+    // (io_uring accept) rather than by a system call made here.
+    static file_desc from_fd(int fd) {
+        return file_desc(fd);
+    }
     file_desc dup() const {
         int fd = ::dup(get());
         throw_system_error_on(fd == -1, "dup");
@@ -41,10 +41,16 @@
 #include "report_exception.hh"
 #include "util/log.hh"
 #include "file-impl.hh"
+#include "bitops.hh"
 #include <cassert>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/eventfd.h>
+#include <execinfo.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <poll.h>
+#endif
 #include <boost/filesystem.hpp>
 #include <boost/thread/barrier.hpp>
 #include <boost/algorithm/string/classification.hpp>
@@ -69,6 +75,7 @@
 #include "prefetch.hh"
 #include <exception>
 #include <regex>
+#include <fstream>
 #ifdef __GNUC__
 #include <iostream>
 #include <system_error>
@@ -227,8 +234,8 @@ inline int task_quota_signal() {
     return SIGRTMIN + 1;
 }
 
-reactor::reactor()
-    : _backend()
+reactor::reactor(const sstring& backend)
+    : _backend(make_backend(backend))
 #ifdef HAVE_OSV
     , _timer_thread(
         [&] { timer_thread_func(); }, sched::thread::attr().stack(4096).name("timer_thread").pin(sched::cpu::current()))
@@ -287,6 +294,65 @@ reactor::~reactor() {
 void
 reactor::clear_task_quota(int) {
     g_need_preempt = true;
+    if (local_engine) {
+        local_engine->on_task_quota_tick();
+    }
+}
+
+// Async-signal-safe output to stderr, for the stall detector.
+static void print_safe(const char* str) {
+    auto r = ::write(STDERR_FILENO, str, strlen(str));
+    (void)r;
+}
+
+static void print_decimal_safe(uint64_t n) {
+    char buf[21];
+    char* p = buf + sizeof(buf);
+    *--p = '\0';
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    print_safe(p);
+}
+
+// Runs in signal context.
+void reactor::on_task_quota_tick() {
+    auto ticks = _stall_ticks.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (_stall_report_threshold && ticks == _next_stall_report.load(std::memory_order_relaxed)) {
+        _next_stall_report.store(ticks * 2, std::memory_order_relaxed);
+        report_stall(ticks);
+    }
+}
+
+// Runs in signal context, so it may only use async-signal-safe functions.
+// backtrace() qualifies once libgcc has been loaded (see configure()).
+void reactor::report_stall(unsigned ticks) {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    auto now = int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    if (now >= _stall_report_window_end_ns) {
+        _stall_report_window_end_ns = now + int64_t(60) * 1000000000;
+        _stall_reports_in_window = 0;
+    }
+    if (_stall_reports_in_window >= _stall_reports_per_minute) {
+        return;
+    }
+    ++_stall_reports_in_window;
+    void* addrs[64];
+    auto n = ::backtrace(addrs, 64);
+    print_safe("Reactor stalled for ");
+    print_decimal_safe(ticks * _task_quota.count() * 1000);
+    print_safe(" ms on shard ");
+    print_decimal_safe(_id);
+    print_safe(", backtrace:\n");
+    ::backtrace_symbols_fd(addrs, n, STDERR_FILENO);
+}
+
+void reactor::account_stall(unsigned ticks) {
+    ++_stalls;
+    _max_stall_ms = std::max(_max_stall_ms, ticks * _task_quota.count() * 1000);
+    _next_stall_report.store(_stall_report_threshold, std::memory_order_relaxed);
 }
 
 template <typename T, typename E, typename EnableFunc>
@@ -327,7 +393,7 @@ void reactor::timer_thread_func() {
                 if (tmr.expired()) {
                     _timer_due = 0;
                     _engine_thread->unsafe_stop();
-                    _pending_tasks.push_front(make_task([this] {
+                    get_task_queue(default_scheduling_group())._q.push_front(make_task([this] {
                         complete_timers(_timers, _expired_timers, [this] {
                             if (!_timers.empty()) {
                                 enable_timer(_timers.get_next_timeout());
@@ -391,6 +457,20 @@ void reactor::configure(boost::program_options::variables_map vm) {
     _handle_sigint = !vm.count("no-handle-interrupt");
     _task_quota = vm["task-quota-ms"].as<double>() * 1ms;
     _max_task_backlog = vm["max-task-backlog"].as<unsigned>();
+    _stall_report_threshold = vm["stall-report-threshold"].as<unsigned>();
+    _next_stall_report.store(_stall_report_threshold, std::memory_order_relaxed);
+    _stall_reports_per_minute = vm["stall-reports-per-minute"].as<unsigned>();
+    if (_stall_report_threshold) {
+        // The first backtrace() call loads libgcc, which allocates memory;
+        // get that done here rather than in the signal handler.
+        void* addr;
+        ::backtrace(&addr, 1);
+    }
+    memory::set_heap_profiling_interval(vm["heap-profiling-interval"].as<size_t>());
+    memory::set_large_allocation_warning_threshold(parse_memory_size(vm["large-allocation-warning-threshold"].as<std::string>()));
+    if (!vm.count("lock-memory") || !vm["lock-memory"].as<bool>()) {
+        memory::set_free_memory_release_threshold(parse_memory_size(vm["memory-release-threshold"].as<std::string>()));
+    }
     _max_poll_time = vm["idle-poll-time-us"].as<unsigned>() * 1us;
     if (vm.count("poll-mode")) {
         _max_poll_time = std::chrono::nanoseconds::max();
@@ -476,6 +556,88 @@ future<> reactor_backend_epoll::notified(reactor_notifier *n) {
     abort();
 }
 
+future<pollable_fd, socket_address>
+reactor_backend::accept(pollable_fd_state& listenfd) {
+    return readable(listenfd).then([this, &listenfd] () mutable {
+        socket_address sa;
+        socklen_t sl = sizeof(&sa.u.sas);
+        file_desc fd = listenfd.fd.accept(sa.u.sa, sl, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        pollable_fd pfd(std::move(fd), pollable_fd::speculation(EPOLLOUT));
+        return make_ready_future<pollable_fd, socket_address>(std::move(pfd), std::move(sa));
+    });
+}
+
+future<size_t>
+reactor_backend::read_some(pollable_fd_state& fd, void* buffer, size_t len) {
+    return readable(fd).then([this, &fd, buffer, len] () mutable {
+        auto r = fd.fd.read(buffer, len);
+        if (!r) {
+            return read_some(fd, buffer, len);
+        }
+        if (size_t(*r) == len) {
+            fd.speculate_epoll(EPOLLIN);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
+future<size_t>
+reactor_backend::read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) {
+    return readable(fd).then([this, &fd, iov = iov] () mutable {
+        ::msghdr mh = {};
+        mh.msg_iov = &iov[0];
+        mh.msg_iovlen = iov.size();
+        auto r = fd.fd.recvmsg(&mh, 0);
+        if (!r) {
+            return read_some(fd, iov);
+        }
+        if (size_t(*r) == iovec_len(iov)) {
+            fd.speculate_epoll(EPOLLIN);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
+future<size_t>
+reactor_backend::write_some(pollable_fd_state& fd, const void* buffer, size_t len) {
+    return writeable(fd).then([this, &fd, buffer, len] () mutable {
+        auto r = fd.fd.send(buffer, len, MSG_NOSIGNAL);
+        if (!r) {
+            return write_some(fd, buffer, len);
+        }
+        if (size_t(*r) == len) {
+            fd.speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
+static_assert(offsetof(iovec, iov_base) == offsetof(net::fragment, base) &&
+    sizeof(iovec::iov_base) == sizeof(net::fragment::base) &&
+    offsetof(iovec, iov_len) == offsetof(net::fragment, size) &&
+    sizeof(iovec::iov_len) == sizeof(net::fragment::size) &&
+    alignof(iovec) == alignof(net::fragment) &&
+    sizeof(iovec) == sizeof(net::fragment)
+    , "net::fragment and iovec should be equivalent");
+
+future<size_t>
+reactor_backend::write_some(pollable_fd_state& fd, net::packet& p) {
+    return writeable(fd).then([this, &fd, &p] () mutable {
+        iovec* iov = reinterpret_cast<iovec*>(p.fragment_array());
+        msghdr mh = {};
+        mh.msg_iov = iov;
+        mh.msg_iovlen = p.nr_frags();
+        auto r = fd.fd.sendmsg(&mh, MSG_NOSIGNAL);
+        if (!r) {
+            return write_some(fd, p);
+        }
+        if (size_t(*r) == p.len()) {
+            fd.speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
 
 pollable_fd
 reactor::posix_listen(socket_address sa, listen_options opts) {
@@ -562,16 +724,163 @@ reactor::submit_io(Func prepare_io) {
         io.data = pr.get();
         _pending_aio.push_back(io);
         pr.release();
-        if ((_io_queue->queued_requests() > 0) ||
-            (_pending_aio.size() >= std::min(max_aio / 4, _io_queue->_capacity / 2))) {
+        // Requests are otherwise submitted by the aio_batch_submit poller,
+        // after the current batch of tasks, so that the adjacent ones can be
+        // merged.
+        if (_pending_aio.size() >= std::min(max_aio / 4, _io_queue->_capacity / 2)) {
             flush_pending_aio();
         }
         return f;
     });
 }
 
+namespace {
+
+// Requests merged into one vectored request: iov[i] is the buffer of the
+// request completed through parts[i].
+struct merged_aio {
+    std::vector<iovec> iov;
+    std::vector<promise<io_event>*> parts;
+};
+
+}
+
+::iocb
+reactor::merge_aio(const ::iocb* ios, size_t nr) {
+    auto m = std::make_unique<merged_aio>();
+    m->iov.reserve(nr);
+    m->parts.reserve(nr);
+    for (size_t i = 0; i < nr; ++i) {
+        m->iov.push_back(iovec{ios[i].u.c.buf, size_t(ios[i].u.c.nbytes)});
+        m->parts.push_back(reinterpret_cast<promise<io_event>*>(ios[i].data));
+    }
+    ::iocb io;
+    if (ios[0].aio_lio_opcode == IO_CMD_PREAD) {
+        io_prep_preadv(&io, ios[0].aio_fildes, m->iov.data(), nr, ios[0].u.c.offset);
+    } else {
+        io_prep_pwritev(&io, ios[0].aio_fildes, m->iov.data(), nr, ios[0].u.c.offset);
+    }
+    if (_aio_eventfd) {
+        io_set_eventfd(&io, _aio_eventfd->get_fd());
+    }
+    auto pr = std::make_unique<promise<io_event>>();
+    auto f = pr->get_future();
+    io.data = pr.release();
+    // Hand each request its part of the result: a short transfer completes
+    // the first requests and leaves the last ones short or empty, as if
+    // they had been submitted separately.
+    f.then_wrapped([m = std::move(m)] (future<io_event> f) {
+        io_event ev;
+        try {
+            ev = f.get0();
+        } catch (...) {
+            auto ex = std::current_exception();
+            for (auto pr : m->parts) {
+                pr->set_exception(ex);
+                delete pr;
+            }
+            return;
+        }
+        auto remaining = long(ev.res) < 0 ? size_t(0) : size_t(ev.res);
+        for (size_t i = 0; i < m->parts.size(); ++i) {
+            auto part = ev;
+            part.data = m->parts[i];
+            if (long(ev.res) >= 0) {
+                auto len = std::min(remaining, m->iov[i].iov_len);
+                part.res = len;
+                remaining -= len;
+            }
+            m->parts[i]->set_value(part);
+            delete m->parts[i];
+        }
+    });
+    _aio_merged += nr - 1;
+    // The merged requests take a single slot in the aio context.
+    _io_context_available.signal(nr - 1);
+    return io;
+}
+
+static bool mergeable_aio(const ::iocb& io) {
+    return io.aio_lio_opcode == IO_CMD_PREAD || io.aio_lio_opcode == IO_CMD_PWRITE;
+}
+
+// Whether some pending read or write starts where another one on the same
+// file ends, in O(n log n) and without allocating once _pending_aio_ends
+// has grown to the batch size. Keys may collide, which only costs a
+// needless sort.
+bool
+reactor::pending_aio_adjacent() {
+    auto key = [] (const ::iocb& io, uint64_t offset) {
+        return offset ^ (uint64_t(io.aio_fildes) << 40) ^ (uint64_t(io.aio_lio_opcode) << 60);
+    };
+    _pending_aio_ends.clear();
+    for (auto& io : _pending_aio) {
+        if (mergeable_aio(io)) {
+            _pending_aio_ends.push_back(key(io, io.u.c.offset + io.u.c.nbytes));
+        }
+    }
+    if (_pending_aio_ends.size() < 2) {
+        return false;
+    }
+    std::sort(_pending_aio_ends.begin(), _pending_aio_ends.end());
+    return std::any_of(_pending_aio.begin(), _pending_aio.end(), [&] (const ::iocb& io) {
+        return mergeable_aio(io)
+                && std::binary_search(_pending_aio_ends.begin(), _pending_aio_ends.end(), key(io, io.u.c.offset));
+    });
+}
+
+void
+reactor::merge_pending_aio() {
+    if (_pending_aio.size() < 2 || !pending_aio_adjacent()) {
+        return;
+    }
+    std::stable_sort(_pending_aio.begin(), _pending_aio.end(), [&] (const ::iocb& a, const ::iocb& b) {
+        if (a.aio_fildes != b.aio_fildes || a.aio_lio_opcode != b.aio_lio_opcode) {
+            return std::make_pair(a.aio_fildes, a.aio_lio_opcode) < std::make_pair(b.aio_fildes, b.aio_lio_opcode);
+        }
+        return mergeable_aio(a) && a.u.c.offset < b.u.c.offset;
+    });
+    auto nr = _pending_aio.size();
+    size_t out = 0;
+    for (size_t i = 0; i < nr; ) {
+        auto& first = _pending_aio[i];
+        size_t j = i + 1;
+        if (mergeable_aio(first)) {
+            auto end = first.u.c.offset + first.u.c.nbytes;
+            size_t size = first.u.c.nbytes;
+            while (j < nr && j - i < max_merged_aio_iovecs) {
+                auto& next = _pending_aio[j];
+                if (next.aio_fildes != first.aio_fildes || next.aio_lio_opcode != first.aio_lio_opcode
+                        || next.u.c.offset != end || size + next.u.c.nbytes > max_merged_aio_size) {
+                    break;
+                }
+                end += next.u.c.nbytes;
+                size += next.u.c.nbytes;
+                ++j;
+            }
+        }
+        if (j - i == 1) {
+            _pending_aio[out++] = first;
+        } else {
+            auto io = merge_aio(&first, j - i);
+            _pending_aio[out++] = io;
+        }
+        i = j;
+    }
+    _pending_aio.resize(out);
+}
+
 bool
 reactor::flush_pending_aio() {
+    merge_pending_aio();
+    if (_backend->handles_disk_io()) {
+        for (auto& io : _pending_aio) {
+            _backend->submit_disk_io(io);
+        }
+        bool did_work = !_pending_aio.empty();
+        _pending_aio.clear();
+        return did_work;
+    }
     bool did_work = false;
     while (!_pending_aio.empty()) {
         auto nr = _pending_aio.size();
@@ -610,7 +919,7 @@ reactor::flush_pending_aio() {
         if (nr_consumed == nr) {
             _pending_aio.clear();
         } else {
-            _pending_aio.erase(_pending_aio.begin(), _pending_aio.begin() + r);
+            _pending_aio.erase(_pending_aio.begin(), _pending_aio.begin() + nr_consumed);
         }
     }
     return did_work;
@@ -628,7 +937,7 @@ future<io_event>
 reactor::submit_io_read(const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_aio_reads;
     _aio_read_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    return io_queue::queue_request(_io_coordinator, pc, io_direction::read, len, std::move(prepare_io));
 }
 
 template <typename Func>
@@ -636,7 +945,7 @@ future<io_event>
 reactor::submit_io_write(const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_aio_writes;
     _aio_write_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    return io_queue::queue_request(_io_coordinator, pc, io_direction::write, len, std::move(prepare_io));
 }
 
 bool reactor::process_io()
@@ -654,12 +963,56 @@ bool reactor::process_io()
     return n;
 }
 
-io_queue::io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology)
+void reactor::complete_disk_io(promise<io_event>* pr, const io_event& ev) {
+    pr->set_value(ev);
+    delete pr;
+    _io_context_available.signal(1);
+}
+
+io_properties io_properties::load(const sstring& path) {
+    namespace bpo = boost::program_options;
+    bpo::options_description desc;
+    desc.add_options()
+        ("read-iops", bpo::value<double>()->required())
+        ("read-bandwidth", bpo::value<double>()->required())
+        ("write-iops", bpo::value<double>()->required())
+        ("write-bandwidth", bpo::value<double>()->required())
+        ;
+    std::ifstream ifs(path);
+    if (!ifs) {
+        throw std::runtime_error(sprint("cannot open I/O properties file %s", path));
+    }
+    bpo::variables_map vm;
+    bpo::store(bpo::parse_config_file(ifs, desc), vm);
+    bpo::notify(vm);
+    io_properties p;
+    p.read_iops = vm["read-iops"].as<double>();
+    p.read_bandwidth = vm["read-bandwidth"].as<double>();
+    p.write_iops = vm["write-iops"].as<double>();
+    p.write_bandwidth = vm["write-bandwidth"].as<double>();
+    if (!p.valid()) {
+        throw std::runtime_error(sprint("invalid I/O properties in %s: all values must be positive", path));
+    }
+    return p;
+}
+
+constexpr std::chrono::milliseconds io_queue::adjust_period;
+constexpr unsigned io_queue::read_4k_weight;
+
+io_queue::io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology, io_properties properties,
+        std::chrono::microseconds latency_target)
         : _coordinator(coordinator)
         , _capacity(capacity)
         , _io_topology(std::move(topology))
+        , _properties(properties)
+        , _nr_queues(std::set<shard_id>(_io_topology.begin(), _io_topology.end()).size())
         , _priority_classes()
-        , _fq(capacity) {
+        , _fq(capacity)
+        , _latency_target(latency_target) {
+    if (adaptive()) {
+        _adjust_timer.set_callback([this] { adjust_limit(); });
+        _adjust_timer.arm_periodic(adjust_period);
+    }
 }
 
 io_queue::~io_queue() {
@@ -679,20 +1032,27 @@ std::array<std::atomic<uint32_t>, io_queue::_max_classes> io_queue::_registered_
 // structure is passed along all the time - and sometimes we can't help but copy it, better keep
 // it lean. The name won't really be used for anything other than monitoring.
 std::array<sstring, io_queue::_max_classes> io_queue::_registered_names;
+std::array<std::atomic<uint64_t>, io_queue::_max_classes> io_queue::_registered_bytes_per_second;
+std::array<std::atomic<uint64_t>, io_queue::_max_classes> io_queue::_registered_ops_per_second;
 
 void io_queue::fill_shares_array() {
     for (unsigned i = 0; i < _max_classes; ++i) {
         _registered_shares[i].store(0);
+        _registered_bytes_per_second[i].store(0);
+        _registered_ops_per_second[i].store(0);
     }
 }
 
-io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares) {
+io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares,
+        uint64_t bytes_per_second, uint64_t ops_per_second) {
     for (unsigned i = 0; i < _max_classes; ++i) {
         uint32_t unused = 0;
         auto s = _registered_shares[i].compare_exchange_strong(unused, shares, std::memory_order_acq_rel);
         if (s) {
             io_priority_class p;
             _registered_names[i] = name;
+            _registered_bytes_per_second[i].store(bytes_per_second, std::memory_order_release);
+            _registered_ops_per_second[i].store(ops_per_second, std::memory_order_release);
             p.val = i;
             return std::move(p);
         };
@@ -700,6 +1060,28 @@ io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t s
     throw std::runtime_error("No more room for new I/O priority classes");
 }
 
+future<> io_queue::set_rate_limits(const io_priority_class& pc, uint64_t bytes_per_second, uint64_t ops_per_second) {
+    auto id = pc.id();
+    _registered_bytes_per_second.at(id).store(bytes_per_second, std::memory_order_release);
+    _registered_ops_per_second.at(id).store(ops_per_second, std::memory_order_release);
+    // Classes not created yet will pick the limits up from the arrays above.
+    return smp::invoke_on_all([id] {
+        auto& queue = engine().my_io_queue;
+        if (queue) {
+            auto it = queue->_priority_classes.find(id);
+            if (it != queue->_priority_classes.end()) {
+                queue->apply_rate_limits(id, *it->second);
+            }
+        }
+    });
+}
+
+void io_queue::apply_rate_limits(unsigned id, priority_class_data& pclass) {
+    auto bytes_per_second = _registered_bytes_per_second.at(id).load(std::memory_order_acquire);
+    auto ops_per_second = _registered_ops_per_second.at(id).load(std::memory_order_acquire);
+    _fq.set_rate_limits(pclass.ptr, double(bytes_per_second) / _nr_queues, double(ops_per_second) / _nr_queues);
+}
+
 io_queue::priority_class_data::priority_class_data(sstring name, priority_class_ptr ptr)
     : ptr(ptr)
     , bytes(0)
@@ -737,6 +1119,15 @@ io_queue::priority_class_data::priority_class_data(sstring name, priority_class_
             , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
                 return queue_time.count();
             })
+        ),
+        // Time spent with requests queued but held back by the class' rate
+        // limits, in microseconds.
+        scollectd::add_polled_metric(scollectd::type_instance_id("io_queue"
+            , scollectd::per_cpu_plugin_instance
+            , "throttled_time", name)
+            , scollectd::make_typed(scollectd::data_type::DERIVE, [this] {
+                return std::chrono::duration_cast<std::chrono::microseconds>(fair_queue::throttled_time(this->ptr)).count();
+            })
         )
     }))
 {
@@ -762,28 +1153,118 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
         // the same I/O queue (by filtering by instance ID)
         auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(sprint("%s-%d", name, owner), _fq.register_priority_class(shares)));
         it_pclass = ret.first;
+        apply_rate_limits(pc.id(), *it_pclass->second);
     }
     return *(it_pclass->second);
 }
 
+unsigned io_queue::request_weight(io_direction dir, size_t len) const {
+    if (!_properties.valid()) {
+        return read_4k_weight * (1 + len/(16 << 10));
+    }
+    // A request costs a seek and the transfer of whatever exceeds the 4k
+    // that the IOPS were measured with.
+    constexpr size_t iops_request_size = 4096;
+    auto iops = dir == io_direction::read ? _properties.read_iops : _properties.write_iops;
+    auto bandwidth = dir == io_direction::read ? _properties.read_bandwidth : _properties.write_bandwidth;
+    auto cost = 1 / iops + double(len > iops_request_size ? len - iops_request_size : 0) / bandwidth;
+    // Weigh a 4k read as read_4k_weight, like the fallback above does.
+    auto unit = 1 / _properties.read_iops / read_4k_weight;
+    return std::max<unsigned>(1, std::lround(cost / unit));
+}
+
+unsigned io_queue::latency_histogram::bucket_of(uint64_t usec) {
+    // Buckets 0-3 hold 0-3us; then four buckets per power of two.
+    if (usec < 4) {
+        return usec;
+    }
+    usec = std::min<uint64_t>(usec, (uint64_t(1) << 32) - 1);
+    unsigned log = std::numeric_limits<unsigned long long>::digits - 1 - count_leading_zeros((unsigned long long)usec);
+    return log * 4 + ((usec >> (log - 2)) & 3);
+}
+
+uint64_t io_queue::latency_histogram::upper_bound_of(unsigned bucket) {
+    if (bucket < 4) {
+        return bucket + 1;
+    }
+    unsigned log = bucket / 4;
+    return uint64_t(4 + bucket % 4 + 1) << (log - 2);
+}
+
+void io_queue::latency_histogram::add(std::chrono::steady_clock::duration latency) {
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    _buckets[bucket_of(std::max<int64_t>(usec, 0))]++;
+    _count++;
+}
+
+std::chrono::microseconds io_queue::latency_histogram::percentile(double p) const {
+    auto rank = uint64_t(std::ceil(_count * p / 100));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < _buckets.size(); ++i) {
+        seen += _buckets[i];
+        if (seen >= rank && seen) {
+            return std::chrono::microseconds(upper_bound_of(i));
+        }
+    }
+    return std::chrono::microseconds(0);
+}
+
+void io_queue::latency_histogram::clear() {
+    _buckets.fill(0);
+    _count = 0;
+}
+
+void io_queue::adjust_limit() {
+    // Too few completions say little about the latency; wait for more.
+    constexpr uint64_t min_samples = 16;
+    if (_latencies.count() < min_samples) {
+        return;
+    }
+    _latency_p50 = _latencies.percentile(50);
+    _latency_p95 = _latencies.percentile(95);
+    _latency_p99 = _latencies.percentile(99);
+    bool saturated = _fq.capacity_waits() != _capacity_waits_seen;
+    _capacity_waits_seen = _fq.capacity_waits();
+    _fq.set_capacity(next_limit(_fq.capacity(), _capacity, _latency_p95, _latency_target, saturated));
+    _latencies.clear();
+}
+
+unsigned io_queue::next_limit(unsigned limit, unsigned max_limit, std::chrono::microseconds p95,
+        std::chrono::microseconds target, bool saturated) {
+    if (p95 > target) {
+        return std::max(1u, limit * 9 / 10);
+    } else if (saturated) {
+        return std::min(limit + 1, max_limit);
+    }
+    return limit;
+}
+
 template <typename Func>
 future<io_event>
-io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func prepare_io) {
+io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, io_direction dir, size_t len, Func prepare_io) {
     auto start = std::chrono::steady_clock::now();
-    return smp::submit_to(coordinator, [start, &pc, len, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
+    return smp::submit_to(coordinator, [start, &pc, dir, len, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
         auto& queue = *(engine()._io_queue);
-        unsigned weight = 1 + len/(16 << 10);
+        unsigned weight = queue.request_weight(dir, len);
         // First time will hit here, and then we create the class. It is important
         // that we create the shared pointer in the same shard it will be used at later.
         auto& pclass = queue.find_or_create_class(pc, owner);
         pclass.bytes += len;
         pclass.ops++;
         pclass.nr_queued++;
-        return queue._fq.queue(pclass.ptr, weight, [&pclass, start, prepare_io = std::move(prepare_io)] {
+        auto f = queue._fq.queue(pclass.ptr, weight, len, [&queue, &pclass, start, prepare_io = std::move(prepare_io)] {
             pclass.nr_queued--;
-            pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start);
-            return engine().submit_io(std::move(prepare_io));
+            auto dispatched = std::chrono::steady_clock::now();
+            pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(dispatched - start);
+            auto f = engine().submit_io(std::move(prepare_io));
+            if (!queue.adaptive()) {
+                return f;
+            }
+            return f.finally([&queue, dispatched] {
+                queue._latencies.add(std::chrono::steady_clock::now() - dispatched);
+            });
         });
+        return f;
     });
 }
 
@@ -1749,7 +2230,7 @@ reactor::register_collectd_metrics() {
                     , scollectd::per_cpu_plugin_instance
                     , "queue_length", "tasks-pending")
                     , scollectd::make_typed(scollectd::data_type::GAUGE
-                            , std::bind(&decltype(_pending_tasks)::size, &_pending_tasks))
+                            , std::bind(&reactor::pending_tasks, this))
             ),
             // total_operations value:DERIVE:0:U
             scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
@@ -1793,6 +2274,11 @@ reactor::register_collectd_metrics() {
                     , "derive", "aio-write-bytes")
                     , scollectd::make_typed(scollectd::data_type::DERIVE, _aio_write_bytes)
             ),
+            scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "aio-merged")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _aio_merged)
+            ),
             // total_operations value:DERIVE:0:U
             scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
                     , scollectd::per_cpu_plugin_instance
@@ -1862,6 +2348,34 @@ reactor::register_collectd_metrics() {
                 scollectd::make_typed(scollectd::data_type::DERIVE,
                         [] { return memory::stats().reclaims(); })
             ),
+            scollectd::add_polled_metric(
+                scollectd::type_instance_id("memory",
+                    scollectd::per_cpu_plugin_instance,
+                    "memory", "released_memory"),
+                scollectd::make_typed(scollectd::data_type::GAUGE,
+                        [] { return memory::stats().released_memory(); })
+            ),
+            scollectd::add_polled_metric(
+                scollectd::type_instance_id("memory",
+                    scollectd::per_cpu_plugin_instance,
+                    "total_operations", "large_allocations_over_threshold"),
+                scollectd::make_typed(scollectd::data_type::DERIVE,
+                        [] { return memory::stats().large_allocations_over_threshold(); })
+            ),
+            scollectd::add_polled_metric(
+                scollectd::type_instance_id("memory",
+                    scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "released"),
+                scollectd::make_typed(scollectd::data_type::DERIVE,
+                        [] { return memory::stats().total_released_memory(); })
+            ),
+            scollectd::add_polled_metric(
+                scollectd::type_instance_id("memory",
+                    scollectd::per_cpu_plugin_instance,
+                    "total_bytes", "refaulted"),
+                scollectd::make_typed(scollectd::data_type::DERIVE,
+                        [] { return memory::stats().total_refaulted_memory(); })
+            ),
             scollectd::add_polled_metric(
                 scollectd::type_instance_id("reactor",
                     scollectd::per_cpu_plugin_instance,
@@ -1875,6 +2389,18 @@ reactor::register_collectd_metrics() {
                     , "total_operations", "c++exceptions")
                     , scollectd::make_typed(scollectd::data_type::DERIVE, _cxx_exceptions)
             ),
+            // total_operations value:DERIVE:0:U
+            scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "stalls")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _stalls)
+            ),
+            // gauge value:GAUGE:0:U
+            scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                    , scollectd::per_cpu_plugin_instance
+                    , "gauge", "max-stall-ms")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE, _max_stall_ms)
+            ),
     } };
 
     if (my_io_queue) {
@@ -1884,18 +2410,65 @@ reactor::register_collectd_metrics() {
             , scollectd::make_typed(scollectd::data_type::GAUGE,
                 [this] { return my_io_queue->queued_requests(); } )
         ));
+        if (my_io_queue->adaptive()) {
+            ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                , scollectd::per_cpu_plugin_instance
+                , "gauge", "io-queue-limit")
+                , scollectd::make_typed(scollectd::data_type::GAUGE,
+                    [this] { return my_io_queue->limit(); } )
+            ));
+            auto add_latency = [&] (const char* name, std::chrono::microseconds io_queue::* p) {
+                ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                    , scollectd::per_cpu_plugin_instance
+                    , "gauge", name)
+                    , scollectd::make_typed(scollectd::data_type::GAUGE,
+                        [this, p] { return ((*my_io_queue).*p).count(); } )
+                ));
+            };
+            add_latency("io-latency-p50-us", &io_queue::_latency_p50);
+            add_latency("io-latency-p95-us", &io_queue::_latency_p95);
+            add_latency("io-latency-p99-us", &io_queue::_latency_p99);
+        }
+    }
+
+    for (unsigned i = 0; i < memory::nr_size_classes(); ++i) {
+        auto size = to_sstring(memory::get_size_class_stats(i).object_size);
+        auto add = [&] (const char* type, sstring name, scollectd::data_type dt, auto func) {
+            ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+                , scollectd::per_cpu_plugin_instance
+                , type, name + "_" + size)
+                , scollectd::make_typed(dt, [i, func] { return func(memory::get_size_class_stats(i)); })
+            ));
+        };
+        add("total_operations", "malloc", scollectd::data_type::DERIVE,
+                [] (const memory::size_class_stats& s) { return s.allocs; });
+        add("total_operations", "free", scollectd::data_type::DERIVE,
+                [] (const memory::size_class_stats& s) { return s.frees; });
+        add("objects", "malloc", scollectd::data_type::GAUGE,
+                [] (const memory::size_class_stats& s) { return s.objects_in_use(); });
+        add("objects", "spans", scollectd::data_type::GAUGE,
+                [] (const memory::size_class_stats& s) { return s.spans; });
+        add("gauge", "fragmentation", scollectd::data_type::GAUGE,
+                [] (const memory::size_class_stats& s) { return s.fragmentation(); });
+    }
+    for (unsigned i = 0; i < memory::nr_large_allocation_buckets; ++i) {
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "large_malloc_" + to_sstring(memory::large_allocation_bucket_size(i)))
+            , scollectd::make_typed(scollectd::data_type::DERIVE, [i] { return memory::large_allocations(i); })
+        ));
     }
     return ret;
 }
 
 void reactor::run_tasks(circular_buffer<std::unique_ptr<task>>& tasks) {
-    g_need_preempt = false;
     while (!tasks.empty()) {
         auto tsk = std::move(tasks.front());
         tasks.pop_front();
         tsk->run();
         tsk.reset();
         ++_tasks_processed;
+        stall_checkpoint();
         // check at end of loop, to allow at least one task to run
         if (need_preempt() && tasks.size() <= _max_task_backlog) {
             break;
@@ -1903,6 +2476,137 @@ void reactor::run_tasks(circular_buffer<std::unique_ptr<task>>& tasks) {
     }
 }
 
+// Scheduling group registry, shared by all shards. A group's shares are
+// read by every reactor each time it accounts runtime to the group, so
+// set_shares() takes effect everywhere without cross-shard messages.
+// Groups can be created on any shard: a group's name and initial shares are
+// written before it is marked published (release), and only read after
+// checking that mark (acquire), so any shard given the group sees them.
+static std::atomic<unsigned> registered_scheduling_groups{1};
+static std::array<std::atomic<uint32_t>, scheduling_group::max_groups> scheduling_group_shares = {{ {1000} }};
+static std::array<sstring, scheduling_group::max_groups> scheduling_group_names = {{ "default" }};
+static std::array<std::atomic<bool>, scheduling_group::max_groups> scheduling_group_published = {{ {true} }};
+
+static const sstring& scheduling_group_name(unsigned id) {
+    auto published = scheduling_group_published[id].load(std::memory_order_acquire);
+    assert(published);
+    (void)published;
+    return scheduling_group_names[id];
+}
+
+__thread unsigned g_current_scheduling_group;
+
+__thread task_allocator::bucket task_allocator::_buckets[task_allocator::nr_buckets];
+__thread bool task_allocator::_drained;
+
+scheduling_group create_scheduling_group(sstring name, uint32_t shares) {
+    auto id = registered_scheduling_groups.fetch_add(1, std::memory_order_relaxed);
+    if (id >= scheduling_group::max_groups) {
+        registered_scheduling_groups.fetch_sub(1, std::memory_order_relaxed);
+        throw std::runtime_error("No more room for new scheduling groups");
+    }
+    scheduling_group_names[id] = std::move(name);
+    scheduling_group_shares[id].store(std::max(shares, 1u), std::memory_order_relaxed);
+    scheduling_group_published[id].store(true, std::memory_order_release);
+    return scheduling_group(id);
+}
+
+const sstring& scheduling_group::name() const {
+    return scheduling_group_name(_id);
+}
+
+uint32_t scheduling_group::shares() const {
+    return scheduling_group_shares[_id].load(std::memory_order_relaxed);
+}
+
+void scheduling_group::set_shares(uint32_t shares) {
+    scheduling_group_shares[_id].store(std::max(shares, 1u), std::memory_order_relaxed);
+}
+
+reactor::task_queue::task_queue(unsigned id)
+    : _id(id) {
+    auto name = scheduling_group_name(id);
+    _collectd_regs = scollectd::registrations({
+        scollectd::add_polled_metric(scollectd::type_instance_id("scheduler"
+                , scollectd::per_cpu_plugin_instance
+                , "queue_length", name)
+                , scollectd::make_typed(scollectd::data_type::GAUGE
+                        , std::bind(&decltype(_q)::size, &_q))
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("scheduler"
+                , scollectd::per_cpu_plugin_instance
+                , "total_operations", name)
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _tasks_processed)
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id("scheduler"
+                , scollectd::per_cpu_plugin_instance
+                , "derive", name + "-runtime-us")
+                , scollectd::make_typed(scollectd::data_type::DERIVE, _runtime_us)
+        ),
+    });
+}
+
+void reactor::task_queue::account(std::chrono::nanoseconds runtime) {
+    auto shares = scheduling_group_shares[_id].load(std::memory_order_relaxed);
+    _vruntime += double(runtime.count()) / shares;
+    _runtime_us += std::chrono::duration_cast<std::chrono::microseconds>(runtime).count();
+}
+
+reactor::task_queue& reactor::create_task_queue(scheduling_group sg) {
+    _task_queues[sg.id()] = std::make_unique<task_queue>(sg.id());
+    return *_task_queues[sg.id()];
+}
+
+reactor::task_queue* reactor::pick_next_task_queue() {
+    task_queue* next = nullptr;
+    for (auto& tq : _task_queues) {
+        if (tq && !tq->_q.empty() && (!next || tq->_vruntime < next->_vruntime)) {
+            next = tq.get();
+        }
+    }
+    return next;
+}
+
+bool reactor::have_more_tasks() const {
+    return std::any_of(_task_queues.begin(), _task_queues.end(), [] (auto& tq) {
+        return tq && !tq->_q.empty();
+    });
+}
+
+size_t reactor::pending_tasks() const {
+    size_t ret = 0;
+    for (auto& tq : _task_queues) {
+        if (tq) {
+            ret += tq->_q.size();
+        }
+    }
+    return ret;
+}
+
+// Runs tasks until the task quota expires, switching to the runnable queue
+// with the smallest virtual runtime whenever the current one drains.
+void reactor::run_some_tasks() {
+    g_need_preempt = false;
+    auto t_run_started = std::chrono::steady_clock::now();
+    do {
+        auto tq = pick_next_task_queue();
+        if (!tq) {
+            break;
+        }
+        g_current_scheduling_group = tq->_id;
+        auto processed_before = _tasks_processed;
+        run_tasks(tq->_q);
+        tq->_tasks_processed += _tasks_processed - processed_before;
+        auto t_run_completed = std::chrono::steady_clock::now();
+        tq->account(t_run_completed - t_run_started);
+        _last_vruntime = tq->_vruntime;
+        t_run_started = t_run_completed;
+    } while (!need_preempt());
+    // tasks created outside any task (by pollers, for example) go to the
+    // default group
+    g_current_scheduling_group = 0;
+}
+
 void reactor::force_poll() {
     g_need_preempt = true;
 }
@@ -2039,8 +2743,17 @@ class reactor::aio_batch_submit_pollfn final : public reactor::pollfn {
 
 class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
 public:
+    drain_cross_cpu_freelist_pollfn() {
+        memory::set_cross_cpu_free_batching(true);
+    }
+    ~drain_cross_cpu_freelist_pollfn() {
+        memory::set_cross_cpu_free_batching(false);
+    }
     virtual bool poll() final override {
-        return memory::drain_cross_cpu_freelist();
+        // Hand over objects we freed on behalf of other cpus, and free
+        // the ones other cpus handed over to us.
+        auto flushed = memory::flush_cross_cpu_frees();
+        return memory::drain_cross_cpu_freelist() | flushed;
     }
     virtual bool pure_poll() override final {
         return poll(); // actually performs work, but triggers no user continuations, so okay
@@ -2051,6 +2764,9 @@ class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
         // doesn't have any side effects.
         //
         // We'll take care of those items when we wake up for another reason.
+        // Items we freed for other cpus must not wait for us to wake up,
+        // though.
+        memory::flush_cross_cpu_frees();
         return true;
     }
     virtual void exit_interrupt_mode() override final {
@@ -2214,11 +2930,18 @@ void reactor::stop_aio_eventfd_loop() {
     ::write(_aio_eventfd->get_fd(), &one, 8);
 }
 
+// Upper bound on the memory returned to the OS per idle poll, so that
+// madvise() does not delay reacting to new work by much.
+static constexpr size_t max_memory_release_per_idle_poll = 64 << 20;
+
 int reactor::run() {
     auto collectd_metrics = register_collectd_metrics();
 
 #ifndef HAVE_OSV
-    poller io_poller(std::make_unique<io_pollfn>(*this));
+    std::experimental::optional<poller> io_poller;
+    if (!_backend->handles_disk_io()) {
+        io_poller = poller(std::make_unique<io_pollfn>(*this));
+    }
 #endif
 
     poller sig_poller(std::make_unique<signal_pollfn>(*this));
@@ -2307,18 +3030,19 @@ int reactor::run() {
     bool idle = false;
 
     std::function<bool()> check_for_work = [this] () {
-        return poll_once() || !_pending_tasks.empty() || seastar::thread::try_run_one_yielded_thread();
+        return poll_once() || have_more_tasks() || seastar::thread::try_run_one_yielded_thread();
     };
     std::function<bool()> pure_check_for_work = [this] () {
-        return pure_poll_once() || !_pending_tasks.empty() || seastar::thread::try_run_one_yielded_thread();
+        return pure_poll_once() || have_more_tasks() || seastar::thread::try_run_one_yielded_thread();
     };
     while (true) {
-        run_tasks(_pending_tasks);
+        stall_checkpoint();
+        run_some_tasks();
         if (_stopped) {
             load_timer.cancel();
             // Final tasks may include sending the last response to cpu 0, so run them
-            while (!_pending_tasks.empty()) {
-                run_tasks(_pending_tasks);
+            while (have_more_tasks()) {
+                run_some_tasks();
             }
             while (!_at_destroy_tasks.empty()) {
                 run_tasks(_at_destroy_tasks);
@@ -2355,7 +3079,11 @@ int reactor::run() {
             if (go_to_sleep) {
                 _mm_pause();
                 if (idle_end - idle_start > _max_poll_time) {
-                    sleep();
+                    // Return free memory to the OS before sleeping, in small
+                    // steps so that new work is not held up for long.
+                    if (!memory::release_free_memory(max_memory_release_per_idle_poll)) {
+                        sleep();
+                    }
                     // We may have slept for a while, so freshen idle_end
                     idle_end = steady_clock_type::now();
                 }
@@ -2371,6 +3099,8 @@ int reactor::run() {
     // the I/O queue happens to use any other infrastructure that is also kept this way (for
     // instance, collectd), we will not have any way to guarantee who is destroyed first.
     my_io_queue.reset(nullptr);
+    task_allocator::drain();
+    net::receive_buffer_pool::drain();
     return _return;
 }
 
@@ -2563,25 +3293,31 @@ unsigned syscall_work_queue::complete() {
     return nr;
 }
 
-smp_message_queue::smp_message_queue(reactor* from, reactor* to)
-    : _pending(to)
-    , _completed(from)
+smp_message_queue::smp_message_queue(reactor* from, reactor* to, size_t queue_length)
+    : _pending(to, queue_length)
+    , _completed(from, queue_length)
 {
+    _snt_batch.init(queue_length / 4);
+    _cmpl_batch.init(queue_length / 4);
 }
 
 void smp_message_queue::move_pending() {
     auto begin = _tx.a.pending_fifo.cbegin();
     auto end = _tx.a.pending_fifo.cend();
-    end = _pending.push(begin, end);
-    if (begin == end) {
+    auto pushed = _pending.push(begin, end);
+    if (pushed != end) {
+        ++_snt_ring_full;
+    }
+    if (begin == pushed) {
         return;
     }
-    auto nr = end - begin;
+    auto nr = pushed - begin;
     _pending.maybe_wakeup();
-    _tx.a.pending_fifo.erase(begin, end);
+    _tx.a.pending_fifo.erase(begin, pushed);
     _current_queue_length += nr;
     _last_snt_batch = nr;
     _sent += nr;
+    ++_snt_batches;
 }
 
 bool smp_message_queue::pure_poll_tx() const {
@@ -2592,28 +3328,38 @@ bool smp_message_queue::pure_poll_tx() const {
 
 void smp_message_queue::submit_item(smp_message_queue::work_item* item) {
     _tx.a.pending_fifo.push_back(item);
-    if (_tx.a.pending_fifo.size() >= batch_size) {
+    _snt_batch.add();
+    if (_tx.a.pending_fifo.size() >= _snt_batch.threshold()) {
         move_pending();
     }
 }
 
 void smp_message_queue::respond(work_item* item) {
     _completed_fifo.push_back(item);
-    if (_completed_fifo.size() >= batch_size || engine()._stopped) {
-        flush_response_batch();
+    _cmpl_batch.add();
+    if (_completed_fifo.size() >= _cmpl_batch.threshold() || engine()._stopped) {
+        move_completed();
     }
 }
 
 void smp_message_queue::flush_response_batch() {
+    _cmpl_batch.poll();
+    move_completed();
+}
+
+void smp_message_queue::move_completed() {
     if (!_completed_fifo.empty()) {
         auto begin = _completed_fifo.cbegin();
         auto end = _completed_fifo.cend();
-        end = _completed.push(begin, end);
-        if (begin == end) {
+        auto pushed = _completed.push(begin, end);
+        if (pushed != end) {
+            ++_cmpl_ring_full;
+        }
+        if (begin == pushed) {
             return;
         }
         _completed.maybe_wakeup();
-        _completed_fifo.erase(begin, end);
+        _completed_fifo.erase(begin, pushed);
     }
 }
 
@@ -2648,14 +3394,14 @@ template<size_t PrefetchCnt, typename Func>
 size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
     // copy batch to local memory in order to minimize
     // time in which cross-cpu data is accessed
-    work_item* items[queue_length + PrefetchCnt];
+    work_item* items[max_process_batch + PrefetchCnt];
     work_item* wi;
     if (!q.pop(wi))
         return 0;
     // start prefecthing first item before popping the rest to overlap memory
     // access with potential cache miss the second pop may cause
     prefetch<2>(wi);
-    auto nr = q.pop(items);
+    auto nr = q.pop(items, max_process_batch - 1);
     std::fill(std::begin(items) + nr, std::begin(items) + nr + PrefetchCnt, nr ? items[nr - 1] : wi);
     unsigned i = 0;
     do {
@@ -2680,6 +3426,7 @@ size_t smp_message_queue::process_completions() {
 }
 
 void smp_message_queue::flush_request_batch() {
+    _snt_batch.poll();
     if (!_tx.a.pending_fifo.empty()) {
         move_pending();
     }
@@ -2741,6 +3488,31 @@ void smp_message_queue::start(unsigned cpuid) {
                     , "total_operations", "completed-messages")
             , scollectd::make_typed(scollectd::data_type::DERIVE, _compl)
             ),
+            // total_operations value:DERIVE:0:U
+            // sent-messages / sent-batches is the average send batch size.
+            scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
+                    , instance
+                    , "total_operations", "sent-batches")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _snt_batches)
+            ),
+            // total_operations value:DERIVE:0:U
+            // Number of times a batch did not fit in the ring and was
+            // (partially) held back until the next poll.
+            scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
+                    , instance
+                    , "total_operations", "send-ring-full")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _snt_ring_full)
+            ),
+            scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
+                    , instance
+                    , "total_operations", "complete-ring-full")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _cmpl_ring_full)
+            ),
+            scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
+                    , instance
+                    , "queue_length", "send-batch-threshold")
+            , scollectd::make_typed(scollectd::data_type::GAUGE, [this] { return _snt_batch.threshold(); })
+            ),
     });
 }
 
@@ -2873,10 +3645,14 @@ reactor::get_options_description() {
     namespace bpo = boost::program_options;
     bpo::options_description opts("Core options");
     auto net_stack_names = network_stack_registry::list();
+    auto backend_names = available_backends();
     opts.add_options()
         ("network-stack", bpo::value<std::string>(),
                 sprint("select network stack (valid values: %s)",
                         format_separated(net_stack_names.begin(), net_stack_names.end(), ", ")).c_str())
+        ("reactor-backend", bpo::value<std::string>()->default_value(available_backends().front()),
+                sprint("internal reactor implementation (valid values: %s)",
+                        format_separated(backend_names.begin(), backend_names.end(), ", ")).c_str())
         ("no-handle-interrupt", "ignore SIGINT (for gdb)")
         ("poll-mode", "poll continuously (100% cpu use)")
         ("idle-poll-time-us", bpo::value<unsigned>()->default_value(calculate_poll_time() / 1us),
@@ -2885,6 +3661,10 @@ reactor::get_options_description() {
                 "busy-poll for disk I/O (reduces latency and increases throughput)")
         ("task-quota-ms", bpo::value<double>()->default_value(2.0), "Max time (ms) between polls")
         ("max-task-backlog", bpo::value<unsigned>()->default_value(1000), "Maximum number of task backlog to allow; above this we ignore I/O")
+        ("stall-report-threshold", bpo::value<unsigned>()->default_value(50), "Print a backtrace when a task (or poller) runs for this many task quotas without returning to the reactor; 0 disables")
+        ("stall-reports-per-minute", bpo::value<unsigned>()->default_value(5), "Maximum number of stall backtraces to print per minute, on each shard")
+        ("heap-profiling-interval", bpo::value<size_t>()->default_value(0), "Record a backtrace for one allocation per this many bytes allocated, for heap profiling (0 to disable; 524288 is a good start)")
+        ("large-allocation-warning-threshold", bpo::value<std::string>()->default_value("0"), "Log a backtrace for allocations larger than this (ex: 1M), at most a few times a minute on each shard (0 to disable)")
         ("relaxed-dma", "allow using buffered I/O if DMA is not available (reduces performance)")
         ("overprovisioned", "run in an overprovisioned environment (such as docker or a laptop); equivalent to --idle-poll-time-us 0 --thread-affinity 0 --poll-aio 0")
         ("abort-on-seastar-bad-alloc", "abort when seastar allocator cannot allocate memory")
@@ -2905,12 +3685,18 @@ smp::get_options_description()
         ("reserve-memory", bpo::value<std::string>(), "memory reserved to OS (if --memory not specified)")
         ("hugepages", bpo::value<std::string>(), "path to accessible hugetlbfs mount (typically /dev/hugepages/something)")
         ("lock-memory", bpo::value<bool>(), "lock all memory (prevents swapping)")
+        ("memory-release-threshold", bpo::value<std::string>()->default_value("0"), "return free memory in free ranges at least this large (ex: 64M) to the OS when idle (default: 0, never)")
         ("thread-affinity", bpo::value<bool>()->default_value(true), "pin threads to their cpus (disable for overprovisioning)")
+        ("smp-queue-length", bpo::value<unsigned>()->default_value(smp_message_queue::default_queue_length), "capacity of each cross-cpu message ring; raise for heavy cross-cpu traffic")
 #ifdef HAVE_HWLOC
         ("num-io-queues", bpo::value<unsigned>(), "Number of IO queues. Each IO unit will be responsible for a fraction of the IO requests. Defaults to the number of threads")
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of IO queues")
+        ("io-properties-file", bpo::value<sstring>(), "file with the disk's read/write IOPS and bandwidth, as measured by iotune; requests are then weighted by their estimated disk time")
+        ("io-latency-target-ms", bpo::value<double>(), "adjust the number of concurrent requests sent to the disk (up to max-io-requests) so that the 95th percentile of their latency stays under this target (default: fixed); the latency is measured from dispatch by the I/O queue, so it includes the time a request waits to be batched into io_submit()")
 #else
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of processors")
+        ("io-properties-file", bpo::value<sstring>(), "file with the disk's read/write IOPS and bandwidth, as measured by iotune; requests are then weighted by their estimated disk time")
+        ("io-latency-target-ms", bpo::value<double>(), "adjust the number of concurrent requests sent to the disk (up to max-io-requests) so that the 95th percentile of their latency stays under this target (default: fixed); the latency is measured from dispatch by the I/O queue, so it includes the time a request waits to be batched into io_submit()")
 #endif
         ;
     return opts;
@@ -2986,7 +3772,7 @@ void smp::arrive_at_event_loop_end() {
     }
 }
 
-void smp::allocate_reactor() {
+void smp::allocate_reactor(const sstring& backend) {
     assert(!reactor_holder);
 
     // we cannot just write "local_engin = new reactor" since reactor's constructor
@@ -2995,7 +3781,7 @@ void smp::allocate_reactor() {
     int r = posix_memalign(&buf, 64, sizeof(reactor));
     assert(r == 0);
     local_engine = reinterpret_cast<reactor*>(buf);
-    new (buf) reactor;
+    new (buf) reactor(backend);
     reactor_holder.reset(local_engine);
 }
 
@@ -3012,6 +3798,21 @@ void smp::create_thread(std::function<void ()> thread_loop) {
     }
 }
 
+static void report_memory_placement(const std::vector<resource::cpu>& allocations, bool numa_bind) {
+    if (!numa_bind) {
+        seastar_logger.info("Single NUMA node, shard memory is not bound to nodes");
+        return;
+    }
+    for (unsigned shard = 0; shard < allocations.size(); ++shard) {
+        auto& a = allocations[shard];
+        sstring placement;
+        for (auto&& m : a.mem) {
+            placement += sprint("%s%d MB on node %d", placement.empty() ? "" : ", ", m.bytes >> 20, m.nodeid);
+        }
+        seastar_logger.info("Shard {} (cpu {}): memory {}", shard, a.cpu_id, placement);
+    }
+}
+
 void smp::configure(boost::program_options::variables_map configuration)
 {
     // Mask most, to prevent threads (esp. dpdk helper threads)
@@ -3055,6 +3856,11 @@ void smp::configure(boost::program_options::variables_map configuration)
     }
     smp::count = nr_cpus;
     _reactors.resize(nr_cpus);
+    sstring backend_name = configuration["reactor-backend"].as<std::string>();
+    auto backends = reactor::available_backends();
+    if (std::find(backends.begin(), backends.end(), backend_name) == backends.end()) {
+        throw std::runtime_error(sprint("reactor backend %s not available", backend_name));
+    }
     resource::configuration rc;
     if (configuration.count("memory")) {
         rc.total_memory = parse_memory_size(configuration["memory"].as<std::string>());
@@ -3091,7 +3897,19 @@ void smp::configure(boost::program_options::variables_map configuration)
         mlock = configuration["lock-memory"].as<bool>();
     }
     if (mlock) {
+        // With MCL_ONFAULT, memory is locked when it is first touched rather
+        // than when it is mapped, so that each shard can fault in its own
+        // memory in memory::configure(), in parallel with the other shards
+        // and after placing it on the right NUMA node.
+#ifdef MCL_ONFAULT
+        auto r = mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT);
+        if (r && errno == EINVAL) {
+            // kernel older than 4.4
+            r = mlockall(MCL_CURRENT | MCL_FUTURE);
+        }
+#else
         auto r = mlockall(MCL_CURRENT | MCL_FUTURE);
+#endif
         if (r) {
             // Don't hard fail for now, it's hard to get the configuration right
             print("warning: failed to mlockall: %s\n", strerror(errno));
@@ -3110,10 +3928,21 @@ void smp::configure(boost::program_options::variables_map configuration)
 
     auto resources = resource::allocate(rc);
     std::vector<resource::cpu> allocations = std::move(resources.cpus);
+    // On a single node there is nothing to gain from binding memory.
+    auto numa_bind = resources.numa_nodes > 1;
+    report_memory_placement(allocations, numa_bind);
     if (thread_affinity) {
         smp::pin(allocations[0].cpu_id);
     }
-    memory::configure(allocations[0].mem, hugepages_path);
+    // Shard 0 sets up its memory after starting the other shards, so that
+    // all shards do it in parallel. With DPDK, the other shards only start
+    // after DPDK is initialized, which needs the memory already.
+    auto configure_memory = [&] {
+        memory::configure(allocations[0].mem, hugepages_path, numa_bind, mlock);
+    };
+    if (_using_dpdk) {
+        configure_memory();
+    }
 
     if (configuration.count("abort-on-seastar-bad-alloc")) {
         memory::enable_abort_on_allocation_failure();
@@ -3136,12 +3965,21 @@ void smp::configure(boost::program_options::variables_map configuration)
     static boost::barrier inited(smp::count);
 
     auto io_info = std::move(resources.io_queues);
+    io_properties io_props;
+    if (configuration.count("io-properties-file")) {
+        io_props = io_properties::load(configuration["io-properties-file"].as<sstring>());
+    }
+    std::chrono::microseconds io_latency_target(0);
+    if (configuration.count("io-latency-target-ms")) {
+        io_latency_target = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::duration<double, std::milli>(configuration["io-latency-target-ms"].as<double>()));
+    }
 
     std::vector<io_queue*> all_io_queues;
     all_io_queues.resize(io_info.coordinators.size());
     io_queue::fill_shares_array();
 
-    auto alloc_io_queue = [io_info, &all_io_queues] (unsigned shard) {
+    auto alloc_io_queue = [io_info, io_props, io_latency_target, &all_io_queues] (unsigned shard) {
         auto cid = io_info.shard_to_coordinator[shard];
         int vec_idx = 0;
         for (auto& coordinator: io_info.coordinators) {
@@ -3150,7 +3988,8 @@ void smp::configure(boost::program_options::variables_map configuration)
                 continue;
             }
             if (shard == cid) {
-                all_io_queues[vec_idx] = new io_queue(coordinator.id, coordinator.capacity, io_info.shard_to_coordinator);
+                all_io_queues[vec_idx] = new io_queue(coordinator.id, coordinator.capacity, io_info.shard_to_coordinator, io_props,
+                        io_latency_target);
             }
             return vec_idx;
         }
@@ -3170,16 +4009,16 @@ void smp::configure(boost::program_options::variables_map configuration)
     unsigned i;
     for (i = 1; i < smp::count; i++) {
         auto allocation = allocations[i];
-        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity] {
+        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, backend_name, numa_bind, mlock] {
             if (thread_affinity) {
                 smp::pin(allocation.cpu_id);
             }
-            memory::configure(allocation.mem, hugepages_path);
+            memory::configure(allocation.mem, hugepages_path, numa_bind, mlock);
             sigset_t mask;
             sigfillset(&mask);
             auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
             throw_system_error_on(r == -1);
-            allocate_reactor();
+            allocate_reactor(backend_name);
             engine()._id = i;
             _reactors[i] = &engine();
             auto queue_idx = alloc_io_queue(i);
@@ -3193,7 +4032,10 @@ void smp::configure(boost::program_options::variables_map configuration)
         });
     }
 
-    allocate_reactor();
+    if (!_using_dpdk) {
+        configure_memory();
+    }
+    allocate_reactor(backend_name);
     _reactors[0] = &engine();
     auto queue_idx = alloc_io_queue(0);
 
@@ -3207,11 +4049,12 @@ void smp::configure(boost::program_options::variables_map configuration)
 #endif
 
     reactors_registered.wait();
+    auto queue_length = std::max(configuration["smp-queue-length"].as<unsigned>(), 1u);
     smp::_qs = new smp_message_queue* [smp::count];
     for(unsigned i = 0; i < smp::count; i++) {
         smp::_qs[i] = reinterpret_cast<smp_message_queue*>(operator new[] (sizeof(smp_message_queue) * smp::count));
         for (unsigned j = 0; j < smp::count; ++j) {
-            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i]);
+            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i], queue_length);
         }
     }
     smp_queues_constructed.wait();
@@ -3282,6 +4125,426 @@ reactor_backend_epoll::make_reactor_notifier() {
     return std::make_unique<reactor_notifier_epoll>();
 }
 
+#ifdef HAVE_LIBURING
+// An operation bound to one direction of a pollable_fd_state.  The fd points
+// back at the operation through one of its completion slots, so that it can
+// be aborted (abort_reader()/abort_writer()) or cancelled by forget().  A
+// cancelled operation is detached from the fd at once, but only fails its
+// future when its completion is reaped: until then the kernel may still be
+// using the buffers the caller keeps alive for that future.
+class reactor_backend_uring::fd_op : public kernel_completion {
+    pollable_fd_state* _fd;
+    kernel_completion* pollable_fd_state::* _slot;
+    bool _cancelled = false;
+    std::exception_ptr _ex;
+public:
+    fd_op(pollable_fd_state& fd, kernel_completion* pollable_fd_state::* slot)
+            : _fd(&fd), _slot(slot) {
+        assert(!(fd.*slot));
+        fd.*slot = this;
+    }
+    virtual void complete_with(ssize_t res) override final {
+        if (_cancelled) {
+            discard(res);
+            fail(std::move(_ex));
+            return;
+        }
+        _fd->*_slot = nullptr;
+        resolve(res);
+    }
+    void cancel(std::exception_ptr ex) {
+        _fd->*_slot = nullptr;
+        _fd = nullptr;
+        _cancelled = true;
+        _ex = std::move(ex);
+    }
+private:
+    virtual void resolve(ssize_t res) = 0;
+    virtual void fail(std::exception_ptr ex) = 0;
+    // Releases whatever a cancelled operation acquired anyway.
+    virtual void discard(ssize_t res) {}
+};
+
+// An operation whose result is the raw return value of the system call.
+class reactor_backend_uring::result_op : public fd_op {
+    promise<ssize_t> _pr;
+public:
+    using fd_op::fd_op;
+    future<ssize_t> get_future() {
+        return _pr.get_future();
+    }
+private:
+    virtual void resolve(ssize_t res) override {
+        _pr.set_value(res);
+    }
+    virtual void fail(std::exception_ptr ex) override {
+        _pr.set_exception(std::move(ex));
+    }
+};
+
+// recvmsg()/sendmsg(); the kernel reads the msghdr (and the iovec array, if
+// it is ours) while the operation is in flight, so they live here.
+class reactor_backend_uring::msg_op : public result_op {
+public:
+    std::vector<iovec> iov;
+    ::msghdr mh = {};
+    using result_op::result_op;
+};
+
+class reactor_backend_uring::accept_op : public fd_op {
+    promise<pollable_fd, socket_address> _pr;
+public:
+    socket_address sa;
+    socklen_t sl = sizeof(sa.u.sas);
+    using fd_op::fd_op;
+    future<pollable_fd, socket_address> get_future() {
+        return _pr.get_future();
+    }
+private:
+    virtual void resolve(ssize_t res) override {
+        try {
+            throw_kernel_error(res);
+            _pr.set_value(pollable_fd(file_desc::from_fd(res)), std::move(sa));
+        } catch (...) {
+            _pr.set_exception(std::current_exception());
+        }
+    }
+    virtual void fail(std::exception_ptr ex) override {
+        _pr.set_exception(std::move(ex));
+    }
+    virtual void discard(ssize_t res) override {
+        if (res >= 0) {
+            ::close(res);
+        }
+    }
+};
+
+class reactor_backend_uring::disk_op : public kernel_completion {
+    promise<io_event>* _pr;
+public:
+    explicit disk_op(promise<io_event>* pr) : _pr(pr) {}
+    virtual void complete_with(ssize_t res) override {
+        io_event ev = {};
+        ev.data = _pr;
+        ev.res = res;
+        engine().complete_disk_io(_pr, ev);
+    }
+};
+
+reactor_backend_uring::reactor_backend_uring()
+        : _uring(std::make_unique<::io_uring>()) {
+    throw_kernel_error(::io_uring_queue_init(queue_depth, _uring.get(), 0));
+}
+
+reactor_backend_uring::~reactor_backend_uring() {
+    ::io_uring_queue_exit(_uring.get());
+}
+
+bool reactor_backend_uring::available() {
+    ::io_uring ring;
+    if (::io_uring_queue_init(2, &ring, 0) < 0) {
+        return false;
+    }
+    auto probe = ::io_uring_get_probe_ring(&ring);
+    bool ok = probe;
+    if (probe) {
+        for (auto op : { IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_ACCEPT,
+                IORING_OP_RECV, IORING_OP_SEND, IORING_OP_RECVMSG, IORING_OP_SENDMSG,
+                IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV }) {
+            ok &= bool(::io_uring_opcode_supported(probe, op));
+        }
+        ::io_uring_free_probe(probe);
+    }
+    ::io_uring_queue_exit(&ring);
+    return ok;
+}
+
+::io_uring_sqe* reactor_backend_uring::get_sqe() {
+    auto sqe = ::io_uring_get_sqe(_uring.get());
+    while (!sqe) {
+        // The submission ring is full; hand it to the kernel now rather
+        // than at the next poll.
+        submit_pending();
+        reap_completions();
+        sqe = ::io_uring_get_sqe(_uring.get());
+    }
+    // Make sure the reactor polls us for completions.
+    engine().start_epoll();
+    return sqe;
+}
+
+bool reactor_backend_uring::submit_pending() {
+    if (!::io_uring_sq_ready(_uring.get())) {
+        return false;
+    }
+    auto r = ::io_uring_submit(_uring.get());
+    if (r == -EBUSY || r == -EAGAIN) {
+        // Completion ring overflowed, or the kernel is short of memory;
+        // retry after reaping.
+        return false;
+    }
+    throw_kernel_error(r);
+    return r > 0;
+}
+
+bool reactor_backend_uring::reap_completions() {
+    constexpr unsigned batch = 128;
+    std::array<::io_uring_cqe*, batch> cqes;
+    std::array<std::pair<kernel_completion*, ssize_t>, batch> done;
+    auto n = ::io_uring_peek_batch_cqe(_uring.get(), cqes.data(), batch);
+    // Retire the batch before running any completion: they can reenter the
+    // backend (get_sqe() reaps too).
+    for (unsigned i = 0; i < n; ++i) {
+        auto c = static_cast<kernel_completion*>(::io_uring_cqe_get_data(cqes[i]));
+        // the timeout io_uring_wait_cqes() queues on kernels that cannot
+        // pass it to io_uring_enter()
+        if (cqes[i]->user_data == LIBURING_UDATA_TIMEOUT) {
+            c = nullptr;
+        }
+        done[i] = { c, cqes[i]->res };
+    }
+    ::io_uring_cq_advance(_uring.get(), n);
+    for (unsigned i = 0; i < n; ++i) {
+        // cancellation requests and timeouts carry no completion
+        if (auto c = done[i].first) {
+            c->complete_with(done[i].second);
+            delete c;
+        }
+    }
+    return n;
+}
+
+bool reactor_backend_uring::wait_and_process(int timeout, const sigset_t* active_sigmask) {
+    submit_pending();
+    if (timeout) {
+        // timeout is in milliseconds, and negative to wait indefinitely, as
+        // for epoll_wait()
+        ::__kernel_timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+        ::io_uring_cqe* cqe;
+        auto r = ::io_uring_wait_cqes(_uring.get(), &cqe, 1, timeout > 0 ? &ts : nullptr,
+                const_cast<sigset_t*>(active_sigmask));
+        if (r != -EINTR && r != -ETIME) {
+            throw_kernel_error(r);
+        }
+    }
+    return reap_completions();
+}
+
+future<ssize_t>
+reactor_backend_uring::submit(std::unique_ptr<result_op> op, ::io_uring_sqe* sqe) {
+    auto f = op->get_future();
+    ::io_uring_sqe_set_data(sqe, op.release());
+    return f;
+}
+
+future<>
+reactor_backend_uring::poll(pollable_fd_state& fd, kernel_completion* pollable_fd_state::* slot, int events) {
+    auto op = std::make_unique<result_op>(fd, slot);
+    auto sqe = get_sqe();
+    ::io_uring_prep_poll_add(sqe, fd.fd.get(), events);
+    return submit(std::move(op), sqe).then([] (ssize_t r) {
+        throw_kernel_error(r);
+    });
+}
+
+future<> reactor_backend_uring::readable(pollable_fd_state& fd) {
+    if (fd.events_known & EPOLLIN) {
+        fd.events_known &= ~EPOLLIN;
+        return make_ready_future<>();
+    }
+    return poll(fd, &pollable_fd_state::read_completion, POLLIN);
+}
+
+future<> reactor_backend_uring::writeable(pollable_fd_state& fd) {
+    if (fd.events_known & EPOLLOUT) {
+        fd.events_known &= ~EPOLLOUT;
+        return make_ready_future<>();
+    }
+    return poll(fd, &pollable_fd_state::write_completion, POLLOUT);
+}
+
+void reactor_backend_uring::cancel(pollable_fd_state& fd, kernel_completion* pollable_fd_state::* slot,
+        std::exception_ptr ex) {
+    auto op = static_cast<fd_op*>(fd.*slot);
+    if (!op) {
+        return;
+    }
+    op->cancel(std::move(ex));
+    auto sqe = get_sqe();
+    ::io_uring_prep_cancel(sqe, op, 0);
+    ::io_uring_sqe_set_data(sqe, nullptr);
+}
+
+void reactor_backend_uring::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    cancel(fd, &pollable_fd_state::read_completion, std::move(ex));
+    fd.events_known &= ~EPOLLIN;
+}
+
+void reactor_backend_uring::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    cancel(fd, &pollable_fd_state::write_completion, std::move(ex));
+    fd.events_known &= ~EPOLLOUT;
+}
+
+void reactor_backend_uring::forget(pollable_fd_state& fd) {
+    if (!fd.read_completion && !fd.write_completion) {
+        return;
+    }
+    auto ex = std::make_exception_ptr(std::system_error(ECANCELED, std::system_category()));
+    cancel(fd, &pollable_fd_state::read_completion, ex);
+    cancel(fd, &pollable_fd_state::write_completion, ex);
+}
+
+future<pollable_fd, socket_address>
+reactor_backend_uring::accept(pollable_fd_state& listenfd) {
+    auto op = std::make_unique<accept_op>(listenfd, &pollable_fd_state::read_completion);
+    auto sqe = get_sqe();
+    ::io_uring_prep_accept(sqe, listenfd.fd.get(), &op->sa.u.sa, &op->sl, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    auto f = op->get_future();
+    ::io_uring_sqe_set_data(sqe, op.release());
+    return f;
+}
+
+// The socket operations below go to the kernel directly, without a readiness
+// wait.  Sockets are non-blocking, so the kernel may still complete them with
+// -EAGAIN; we then wait for readiness and retry.
+
+future<size_t>
+reactor_backend_uring::read_some(pollable_fd_state& fd, void* buffer, size_t len) {
+    auto op = std::make_unique<result_op>(fd, &pollable_fd_state::read_completion);
+    auto sqe = get_sqe();
+    ::io_uring_prep_recv(sqe, fd.fd.get(), buffer, len, 0);
+    return submit(std::move(op), sqe).then([this, &fd, buffer, len] (ssize_t r) {
+        if (r == -EAGAIN) {
+            return readable(fd).then([this, &fd, buffer, len] {
+                return read_some(fd, buffer, len);
+            });
+        }
+        throw_kernel_error(r);
+        return make_ready_future<size_t>(r);
+    });
+}
+
+future<size_t>
+reactor_backend_uring::read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) {
+    auto op = std::make_unique<msg_op>(fd, &pollable_fd_state::read_completion);
+    op->iov = iov;
+    op->mh.msg_iov = op->iov.data();
+    op->mh.msg_iovlen = op->iov.size();
+    auto sqe = get_sqe();
+    ::io_uring_prep_recvmsg(sqe, fd.fd.get(), &op->mh, 0);
+    return submit(std::move(op), sqe).then([this, &fd, iov] (ssize_t r) {
+        if (r == -EAGAIN) {
+            return readable(fd).then([this, &fd, iov] {
+                return read_some(fd, iov);
+            });
+        }
+        throw_kernel_error(r);
+        return make_ready_future<size_t>(r);
+    });
+}
+
+future<size_t>
+reactor_backend_uring::write_some(pollable_fd_state& fd, const void* buffer, size_t len) {
+    auto op = std::make_unique<result_op>(fd, &pollable_fd_state::write_completion);
+    auto sqe = get_sqe();
+    ::io_uring_prep_send(sqe, fd.fd.get(), buffer, len, MSG_NOSIGNAL);
+    return submit(std::move(op), sqe).then([this, &fd, buffer, len] (ssize_t r) {
+        if (r == -EAGAIN) {
+            return writeable(fd).then([this, &fd, buffer, len] {
+                return write_some(fd, buffer, len);
+            });
+        }
+        throw_kernel_error(r);
+        return make_ready_future<size_t>(r);
+    });
+}
+
+future<size_t>
+reactor_backend_uring::write_some(pollable_fd_state& fd, net::packet& p) {
+    auto op = std::make_unique<msg_op>(fd, &pollable_fd_state::write_completion);
+    // the packet outlives the returned future, so its fragment array can be
+    // handed to the kernel as is (see reactor_backend::write_some())
+    op->mh.msg_iov = reinterpret_cast<iovec*>(p.fragment_array());
+    op->mh.msg_iovlen = p.nr_frags();
+    auto sqe = get_sqe();
+    ::io_uring_prep_sendmsg(sqe, fd.fd.get(), &op->mh, MSG_NOSIGNAL);
+    return submit(std::move(op), sqe).then([this, &fd, &p] (ssize_t r) {
+        if (r == -EAGAIN) {
+            return writeable(fd).then([this, &fd, &p] {
+                return write_some(fd, p);
+            });
+        }
+        throw_kernel_error(r);
+        return make_ready_future<size_t>(r);
+    });
+}
+
+void reactor_backend_uring::submit_disk_io(const ::iocb& io) {
+    auto pr = reinterpret_cast<promise<io_event>*>(io.data);
+    auto sqe = get_sqe();
+    switch (io.aio_lio_opcode) {
+    case IO_CMD_PREAD:
+        ::io_uring_prep_read(sqe, io.aio_fildes, io.u.c.buf, io.u.c.nbytes, io.u.c.offset);
+        break;
+    case IO_CMD_PWRITE:
+        ::io_uring_prep_write(sqe, io.aio_fildes, io.u.c.buf, io.u.c.nbytes, io.u.c.offset);
+        break;
+    case IO_CMD_PREADV:
+        ::io_uring_prep_readv(sqe, io.aio_fildes, io.u.v.vec, io.u.v.nr, io.u.v.offset);
+        break;
+    case IO_CMD_PWRITEV:
+        ::io_uring_prep_writev(sqe, io.aio_fildes, io.u.v.vec, io.u.v.nr, io.u.v.offset);
+        break;
+    default:
+        seastar_logger.error("unexpected aio opcode {}", io.aio_lio_opcode);
+        abort();
+    }
+    ::io_uring_sqe_set_data(sqe, new disk_op(pr));
+}
+
+future<> reactor_backend_uring::notified(reactor_notifier *n) {
+    std::cout << "reactor_backend_uring does not support notifiers!\n";
+    abort();
+}
+
+std::unique_ptr<reactor_notifier>
+reactor_backend_uring::make_reactor_notifier() {
+    return std::make_unique<reactor_notifier_epoll>();
+}
+#endif /* HAVE_LIBURING */
+
+std::unique_ptr<reactor_backend>
+reactor::make_backend(const sstring& name) {
+#ifdef HAVE_OSV
+    return std::make_unique<reactor_backend_osv>();
+#else
+#ifdef HAVE_LIBURING
+    if (name == "io_uring") {
+        return std::make_unique<reactor_backend_uring>();
+    }
+#endif
+    return std::make_unique<reactor_backend_epoll>();
+#endif
+}
+
+std::vector<sstring>
+reactor::available_backends() {
+#ifdef HAVE_OSV
+    return { "osv" };
+#else
+    static std::vector<sstring> backends = [] {
+        std::vector<sstring> ret = { "epoll" };
+#ifdef HAVE_LIBURING
+        if (reactor_backend_uring::available()) {
+            ret.push_back("io_uring");
+        }
+#endif
+        return ret;
+    }();
+    return backends;
+#endif
+}
+
 #ifdef HAVE_OSV
 class reactor_notifier_osv :
         public reactor_notifier, private osv::newpoll::pollable {
@@ -3387,6 +4650,18 @@ reactor_backend_osv::forget(pollable_fd_state& fd) {
     abort();
 }
 
+void
+reactor_backend_osv::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_reader() shouldn't have been called!\n";
+    abort();
+}
+
+void
+reactor_backend_osv::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_writer() shouldn't have been called!\n";
+    abort();
+}
+
 void
 reactor_backend_osv::enable_timer(steady_clock_type::time_point when) {
     _poller.set_timer(when);
@@ -3561,7 +4836,11 @@ future<connected_socket> connect(socket_address sa, socket_address local, transp
 }
 
 void reactor::add_high_priority_task(std::unique_ptr<task>&& t) {
-    _pending_tasks.push_front(std::move(t));
+    auto& tq = get_task_queue(t->group());
+    if (tq._q.empty()) {
+        tq._vruntime = std::max(tq._vruntime, _last_vruntime);
+    }
+    tq._q.push_front(std::move(t));
     // break .then() chains
     g_need_preempt = true;
 }
@@ -80,6 +80,11 @@
 
 extern "C" int _Unwind_RaiseException(void *h);
 
+#ifdef HAVE_LIBURING
+struct io_uring;
+struct io_uring_sqe;
+#endif
+
 using shard_id = unsigned;
 
 namespace scollectd { class registration; }
@@ -88,6 +93,16 @@ class reactor;
 class pollable_fd;
 class pollable_fd_state;
 
+// An operation submitted to a completion-based reactor backend
+// (reactor_backend_uring).  The backend calls complete_with() with the
+// kernel's result (a byte count or a negated errno) when the operation
+// finishes, and then destroys the completion.
+class kernel_completion {
+public:
+    virtual ~kernel_completion() {}
+    virtual void complete_with(ssize_t res) = 0;
+};
+
 struct free_deleter {
     void operator()(void* p) { ::free(p); }
 };
@@ -151,6 +166,9 @@ class pollable_fd_state {
     int events_known = 0;     // returned from epoll
     promise<> pollin;
     promise<> pollout;
+    // Operations in flight on a completion-based backend, one per direction.
+    kernel_completion* read_completion = nullptr;
+    kernel_completion* write_completion = nullptr;
     friend class reactor;
     friend class pollable_fd;
 };
@@ -318,20 +336,56 @@ class syscall_work_queue {
 };
 
 class smp_message_queue {
-    static constexpr size_t queue_length = 128;
-    static constexpr size_t batch_size = 16;
+public:
+    static constexpr size_t default_queue_length = 128;
+private:
+    // Upper bound on the number of items popped from a ring at once.
+    static constexpr size_t max_process_batch = 128;
     static constexpr size_t prefetch_cnt = 2;
     struct work_item;
     struct lf_queue_remote {
         reactor* remote;
     };
-    using lf_queue_base = boost::lockfree::spsc_queue<work_item*,
-                            boost::lockfree::capacity<queue_length>>;
+    using lf_queue_base = boost::lockfree::spsc_queue<work_item*>;
     // use inheritence to control placement order
     struct lf_queue : lf_queue_remote, lf_queue_base {
-        lf_queue(reactor* remote) : lf_queue_remote{remote} {}
+        lf_queue(reactor* remote, size_t length) : lf_queue_remote{remote}, lf_queue_base(length) {}
         void maybe_wakeup();
     };
+    // Decides when a batch of items queued locally is pushed to the ring.
+    // Each push publishes the ring's write index to the other cpu, so large
+    // batches save cross-cpu cache traffic, but hold items back until the
+    // batch fills or the next poll. The threshold tracks a moving average
+    // of the number of items queued between two polls: a lightly loaded
+    // queue pushes each item right away, a busy one batches up to a quarter
+    // of the ring.
+    class adaptive_batch {
+        static constexpr unsigned avg_shift = 3;  // moving average over ~8 polls
+        static constexpr unsigned avg_frac = 4;   // fractional bits of _avg
+        // No constructor: lives in the anonymous structs below.
+        size_t _max;
+        size_t _avg;
+        size_t _arrived;
+        size_t _threshold;
+    public:
+        void init(size_t max) {
+            _max = std::max(max, size_t(1));
+            _avg = 0;
+            _arrived = 0;
+            _threshold = 1;
+        }
+        void add() {
+            ++_arrived;
+        }
+        void poll() {
+            _avg += ((_arrived << avg_frac) >> avg_shift) - (_avg >> avg_shift);
+            _arrived = 0;
+            _threshold = std::min(std::max((_avg >> avg_frac) / 4, size_t(1)), _max);
+        }
+        size_t threshold() const {
+            return _threshold;
+        }
+    };
     lf_queue _pending;
     lf_queue _completed;
     struct alignas(64) {
@@ -340,6 +394,9 @@ class smp_message_queue {
         size_t _last_snt_batch = 0;
         size_t _last_cmpl_batch = 0;
         size_t _current_queue_length = 0;
+        size_t _snt_batches = 0;
+        size_t _snt_ring_full = 0;
+        adaptive_batch _snt_batch;
     };
     // keep this between two structures with statistics
     // this makes sure that they have at least one cache line
@@ -349,8 +406,10 @@ class smp_message_queue {
     struct alignas(64) {
         size_t _received = 0;
         size_t _last_rcv_batch = 0;
+        size_t _cmpl_ring_full = 0;
+        adaptive_batch _cmpl_batch;
     };
-    struct work_item {
+    struct work_item : task_allocated {
         virtual ~work_item() {}
         virtual future<> process() = 0;
         virtual void complete() = 0;
@@ -399,7 +458,7 @@ class smp_message_queue {
     } _tx;
     std::vector<work_item*> _completed_fifo;
 public:
-    smp_message_queue(reactor* from, reactor* to);
+    smp_message_queue(reactor* from, reactor* to, size_t queue_length = default_queue_length);
     template <typename Func>
     futurize_t<std::result_of_t<Func()>> submit(Func&& func) {
         auto wi = new async_work_item<Func>(std::forward<Func>(func));
@@ -417,6 +476,7 @@ class smp_message_queue {
     void submit_item(work_item* wi);
     void respond(work_item* wi);
     void move_pending();
+    void move_completed();
     void flush_request_batch();
     void flush_response_batch();
     bool has_unflushed_responses() const;
@@ -469,8 +529,9 @@ class thread_pool {
 
 // The "reactor_backend" interface provides a method of waiting for various
 // basic events on one thread. We have one implementation based on epoll and
-// file-descriptors (reactor_backend_epoll) and one implementation based on
-// OSv-specific file-descriptor-less mechanisms (reactor_backend_osv).
+// file-descriptors (reactor_backend_epoll), one based on io_uring
+// (reactor_backend_uring) and one implementation based on OSv-specific
+// file-descriptor-less mechanisms (reactor_backend_osv).
 class reactor_backend {
 public:
     virtual ~reactor_backend() {};
@@ -481,11 +542,28 @@ class reactor_backend {
     // pre_process() function is called.
     virtual bool wait_and_process(int timeout = -1, const sigset_t* active_sigmask = nullptr) = 0;
     // Methods that allow polling on file descriptors. This will only work on
-    // reactor_backend_epoll. Other reactor_backend will probably abort if
-    // they are called (which is fine if no file descriptors are waited on):
+    // reactor_backend_epoll and reactor_backend_uring. Other reactor_backend
+    // will probably abort if they are called (which is fine if no file
+    // descriptors are waited on):
     virtual future<> readable(pollable_fd_state& fd) = 0;
     virtual future<> writeable(pollable_fd_state& fd) = 0;
     virtual void forget(pollable_fd_state& fd) = 0;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    // Socket operations. The default implementations wait for readiness with
+    // readable()/writeable() and then issue a non-blocking system call;
+    // completion-based backends override them to submit the operation itself.
+    virtual future<pollable_fd, socket_address> accept(pollable_fd_state& listenfd);
+    virtual future<size_t> read_some(pollable_fd_state& fd, void* buffer, size_t len);
+    virtual future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov);
+    virtual future<size_t> write_some(pollable_fd_state& fd, const void* buffer, size_t len);
+    virtual future<size_t> write_some(pollable_fd_state& fd, net::packet& p);
+    // Disk I/O. A backend returning true from handles_disk_io() receives the
+    // requests prepared by reactor::submit_io() through submit_disk_io(), and
+    // resolves the promise<io_event> stored in iocb::data itself.  Otherwise
+    // the reactor submits them with linux-aio.
+    virtual bool handles_disk_io() const { return false; }
+    virtual void submit_disk_io(const ::iocb& io) { abort(); }
     // Methods that allow polling on a reactor_notifier. This is currently
     // used only for reactor_backend_osv, but in the future it should really
     // replace the above functions.
@@ -514,12 +592,57 @@ class reactor_backend_epoll : public reactor_backend {
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
     virtual void forget(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
-    void abort_reader(pollable_fd_state& fd, std::exception_ptr ex);
-    void abort_writer(pollable_fd_state& fd, std::exception_ptr ex);
 };
 
+#ifdef HAVE_LIBURING
+// reactor backend using io_uring. Socket reads, writes and accepts, as well
+// as disk I/O, are queued on a single submission ring; the whole batch is
+// handed to the kernel with one io_uring_enter() per poll cycle, and
+// completions are reaped from the completion ring without a system call.
+// Readiness waits (readable()/writeable()) use IORING_OP_POLL_ADD.
+class reactor_backend_uring : public reactor_backend {
+private:
+    class fd_op;
+    class result_op;
+    class msg_op;
+    class accept_op;
+    class disk_op;
+    static constexpr unsigned queue_depth = 1024;
+    std::unique_ptr<::io_uring> _uring;
+    ::io_uring_sqe* get_sqe();
+    bool submit_pending();
+    bool reap_completions();
+    future<ssize_t> submit(std::unique_ptr<result_op> op, ::io_uring_sqe* sqe);
+    future<> poll(pollable_fd_state& fd, kernel_completion* pollable_fd_state::* slot, int events);
+    void cancel(pollable_fd_state& fd, kernel_completion* pollable_fd_state::* slot,
+            std::exception_ptr ex);
+public:
+    reactor_backend_uring();
+    virtual ~reactor_backend_uring() override;
+    // Checks whether the running kernel supports the operations we need.
+    static bool available();
+    virtual bool wait_and_process(int timeout, const sigset_t* active_sigmask) override;
+    virtual future<> readable(pollable_fd_state& fd) override;
+    virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual void forget(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual future<pollable_fd, socket_address> accept(pollable_fd_state& listenfd) override;
+    virtual future<size_t> read_some(pollable_fd_state& fd, void* buffer, size_t len) override;
+    virtual future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) override;
+    virtual future<size_t> write_some(pollable_fd_state& fd, const void* buffer, size_t len) override;
+    virtual future<size_t> write_some(pollable_fd_state& fd, net::packet& p) override;
+    virtual bool handles_disk_io() const override { return true; }
+    virtual void submit_disk_io(const ::iocb& io) override;
+    virtual future<> notified(reactor_notifier *n) override;
+    virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
+};
+#endif /* HAVE_LIBURING */
+
 #ifdef HAVE_OSV
 // reactor_backend using OSv-specific features, without any file descriptors.
 // This implementation cannot currently wait on file descriptors, but unlike
@@ -538,6 +661,8 @@ class reactor_backend_osv : public reactor_backend {
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
     virtual void forget(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
     void enable_timer(steady_clock_type::time_point when);
@@ -558,11 +683,48 @@ inline open_flags operator|(open_flags a, open_flags b) {
     return open_flags(static_cast<unsigned int>(a) | static_cast<unsigned int>(b));
 }
 
+enum class io_direction { read, write };
+
+// Disk properties measured by iotune (--io-properties-file), from which the
+// I/O scheduler derives the cost of each request.
+struct io_properties {
+    // 4k random requests per second
+    double read_iops = 0;
+    double write_iops = 0;
+    // sequential bytes per second
+    double read_bandwidth = 0;
+    double write_bandwidth = 0;
+
+    bool valid() const {
+        return read_iops > 0 && write_iops > 0 && read_bandwidth > 0 && write_bandwidth > 0;
+    }
+    static io_properties load(const sstring& path);
+};
+
 class io_queue {
+public:
+    // Completion latencies, in buckets of a quarter of a power of two
+    // microseconds.
+    class latency_histogram {
+        std::array<uint32_t, 128> _buckets = {};
+        uint64_t _count = 0;
+    public:
+        static unsigned bucket_of(uint64_t usec);
+        static uint64_t upper_bound_of(unsigned bucket);
+        void add(std::chrono::steady_clock::duration latency);
+        // Upper bound of the bucket holding the given percentile.
+        std::chrono::microseconds percentile(double p) const;
+        uint64_t count() const { return _count; }
+        void clear();
+    };
+
 private:
     shard_id _coordinator;
     size_t _capacity;
     std::vector<shard_id> _io_topology;
+    io_properties _properties;
+    // Rate limits are split evenly between the I/O queues.
+    unsigned _nr_queues;
 
     struct priority_class_data {
         priority_class_ptr ptr;
@@ -577,28 +739,74 @@ class io_queue {
     std::unordered_map<unsigned, lw_shared_ptr<priority_class_data>> _priority_classes;
     fair_queue _fq;
 
+    // Adaptive queue depth (--io-latency-target-ms): every adjust_period the
+    // number of requests allowed in flight is lowered multiplicatively if the
+    // 95th percentile of the completion latency exceeds the target, and raised
+    // by one if it did not and requests had to wait for it (not just for their
+    // class' rate limits, see fair_queue::capacity_waits()). _capacity stays
+    // the upper bound.
+    static constexpr std::chrono::milliseconds adjust_period{100};
+    std::chrono::microseconds _latency_target;
+    latency_histogram _latencies;
+    std::chrono::microseconds _latency_p50{0};
+    std::chrono::microseconds _latency_p95{0};
+    std::chrono::microseconds _latency_p99{0};
+    uint64_t _capacity_waits_seen = 0;
+    timer<> _adjust_timer;
+
+    void adjust_limit();
+
     static constexpr unsigned _max_classes = 1024;
     static std::array<std::atomic<uint32_t>, _max_classes> _registered_shares;
     static std::array<sstring, _max_classes> _registered_names;
+    static std::array<std::atomic<uint64_t>, _max_classes> _registered_bytes_per_second;
+    static std::array<std::atomic<uint64_t>, _max_classes> _registered_ops_per_second;
 
-    static io_priority_class register_one_priority_class(sstring name, uint32_t shares);
+    static io_priority_class register_one_priority_class(sstring name, uint32_t shares,
+            uint64_t bytes_per_second, uint64_t ops_per_second);
+    static future<> set_rate_limits(const io_priority_class& pc, uint64_t bytes_per_second, uint64_t ops_per_second);
 
     priority_class_data& find_or_create_class(const io_priority_class& pc, shard_id owner);
+    void apply_rate_limits(unsigned id, priority_class_data& pclass);
     static void fill_shares_array();
     friend smp;
 public:
-
-    io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology);
+    // One step of the adaptive queue depth: the limit that follows \c limit,
+    // given the 95th percentile of the latency over the last period and
+    // whether requests had to wait for the limit.
+    static unsigned next_limit(unsigned limit, unsigned max_limit, std::chrono::microseconds p95,
+            std::chrono::microseconds target, bool saturated);
+
+    io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology, io_properties properties = {},
+            std::chrono::microseconds latency_target = std::chrono::microseconds(0));
     ~io_queue();
 
     template <typename Func>
     static future<io_event>
-    queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func do_io);
+    queue_request(shard_id coordinator, const io_priority_class& pc, io_direction dir, size_t len, Func do_io);
+
+    // Weight of a 4k random read. Finer than 1, so that small requests of
+    // different directions and sizes still weigh differently.
+    static constexpr unsigned read_4k_weight = 16;
+
+    // Fair queue weight of a request: its estimated disk time if the disk
+    // properties are known, with a 4k random read weighing read_4k_weight.
+    unsigned request_weight(io_direction dir, size_t len) const;
 
     size_t capacity() const {
         return _capacity;
     }
 
+    bool adaptive() const {
+        return _latency_target.count() > 0;
+    }
+
+    // Requests currently allowed in flight; below capacity() if lowered to
+    // meet the latency target.
+    size_t limit() const {
+        return _fq.capacity();
+    }
+
     size_t queued_requests() const {
         return _fq.waiters();
     }
@@ -679,16 +887,13 @@ class reactor {
     using idle_cpu_handler = std::function<idle_cpu_handler_result(work_waiting_on_reactor)>;
 
 private:
-    // FIXME: make _backend a unique_ptr<reactor_backend>, not a compile-time #ifdef.
+    std::unique_ptr<reactor_backend> _backend;
 #ifdef HAVE_OSV
-    reactor_backend_osv _backend;
     sched::thread _timer_thread;
     sched::thread *_engine_thread;
     mutable mutex _timer_mutex;
     condvar _timer_cond;
     s64 _timer_due = 0;
-#else
-    reactor_backend_epoll _backend;
 #endif
     sigset_t _active_sigmask; // holds sigmask while sleeping with sig disabled
     std::vector<pollfn*> _pollers;
@@ -720,20 +925,56 @@ class reactor {
     semaphore _cpu_started;
     uint64_t _tasks_processed = 0;
     unsigned _max_task_backlog = 1000;
-    seastar::timer_set<timer<>, &timer<>::_link> _timers;
-    seastar::timer_set<timer<>, &timer<>::_link>::timer_list_t _expired_timers;
-    seastar::timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link> _lowres_timers;
-    seastar::timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link>::timer_list_t _expired_lowres_timers;
+    seastar::timer_wheel<timer<>, &timer<>::_link> _timers;
+    seastar::timer_wheel<timer<>, &timer<>::_link>::timer_list_t _expired_timers;
+    seastar::timer_wheel<timer<lowres_clock>, &timer<lowres_clock>::_link> _lowres_timers;
+    seastar::timer_wheel<timer<lowres_clock>, &timer<lowres_clock>::_link>::timer_list_t _expired_lowres_timers;
     io_context_t _io_context;
     std::vector<struct ::iocb> _pending_aio;
+    // Scratch space of pending_aio_adjacent(), kept to avoid allocating
+    // on every flush.
+    std::vector<uint64_t> _pending_aio_ends;
     semaphore _io_context_available;
     uint64_t _aio_reads = 0;
     uint64_t _aio_read_bytes = 0;
     uint64_t _aio_writes = 0;
     uint64_t _aio_write_bytes = 0;
+    // Reads or writes folded into a preceding one by merge_pending_aio()
+    uint64_t _aio_merged = 0;
     uint64_t _fsyncs = 0;
     uint64_t _cxx_exceptions = 0;
-    circular_buffer<std::unique_ptr<task>> _pending_tasks;
+    // Stall detector. _stall_ticks counts task quota timer expirations since
+    // the reactor last finished a task or went back to polling; it is
+    // incremented from the signal handler, which prints a backtrace when it
+    // reaches _stall_report_threshold (and each doubling of it after that).
+    // The signal handler and the code it interrupts share _stall_ticks and
+    // _next_stall_report.
+    std::atomic<unsigned> _stall_ticks = { 0 };
+    unsigned _stall_report_threshold = 0;  // in task quotas; 0 disables
+    std::atomic<unsigned> _next_stall_report = { 0 };
+    unsigned _stall_reports_per_minute = 0;
+    unsigned _stall_reports_in_window = 0;
+    int64_t _stall_report_window_end_ns = 0;
+    uint64_t _stalls = 0;
+    double _max_stall_ms = 0;
+    // Task queue of one scheduling group. The reactor runs the queue with
+    // the smallest virtual runtime (CPU time consumed divided by shares).
+    struct task_queue {
+        explicit task_queue(unsigned id);
+        unsigned _id;
+        double _vruntime = 0;
+        uint64_t _tasks_processed = 0;
+        uint64_t _runtime_us = 0;
+        circular_buffer<std::unique_ptr<task>> _q;
+        std::vector<scollectd::registration> _collectd_regs;
+        void account(std::chrono::nanoseconds runtime);
+    };
+    // Indexed by scheduling_group::id(); created on the group's first task.
+    std::array<std::unique_ptr<task_queue>, scheduling_group::max_groups> _task_queues;
+    // Virtual runtime of the queue that ran last; a queue that becomes
+    // runnable again starts no earlier than this, so it cannot bank credit
+    // while idle.
+    double _last_vruntime = 0;
     circular_buffer<std::unique_ptr<task>> _at_destroy_tasks;
     std::chrono::duration<double> _task_quota;
     /// Handler that will be called when there is no task to execute on cpu.
@@ -762,8 +1003,30 @@ class reactor {
 private:
     static std::chrono::nanoseconds calculate_poll_time();
     static void clear_task_quota(int);
+    void on_task_quota_tick();
+    void report_stall(unsigned ticks);
+    void account_stall(unsigned ticks);
+    // Called whenever the reactor makes progress: a task completed, or a
+    // round of polling started.
+    void stall_checkpoint() {
+        // Only pay for the exchange when there was a tick; it does not lose
+        // one arriving meanwhile.
+        if (_stall_ticks.load(std::memory_order_relaxed)) {
+            auto ticks = _stall_ticks.exchange(0, std::memory_order_relaxed);
+            if (__builtin_expect(_stall_report_threshold && ticks >= _stall_report_threshold, false)) {
+                account_stall(ticks);
+            }
+        }
+    }
     void wakeup();
     bool flush_pending_aio();
+    // Merges reads (or writes) in _pending_aio to consecutive ranges of the
+    // same file into vectored requests of at most max_merged_aio_size bytes.
+    static constexpr size_t max_merged_aio_size = 1 << 20;
+    static constexpr size_t max_merged_aio_iovecs = 64;
+    bool pending_aio_adjacent();
+    void merge_pending_aio();
+    ::iocb merge_aio(const ::iocb* ios, size_t nr);
     bool flush_tcp_batches();
     bool do_expire_lowres_timers();
     bool do_check_lowres_timers() const;
@@ -809,10 +1072,23 @@ class reactor {
     friend class thread_pool;
 
     void run_tasks(circular_buffer<std::unique_ptr<task>>& tasks);
+    void run_some_tasks();
+    task_queue* pick_next_task_queue();
+    task_queue& create_task_queue(scheduling_group sg);
+    bool have_more_tasks() const;
+    size_t pending_tasks() const;
+    task_queue& get_task_queue(scheduling_group sg) {
+        auto& tq = _task_queues[sg.id()];
+        return tq ? *tq : create_task_queue(sg);
+    }
     bool posix_reuseport_detect();
+    void complete_disk_io(promise<io_event>* pr, const io_event& ev);
+    static std::unique_ptr<reactor_backend> make_backend(const sstring& name);
 public:
     static boost::program_options::options_description get_options_description();
-    reactor();
+    // Names accepted by --reactor-backend in this build, default first.
+    static std::vector<sstring> available_backends();
+    explicit reactor(const sstring& backend = available_backends().front());
     reactor(const reactor&) = delete;
     ~reactor();
     void operator=(const reactor&) = delete;
@@ -821,8 +1097,27 @@ class reactor {
         return *_io_queue;
     }
 
-    io_priority_class register_one_priority_class(sstring name, uint32_t shares) {
-        return io_queue::register_one_priority_class(std::move(name), shares);
+    /// How long a task (or poller) may run before it is reported as a stall;
+    /// zero if stalls are not detected.
+    std::chrono::duration<double> stall_report_threshold() const {
+        return _stall_report_threshold * _task_quota;
+    }
+
+    /// Number of reads and writes submitted as part of a preceding adjacent one.
+    uint64_t merged_aio_requests() const {
+        return _aio_merged;
+    }
+
+    /// Registers an I/O priority class, optionally capped in bytes and operations
+    /// per second across all I/O queues (0 means unlimited).
+    io_priority_class register_one_priority_class(sstring name, uint32_t shares,
+            uint64_t bytes_per_second = 0, uint64_t ops_per_second = 0) {
+        return io_queue::register_one_priority_class(std::move(name), shares, bytes_per_second, ops_per_second);
+    }
+
+    /// Changes the rate limits of an I/O priority class on all shards (0 means unlimited).
+    future<> set_io_rate_limits(const io_priority_class& pc, uint64_t bytes_per_second, uint64_t ops_per_second) {
+        return io_queue::set_rate_limits(pc, bytes_per_second, ops_per_second);
     }
 
     void configure(boost::program_options::variables_map config);
@@ -845,6 +1140,7 @@ class reactor {
     future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov);
 
     future<size_t> write_some(pollable_fd_state& fd, const void* buffer, size_t size);
+    future<size_t> write_some(pollable_fd_state& fd, net::packet& p);
 
     future<> write_all(pollable_fd_state& fd, const void* buffer, size_t size);
 
@@ -887,7 +1183,13 @@ class reactor {
         _at_destroy_tasks.push_back(make_task(std::forward<Func>(func)));
     }
 
-    void add_task(std::unique_ptr<task>&& t) { _pending_tasks.push_back(std::move(t)); }
+    void add_task(std::unique_ptr<task>&& t) {
+        auto& tq = get_task_queue(t->group());
+        if (tq._q.empty()) {
+            tq._vruntime = std::max(tq._vruntime, _last_vruntime);
+        }
+        tq._q.push_back(std::move(t));
+    }
 
     /// Set a handler that will be called when there is no task to execute on cpu.
     /// Handler should do a low priority work.
@@ -951,34 +1253,37 @@ class reactor {
     friend class smp;
     friend class smp_message_queue;
     friend class poller;
+#ifdef HAVE_LIBURING
+    friend class reactor_backend_uring;
+#endif
     friend void add_to_flush_poller(output_stream<char>* os);
     friend int _Unwind_RaiseException(void *h);
 public:
     bool wait_and_process(int timeout = 0, const sigset_t* active_sigmask = nullptr) {
-        return _backend.wait_and_process(timeout, active_sigmask);
+        return _backend->wait_and_process(timeout, active_sigmask);
     }
 
     future<> readable(pollable_fd_state& fd) {
-        return _backend.readable(fd);
+        return _backend->readable(fd);
     }
     future<> writeable(pollable_fd_state& fd) {
-        return _backend.writeable(fd);
+        return _backend->writeable(fd);
     }
     void forget(pollable_fd_state& fd) {
-        _backend.forget(fd);
+        _backend->forget(fd);
     }
     future<> notified(reactor_notifier *n) {
-        return _backend.notified(n);
+        return _backend->notified(n);
     }
     void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_reader(fd, std::move(ex));
+        return _backend->abort_reader(fd, std::move(ex));
     }
     void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_writer(fd, std::move(ex));
+        return _backend->abort_writer(fd, std::move(ex));
     }
     void enable_timer(steady_clock_type::time_point when);
     std::unique_ptr<reactor_notifier> make_reactor_notifier() {
-        return _backend.make_reactor_notifier();
+        return _backend->make_reactor_notifier();
     }
     /// Sets the "Strict DMA" flag.
     ///
@@ -1092,7 +1397,7 @@ class smp {
 private:
     static void start_all_queues();
     static void pin(unsigned cpu_id);
-    static void allocate_reactor();
+    static void allocate_reactor(const sstring& backend);
     static void create_thread(std::function<void ()> thread_loop);
 public:
     static unsigned count;
@@ -1117,61 +1422,31 @@ size_t iovec_len(const iovec* begin, size_t len)
 inline
 future<pollable_fd, socket_address>
 reactor::accept(pollable_fd_state& listenfd) {
-    return readable(listenfd).then([this, &listenfd] () mutable {
-        socket_address sa;
-        socklen_t sl = sizeof(&sa.u.sas);
-        file_desc fd = listenfd.fd.accept(sa.u.sa, sl, SOCK_NONBLOCK | SOCK_CLOEXEC);
-        pollable_fd pfd(std::move(fd), pollable_fd::speculation(EPOLLOUT));
-        return make_ready_future<pollable_fd, socket_address>(std::move(pfd), std::move(sa));
-    });
+    return _backend->accept(listenfd);
 }
 
 inline
 future<size_t>
 reactor::read_some(pollable_fd_state& fd, void* buffer, size_t len) {
-    return readable(fd).then([this, &fd, buffer, len] () mutable {
-        auto r = fd.fd.read(buffer, len);
-        if (!r) {
-            return read_some(fd, buffer, len);
-        }
-        if (size_t(*r) == len) {
-            fd.speculate_epoll(EPOLLIN);
-        }
-        return make_ready_future<size_t>(*r);
-    });
+    return _backend->read_some(fd, buffer, len);
 }
 
 inline
 future<size_t>
 reactor::read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) {
-    return readable(fd).then([this, &fd, iov = iov] () mutable {
-        ::msghdr mh = {};
-        mh.msg_iov = &iov[0];
-        mh.msg_iovlen = iov.size();
-        auto r = fd.fd.recvmsg(&mh, 0);
-        if (!r) {
-            return read_some(fd, iov);
-        }
-        if (size_t(*r) == iovec_len(iov)) {
-            fd.speculate_epoll(EPOLLIN);
-        }
-        return make_ready_future<size_t>(*r);
-    });
+    return _backend->read_some(fd, iov);
 }
 
 inline
 future<size_t>
 reactor::write_some(pollable_fd_state& fd, const void* buffer, size_t len) {
-    return writeable(fd).then([this, &fd, buffer, len] () mutable {
-        auto r = fd.fd.send(buffer, len, MSG_NOSIGNAL);
-        if (!r) {
-            return write_some(fd, buffer, len);
-        }
-        if (size_t(*r) == len) {
-            fd.speculate_epoll(EPOLLOUT);
-        }
-        return make_ready_future<size_t>(*r);
-    });
+    return _backend->write_some(fd, buffer, len);
+}
+
+inline
+future<size_t>
+reactor::write_some(pollable_fd_state& fd, net::packet& p) {
+    return _backend->write_some(fd, p);
 }
 
 inline
@@ -1221,28 +1496,7 @@ future<> pollable_fd::write_all(const uint8_t* buffer, size_t size) {
 
 inline
 future<size_t> pollable_fd::write_some(net::packet& p) {
-    return engine().writeable(*_s).then([this, &p] () mutable {
-        static_assert(offsetof(iovec, iov_base) == offsetof(net::fragment, base) &&
-            sizeof(iovec::iov_base) == sizeof(net::fragment::base) &&
-            offsetof(iovec, iov_len) == offsetof(net::fragment, size) &&
-            sizeof(iovec::iov_len) == sizeof(net::fragment::size) &&
-            alignof(iovec) == alignof(net::fragment) &&
-            sizeof(iovec) == sizeof(net::fragment)
-            , "net::fragment and iovec should be equivalent");
-
-        iovec* iov = reinterpret_cast<iovec*>(p.fragment_array());
-        msghdr mh = {};
-        mh.msg_iov = iov;
-        mh.msg_iovlen = p.nr_frags();
-        auto r = get_file_desc().sendmsg(&mh, MSG_NOSIGNAL);
-        if (!r) {
-            return write_some(p);
-        }
-        if (size_t(*r) == p.len()) {
-            _s->speculate_epoll(EPOLLOUT);
-        }
-        return make_ready_future<size_t>(*r);
-    });
+    return engine().write_some(*_s, p);
 }
 
 inline
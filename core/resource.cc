@@ -317,6 +317,7 @@ resources allocate(configuration c) {
     }
 
     ret.io_queues = allocate_io_queues(topology, c, ret.cpus);
+    ret.numa_nodes = std::max<unsigned>(hwloc_get_nbobjs_by_depth(topology, depth), 1);
     return ret;
 }
 
@@ -74,6 +74,8 @@ struct cpu {
 struct resources {
     std::vector<cpu> cpus;
     io_queue_topology io_queues;
+    // NUMA nodes with memory among the cpus we may run on
+    unsigned numa_nodes = 1;
 };
 
 resources allocate(configuration c);
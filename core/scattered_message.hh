@@ -80,6 +80,12 @@ class scattered_message {
         }
     }
 
+    void append(temporary_buffer<char_type> buf) {
+        if (buf.size()) {
+            _p = packet(std::move(_p), fragment{buf.get_write(), buf.size()}, buf.release());
+        }
+    }
+
     void reserve(int n_frags) {
         _p.reserve(n_frags);
     }
@@ -0,0 +1,84 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "sstring.hh"
+
+/// \addtogroup future-module
+/// @{
+
+/// \brief Identifies a scheduling group.
+///
+/// Every task belongs to a scheduling group. Each group has its own task
+/// queue in every reactor, and the reactor divides CPU time among the queues
+/// that have work in proportion to their shares. A task is placed in the
+/// group that was current when it was created, so continuations attached
+/// with \c then() run in the group of the code that attached them.
+///
+/// Scheduling groups are global: a group created on one shard can be used
+/// on all of them.
+class scheduling_group {
+    unsigned _id;
+private:
+    explicit scheduling_group(unsigned id) noexcept : _id(id) {}
+public:
+    static constexpr unsigned max_groups = 16;
+    /// Creates a handle to the default scheduling group.
+    scheduling_group() noexcept : _id(0) {}
+    unsigned id() const { return _id; }
+    const sstring& name() const;
+    uint32_t shares() const;
+    /// \brief Changes the group's shares, on all shards.
+    void set_shares(uint32_t shares);
+    bool operator==(scheduling_group x) const { return _id == x._id; }
+    bool operator!=(scheduling_group x) const { return _id != x._id; }
+    friend scheduling_group create_scheduling_group(sstring name, uint32_t shares);
+    friend scheduling_group current_scheduling_group();
+};
+
+/// \cond internal
+extern __thread unsigned g_current_scheduling_group;
+/// \endcond
+
+/// \brief Creates a scheduling group.
+///
+/// \param name name of the group, used for monitoring
+/// \param shares CPU shares of the group; the default group has 1000
+/// \throws std::runtime_error if all scheduling_group::max_groups groups exist
+scheduling_group create_scheduling_group(sstring name, uint32_t shares);
+
+/// Returns the scheduling group of the currently running task.
+inline
+scheduling_group
+current_scheduling_group() {
+    return scheduling_group(g_current_scheduling_group);
+}
+
+/// Returns the group tasks are placed in by default.
+inline
+scheduling_group
+default_scheduling_group() {
+    return scheduling_group();
+}
+
+/// @}
@@ -30,6 +30,7 @@
 
 #include "scollectd-impl.hh"
 #include "core/future-util.hh"
+#include "core/memory.hh"
 #include "scollectd_api.hh"
 
 bool scollectd::type_instance_id::operator<(
@@ -422,6 +423,16 @@ future<> send_metric(const type_instance_id & id,
     return get_impl().send_metric(id, values);
 }
 
+registrations add_budget_metrics(const memory::budget& b) {
+    sstring name(b.name().data(), b.name().size());
+    return {
+        add_polled_metric(type_instance_id("memory", per_cpu_plugin_instance, "bytes", name + "_used"),
+                make_typed(data_type::GAUGE, [&b] { return b.used(); })),
+        add_polled_metric(type_instance_id("memory", per_cpu_plugin_instance, "bytes", name + "_limit"),
+                make_typed(data_type::GAUGE, [&b] { return b.limit(); })),
+    };
+}
+
 void configure(const boost::program_options::variables_map & opts) {
     bool enable = opts["collectd"].as<bool>();
     if (!enable) {
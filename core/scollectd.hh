@@ -77,6 +77,10 @@
  *
  */
 
+namespace memory {
+class budget;
+}
+
 namespace scollectd {
 
 // The value binding data types
@@ -835,6 +839,10 @@ typed_value::typed_value(const type_id& tid, const scollectd::type_instance& ti,
 
 // Send a message packet (string)
 future<> send_notification(const type_instance_id & id, const sstring & msg);
+
+// Polled gauges of the bytes accounted against a memory budget and of its
+// limit, as "memory" metrics named after the budget.
+registrations add_budget_metrics(const memory::budget& b);
 };
 
 #endif /* SCOLLECTD_HH_ */
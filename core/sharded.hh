@@ -26,6 +26,7 @@
 #include "util/is_smart_ptr.hh"
 #include "do_with.hh"
 #include <boost/iterator/counting_iterator.hpp>
+#include <boost/range/irange.hpp>
 
 namespace seastar {
 
@@ -54,6 +55,19 @@ class no_sharded_instance_exception : public std::exception {
     }
 };
 
+/// Selects the tree-structured variants of \ref sharded::invoke_on_all()
+/// and \ref sharded::map_reduce0().
+///
+/// Instead of sending a message to every shard, the calling shard sends
+/// one to each of \c fanout shards, each of which forwards it to \c fanout
+/// more, and so on; results are reduced on the way back.  The calling
+/// shard handles \c fanout messages rather than one per shard, and the
+/// whole operation takes O(log(smp::count)) hops.
+struct broadcast_tree {
+    unsigned fanout;
+    explicit broadcast_tree(unsigned fanout = 8) : fanout(std::max(fanout, 2u)) {}
+};
+
 /// \defgroup smp-module Multicore
 ///
 /// \brief Support for exploiting multiple cores on a server.
@@ -153,6 +167,19 @@ class sharded {
     template <typename Func>
     future<> invoke_on_all(Func&& func);
 
+    /// Invoke a callable on all instances of \c Service, broadcasting through
+    /// a tree of shards.
+    ///
+    /// \param tree shape of the broadcast tree
+    /// \param func a callable with the signature `void (Service&)`
+    ///             or `future<> (Service&)`, to be called on each core
+    ///             with the local instance as an argument.  It is copied
+    ///             to every shard.
+    /// \return a `future<>` that becomes ready when all cores have
+    ///         processed the message.
+    template <typename Func>
+    future<> invoke_on_all(broadcast_tree tree, Func func);
+
     /// Invoke a method on all instances of `Service` and reduce the results using
     /// `Reducer`.
     ///
@@ -229,6 +256,27 @@ class sharded {
                             std::move(reduce));
     }
 
+    /// Applies a map function to all shards, then reduces the output by calling
+    /// a reducer function, broadcasting through a tree of shards.
+    ///
+    /// Partial results are reduced on intermediate shards, so the calling
+    /// shard only reduces \c tree.fanout values.  Unlike the flat version,
+    /// \c reduce is applied to partial results in no particular order, so it
+    /// must be associative and commutative, and the result of \c map must
+    /// be convertible to \c Initial.
+    ///
+    /// \param tree shape of the broadcast tree
+    /// \param map callable with the signature `Value (Service&)` or
+    ///               `future<Value> (Service&)`.  It is copied to every shard.
+    /// \param initial initial value used as the first input to \c reduce.
+    /// \param reduce binary function taking two Initial values and returning
+    ///               an Initial.  It is copied to every shard.
+    /// \return  Result of applying `map` to each instance in parallel, reduced
+    ///          with `reduce()`.
+    template <typename Mapper, typename Initial, typename Reduce>
+    future<Initial>
+    map_reduce0(broadcast_tree tree, Mapper map, Initial initial, Reduce reduce);
+
     /// Applies a map function to all shards, and return a vector of the result.
     ///
     /// \param mapper callable with the signature `Value (Service&)` or
@@ -320,6 +368,23 @@ class sharded {
         }
         return inst;
     }
+
+    // Broadcast tree nodes are numbered relative to the root shard; the
+    // children of node i are i * fanout + 1 ... i * fanout + fanout.
+    unsigned tree_shard(unsigned root, unsigned node) const {
+        return (root + node) % _instances.size();
+    }
+
+    boost::integer_range<unsigned> tree_children(unsigned node, unsigned fanout) const {
+        unsigned n = _instances.size();
+        return boost::irange(std::min(node * fanout + 1, n), std::min(node * fanout + fanout + 1, n));
+    }
+
+    template <typename Func>
+    future<> invoke_on_subtree(unsigned root, unsigned node, unsigned fanout, Func func);
+
+    template <typename Initial, typename Mapper, typename Reduce>
+    future<Initial> map_reduce_subtree(unsigned root, unsigned node, unsigned fanout, Mapper map, Reduce reduce);
 };
 
 template <typename Service>
@@ -434,6 +499,92 @@ sharded<Service>::invoke_on_all(Func&& func) {
     });
 }
 
+template <typename Service>
+template <typename Func>
+inline
+future<>
+sharded<Service>::invoke_on_all(broadcast_tree tree, Func func) {
+    static_assert(std::is_same<futurize_t<std::result_of_t<Func(Service&)>>, future<>>::value,
+                  "invoke_on_all()'s func must return void or future<>");
+    return invoke_on_subtree(engine().cpu_id(), 0, tree.fanout, std::move(func));
+}
+
+template <typename Service>
+template <typename Func>
+inline
+future<>
+sharded<Service>::invoke_on_subtree(unsigned root, unsigned node, unsigned fanout, Func func) {
+    // func must live until the future it returns resolves, as it does in
+    // the submit_to() work item of the flat invoke_on_all().
+    return do_with(std::move(func), [this, root, node, fanout] (Func& func) {
+        // Forward to the children first, so that they start while we run
+        // func locally.
+        auto children = parallel_for_each(tree_children(node, fanout), [this, root, fanout, &func] (unsigned child) {
+            return smp::submit_to(tree_shard(root, child), [this, root, child, fanout, func] {
+                return invoke_on_subtree(root, child, fanout, func);
+            });
+        });
+        auto local = futurize<std::result_of_t<Func(Service&)>>::apply([this, &func] {
+            return func(*get_local_service());
+        });
+        return when_all(std::move(local), std::move(children)).then([] (std::tuple<future<>, future<>> results) {
+            auto& local = std::get<0>(results);
+            auto& children = std::get<1>(results);
+            if (local.failed()) {
+                children.ignore_ready_future();
+                return std::move(local);
+            }
+            return std::move(children);
+        });
+    });
+}
+
+template <typename Service>
+template <typename Mapper, typename Initial, typename Reduce>
+inline
+future<Initial>
+sharded<Service>::map_reduce0(broadcast_tree tree, Mapper map, Initial initial, Reduce reduce) {
+    return map_reduce_subtree<Initial>(engine().cpu_id(), 0, tree.fanout, std::move(map), reduce).then(
+            [initial = std::move(initial), reduce] (Initial result) mutable {
+        return reduce(std::move(initial), std::move(result));
+    });
+}
+
+template <typename Service>
+template <typename Initial, typename Mapper, typename Reduce>
+inline
+future<Initial>
+sharded<Service>::map_reduce_subtree(unsigned root, unsigned node, unsigned fanout, Mapper map, Reduce reduce) {
+    using acc_type = std::experimental::optional<Initial>;
+    // As in invoke_on_subtree(), map must outlive the future it returns.
+    return do_with(std::move(map), [this, root, node, fanout, reduce] (Mapper& map) {
+        auto children = tree_children(node, fanout);
+        // Element 0 is the local instance, the rest are the subtrees of our
+        // children.  There is no identity element for reduce, so the
+        // accumulator starts out empty and takes the first value as is.
+        return ::map_reduce(boost::irange<unsigned>(0, children.size() + 1), [this, root, fanout, children, &map, reduce] (unsigned i) {
+            if (i == 0) {
+                return futurize<std::result_of_t<Mapper(Service&)>>::apply([this, &map] {
+                    return map(*get_local_service());
+                }).then([] (auto value) {
+                    return Initial(std::move(value));
+                });
+            }
+            auto child = children[i - 1];
+            return smp::submit_to(tree_shard(root, child), [this, root, child, fanout, map, reduce] {
+                return map_reduce_subtree<Initial>(root, child, fanout, map, reduce);
+            });
+        }, acc_type(), [reduce] (acc_type acc, Initial value) mutable {
+            if (!acc) {
+                return acc_type(std::move(value));
+            }
+            return acc_type(reduce(std::move(*acc), std::move(value)));
+        }).then([] (acc_type acc) {
+            return std::move(*acc);
+        });
+    });
+}
+
 template <typename Service>
 Service& sharded<Service>::local() {
     assert(local_is_initialized());
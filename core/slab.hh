@@ -30,6 +30,7 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <limits>
 #include "core/scollectd.hh"
 #include "core/align.hh"
 #include "core/memory.hh"
@@ -127,9 +128,28 @@ struct slab_page_desc {
 
 class slab_item_base {
     bi::list_member_hook<> _lru_link;
+    uint32_t _last_access = 0; // slab_allocator's access clock
 
     template<typename Item>
     friend class slab_class;
+    template<typename Item>
+    friend class slab_allocator;
+};
+
+/*
+ * Statistics of a slab class. Ages are measured in accesses (item
+ * creations and lookups) to the slab allocator.
+ */
+struct slab_class_stats {
+    size_t object_size;
+    size_t pages;
+    uint64_t allocations;
+    uint64_t hits;
+    uint64_t evictions;
+    uint64_t pages_moved_in;
+    uint64_t pages_moved_out;
+    // age of the least recently used item
+    uint32_t lru_age;
 };
 
 template<typename Item>
@@ -143,6 +163,15 @@ class slab_class {
         &slab_item_base::_lru_link>> _lru;
     size_t _size; // size of objects
     uint8_t _slab_class_id;
+    size_t _pages = 0;
+    uint64_t _allocations = 0;
+    uint64_t _hits = 0;
+    uint64_t _evictions = 0;
+    uint64_t _pages_moved_in = 0;
+    uint64_t _pages_moved_out = 0;
+    // evictions since the slab allocator last looked for a page to move
+    // to this class
+    unsigned _eviction_pressure = 0;
 private:
     template<typename... Args>
     inline
@@ -191,6 +220,11 @@ class slab_class {
         return _lru.empty();
     }
 
+    // Least recently used item, or nullptr
+    Item* lru_item() {
+        return _lru.empty() ? nullptr : &reinterpret_cast<Item&>(_lru.back());
+    }
+
     template<typename... Args>
     Item *create(Args&&... args) {
         assert(!_free_slab_pages.empty());
@@ -227,6 +261,7 @@ class slab_class {
 
         _free_slab_pages.push_front(*desc);
         insert_slab_page_desc(*desc);
+        _pages++;
 
         // first object from the allocated slab page is returned.
         return create_item(slab_page, slab_page_index, std::forward<Args>(args)...);
@@ -271,6 +306,9 @@ class slab_class {
         assert(desc.slab_class_id() == _slab_class_id);
         _free_slab_pages.erase(_free_slab_pages.iterator_to(desc));
     }
+
+    template<typename T>
+    friend class slab_allocator;
 };
 
 template<typename Item>
@@ -282,11 +320,18 @@ class slab_allocator {
     // erase_func() is used to remove the item from the cache using slab.
     std::function<void (Item& item_ref)> _erase_func;
     std::vector<slab_page_desc*> _slab_pages_vector;
+    std::vector<uint32_t> _free_page_indexes; // unused entries of _slab_pages_vector
+    uint32_t _clock = 0; // counts accesses, for item ages
     bi::list<slab_page_desc,
         bi::member_hook<slab_page_desc, bi::list_member_hook<>,
         &slab_page_desc::_lru_link>> _slab_page_desc_lru;
     uint64_t _max_object_size;
     uint64_t _available_slab_pages;
+    // Memory held by slab pages.  When the slab has no fixed limit, its
+    // reclaimer is attached to the budget: lowering the budget's limit
+    // below what the slab holds makes it the first to shrink when memory
+    // runs low.
+    memory::budget _budget;
     struct collectd_stats {
         uint64_t allocs;
         uint64_t frees;
@@ -294,68 +339,140 @@ class slab_allocator {
     memory::reclaimer *_reclaimer = nullptr;
     bool _reclaimed = false;
 private:
-    memory::reclaiming_result evict_lru_slab_page() {
-        if (_slab_page_desc_lru.empty()) {
-            // NOTE: Nothing to evict. If this happens, it implies that all
-            // slab pages in the slab are being used at the same time.
-            // That being said, this event is very unlikely to happen.
-            return memory::reclaiming_result::reclaimed_nothing;
+    /*
+     * Call func on each allocated item of a slab page.
+     */
+    template<typename Func>
+    void for_each_item(slab_page_desc& desc, Func func) {
+        auto slab_class = get_slab_class(desc.slab_class_id());
+        auto& free_objects = desc.free_objects();
+        // sort the array of free objects for binary search.
+        std::sort(free_objects.begin(), free_objects.end());
+        uintptr_t object = reinterpret_cast<uintptr_t>(desc.slab_page());
+        auto object_size = slab_class->size();
+        auto objects = _max_object_size / object_size;
+        for (auto i = 0u; i < objects; i++, object += object_size) {
+            // if binary_search returns true, it means that object at the current
+            // offset isn't an item.
+            if (std::binary_search(free_objects.begin(), free_objects.end(), object)) {
+                continue;
+            }
+            func(reinterpret_cast<Item*>(object));
         }
-        // get descriptor of the least-recently-used slab page and related info.
-        auto& desc = _slab_page_desc_lru.back();
-        assert(desc.refcnt() == 0);
-        uint8_t slab_class_id = desc.slab_class_id();
-        auto slab_class = get_slab_class(slab_class_id);
+    }
+
+    /*
+     * Evict all items of a slab page, which must all be unlocked, and free it.
+     */
+    void evict_slab_page(slab_page_desc& desc) {
+        auto slab_class = get_slab_class(desc.slab_class_id());
         void *slab_page = desc.slab_page();
 
-        auto& free_objects = desc.free_objects();
         if (!desc.empty()) {
             // if not empty, remove desc from the list of slab pages with free objects.
             slab_class->remove_desc_from_free_list(desc);
-            // and sort the array of free objects for binary search later on.
-            std::sort(free_objects.begin(), free_objects.end());
         }
         // remove desc from the list of slab page descriptors.
-        _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
+        if (desc._lru_link.is_linked()) {
+            _slab_page_desc_lru.erase(_slab_page_desc_lru.iterator_to(desc));
+        }
         // remove desc from the slab page vector.
         _slab_pages_vector[desc.index()] = nullptr;
+        _free_page_indexes.push_back(desc.index());
 
-        // Iterate through objects in the slab page and if the object is an allocated
-        // item, the item should be removed from LRU and then erased.
-        uintptr_t object = reinterpret_cast<uintptr_t>(slab_page);
-        auto object_size = slab_class->size();
-        auto objects = _max_object_size / object_size;
-        for (auto i = 0u; i < objects; i++, object += object_size) {
-            if (!desc.empty()) {
-                // if binary_search returns true, it means that object at the current
-                // offset isn't an item.
-                if (std::binary_search(free_objects.begin(), free_objects.end(), object)) {
-                    continue;
-                }
-            }
-            Item* item = reinterpret_cast<Item*>(object);
+        // If the object is an allocated item, the item should be removed from LRU
+        // and then erased.
+        for_each_item(desc, [&] (Item* item) {
             assert(item->is_unlocked());
             slab_class->remove_item_from_lru(item);
             _erase_func(*item);
+            slab_class->_evictions++;
             _stats.frees++;
-        }
+        });
+        slab_class->_pages--;
+        _budget.release(_max_object_size);
 #ifdef DEBUG
-        printf("lru slab page eviction succeeded! desc_empty?=%d\n", desc.empty());
+        printf("slab page eviction succeeded! desc_empty?=%d\n", desc.empty());
 #endif
         ::free(slab_page); // free slab page object
         delete &desc; // free its descriptor
+    }
+
+    memory::reclaiming_result evict_lru_slab_page() {
+        if (_slab_page_desc_lru.empty()) {
+            // NOTE: Nothing to evict. If this happens, it implies that all
+            // slab pages in the slab are being used at the same time.
+            // That being said, this event is very unlikely to happen.
+            return memory::reclaiming_result::reclaimed_nothing;
+        }
+        // evict the least-recently-used slab page.
+        auto& desc = _slab_page_desc_lru.back();
+        assert(desc.refcnt() == 0);
+        evict_slab_page(desc);
         return memory::reclaiming_result::reclaimed_something;
     }
 
     /*
-     * Reclaim the least recently used slab page that is unused.
+     * Rebalancing (when the slab has a limit): called when class dst is out
+     * of memory and must evict items. Once it has evicted a page's worth of
+     * items, move a page to it from the class whose least recently used item
+     * is the oldest, if that item is much older than the one dst would
+     * evict, so that memory follows the object size mix.
      */
-    memory::reclaiming_result reclaim() {
+    void maybe_move_page_to(slab_class<Item>& dst) {
+        if (++dst._eviction_pressure < _max_object_size / dst.size()) {
+            return;
+        }
+        dst._eviction_pressure = 0;
+        auto age = [this] (slab_class<Item>& sc) -> uint32_t {
+            auto item = sc.lru_item();
+            return item ? _clock - item->_last_access : 0;
+        };
+        slab_class<Item>* src = nullptr;
+        uint32_t src_age = 0;
+        for (auto& sc : _slab_classes) {
+            // leave each class a page, so that it can still make progress.
+            if (&sc != &dst && sc._pages > 1 && age(sc) > src_age) {
+                src = &sc;
+                src_age = age(sc);
+            }
+        }
+        if (!src || src_age / 2 < age(dst)) {
+            return;
+        }
+        auto& desc = get_slab_page_desc(src->lru_item());
+        bool unlocked = true;
+        for_each_item(desc, [&] (Item* item) {
+            unlocked &= item->is_unlocked();
+        });
+        if (!unlocked) {
+            return;
+        }
+        evict_slab_page(desc);
+        _available_slab_pages++;
+        src->_pages_moved_out++;
+        dst._pages_moved_in++;
+    }
+
+    void mark_accessed(Item* item) {
+        item->_last_access = ++_clock;
+    }
+
+    /*
+     * Reclaim least recently used slab pages that are unused, until at least
+     * the requested amount of memory is freed.
+     */
+    memory::reclaiming_result reclaim(size_t bytes_to_reclaim) {
         // once reclaimer was called, slab pages should no longer be allocated, as the
         // memory used by slab is supposed to be calibrated.
         _reclaimed = true;
-        // FIXME: Should reclaim() only evict a single slab page at a time?
-        return evict_lru_slab_page();
+        auto result = memory::reclaiming_result::reclaimed_nothing;
+        size_t reclaimed = 0;
+        while (reclaimed < bytes_to_reclaim && evict_lru_slab_page() == memory::reclaiming_result::reclaimed_something) {
+            reclaimed += _max_object_size;
+            result = memory::reclaiming_result::reclaimed_something;
+        }
+        return result;
     }
 
     void initialize_slab_allocator(double growth_factor, uint64_t limit) {
@@ -377,7 +494,9 @@ class slab_allocator {
 
         // If slab limit is zero, enable reclaimer.
         if (!limit) {
-            _reclaimer = new memory::reclaimer([this] { return reclaim(); });
+            _reclaimer = new memory::reclaimer([this] (memory::reclaimer::request r) {
+                return reclaim(r.bytes_to_reclaim);
+            }, memory::reclaimer_scope::async, memory::reclaimer::default_priority, &_budget);
         } else {
             _slab_pages_vector.reserve(_available_slab_pages);
         }
@@ -398,6 +517,13 @@ class slab_allocator {
         return &_slab_classes[slab_class_id];
     }
 
+    slab_class_stats stats_of(slab_class<Item>& sc) {
+        auto item = sc.lru_item();
+        uint32_t lru_age = item ? _clock - item->_last_access : 0;
+        return slab_class_stats{sc.size(), sc._pages, sc._allocations, sc._hits, sc._evictions,
+            sc._pages_moved_in, sc._pages_moved_out, lru_age};
+    }
+
     void register_collectd_metrics() {
         auto add = [this] (auto type_name, auto name, auto data_type, auto func) {
             _registrations.push_back(
@@ -410,6 +536,17 @@ class slab_allocator {
         add("total_operations", "malloc", scollectd::data_type::DERIVE, [&] { return _stats.allocs; });
         add("total_operations", "free", scollectd::data_type::DERIVE, [&] { return _stats.frees; });
         add("objects", "malloc", scollectd::data_type::GAUGE, [&] { return _stats.allocs - _stats.frees; });
+        for (auto&& r : scollectd::add_budget_metrics(_budget)) {
+            _registrations.push_back(std::move(r));
+        }
+        for (auto& sc : _slab_classes) {
+            auto size = "_" + to_sstring(sc.size());
+            auto p = &sc;
+            add("total_operations", "hits" + size, scollectd::data_type::DERIVE, [p] { return p->_hits; });
+            add("total_operations", "evictions" + size, scollectd::data_type::DERIVE, [p] { return p->_evictions; });
+            add("objects", "pages" + size, scollectd::data_type::GAUGE, [p] { return p->_pages; });
+            add("gauge", "lru_age" + size, scollectd::data_type::GAUGE, [this, p] { return stats_of(*p).lru_age; });
+        }
     }
 
     inline slab_page_desc& get_slab_page_desc(Item *item)
@@ -428,6 +565,7 @@ class slab_allocator {
     slab_allocator(double growth_factor, uint64_t limit, uint64_t max_object_size)
         : _max_object_size(max_object_size)
         , _available_slab_pages(limit / max_object_size)
+        , _budget("slab", limit ? limit : std::numeric_limits<size_t>::max())
     {
         initialize_slab_allocator(growth_factor, limit);
         register_collectd_metrics();
@@ -438,11 +576,16 @@ class slab_allocator {
         : _erase_func(std::move(erase_func))
         , _max_object_size(max_object_size)
         , _available_slab_pages(limit / max_object_size)
+        , _budget("slab", limit ? limit : std::numeric_limits<size_t>::max())
     {
         initialize_slab_allocator(growth_factor, limit);
         register_collectd_metrics();
     }
 
+    memory::budget& budget() {
+        return _budget;
+    }
+
     ~slab_allocator()
     {
         _slab_page_desc_lru.clear();
@@ -472,16 +615,26 @@ class slab_allocator {
             item = slab_class->create(std::forward<Args>(args)...);
             _stats.allocs++;
         } else {
+            if (!can_allocate_page(*slab_class) && _erase_func) {
+                maybe_move_page_to(*slab_class);
+            }
             if (can_allocate_page(*slab_class)) {
-                auto index_to_insert = _slab_pages_vector.size();
+                auto reuse_index = !_free_page_indexes.empty();
+                auto index_to_insert = reuse_index ? _free_page_indexes.back() : _slab_pages_vector.size();
                 item = slab_class->create_from_new_page(_max_object_size, index_to_insert,
-                    [this](slab_page_desc& desc) {
+                    [this, reuse_index](slab_page_desc& desc) {
+                        _budget.consume(_max_object_size);
                         if (_reclaimer) {
                             // insert desc into the LRU list of slab page descriptors.
                             _slab_page_desc_lru.push_front(desc);
                         }
                         // insert desc into the slab page vector.
-                        _slab_pages_vector.push_back(&desc);
+                        if (reuse_index) {
+                            _free_page_indexes.pop_back();
+                            _slab_pages_vector[desc.index()] = &desc;
+                        } else {
+                            _slab_pages_vector.push_back(&desc);
+                        }
                     },
                     std::forward<Args>(args)...);
                 if (_available_slab_pages > 0) {
@@ -490,8 +643,13 @@ class slab_allocator {
                 _stats.allocs++;
             } else if (_erase_func) {
                 item = slab_class->create_from_lru(_erase_func, std::forward<Args>(args)...);
+                slab_class->_evictions++;
             }
         }
+        if (item) {
+            slab_class->_allocations++;
+            mark_accessed(item);
+        }
         return item;
     }
 
@@ -508,6 +666,7 @@ class slab_allocator {
         // remove item from the lru of its slab class.
         auto slab_class = get_slab_class(desc.slab_class_id());
         slab_class->remove_item_from_lru(item);
+        slab_class->_hits++;
     }
 
     void unlock_item(Item *item) {
@@ -523,6 +682,7 @@ class slab_allocator {
         // insert item into the lru of its slab class.
         auto slab_class = get_slab_class(desc.slab_class_id());
         slab_class->insert_item_into_lru(item);
+        mark_accessed(item);
     }
 
     /**
@@ -545,7 +705,21 @@ class slab_allocator {
             auto& desc = get_slab_page_desc(item);
             auto slab_class = get_slab_class(desc.slab_class_id());
             slab_class->touch_item(item);
+            slab_class->_hits++;
+            mark_accessed(item);
+        }
+    }
+
+    /**
+     * Statistics of all slab classes, in increasing object size.
+     */
+    std::vector<slab_class_stats> class_stats() {
+        std::vector<slab_class_stats> ret;
+        ret.reserve(_slab_classes.size());
+        for (auto& sc : _slab_classes) {
+            ret.push_back(stats_of(sc));
         }
+        return ret;
     }
 
     /**
@@ -22,11 +22,99 @@
 #pragma once
 
 #include <memory>
+#include <new>
+#include "scheduling.hh"
+#include "memory.hh"
 
-class task {
+/// \cond internal
+// Per-shard cache of freed task-sized objects, bucketed by size. Tasks
+// (continuations in particular) and cross-shard work items are created and
+// destroyed at a very high rate but come in a handful of sizes, so recycling
+// them through a free list saves an allocator round trip for each.
+// Objects freed on a different shard than the one that allocated them
+// are not cached: they go back to the allocator, which returns them to
+// their shard.
+class task_allocator {
+    static constexpr size_t granularity = 16;
+    static constexpr size_t max_size = 512;
+    static constexpr unsigned nr_buckets = max_size / granularity;
+    // Bound on the objects kept per bucket, so a burst does not pin memory.
+    static constexpr unsigned max_cached = 1024;
+    struct free_object {
+        free_object* next;
+    };
+    struct bucket {
+        free_object* head;
+        unsigned count;
+    };
+    static __thread bucket _buckets[nr_buckets];
+    // Set by drain(), once the reactor is gone.
+    static __thread bool _drained;
+    static bucket& bucket_for(size_t size) {
+        return _buckets[(size - 1) / granularity];
+    }
 public:
+    static void* allocate(size_t size) {
+#ifndef DEBUG
+        if (size <= max_size) {
+            auto& b = bucket_for(size);
+            if (auto obj = b.head) {
+                b.head = obj->next;
+                --b.count;
+                return obj;
+            }
+            return ::operator new((size + granularity - 1) & ~(granularity - 1));
+        }
+#endif
+        return ::operator new(size);
+    }
+    static void free(void* ptr, size_t size) noexcept {
+#ifndef DEBUG
+        if (size <= max_size && !_drained && memory::is_local(ptr)) {
+            auto& b = bucket_for(size);
+            if (b.count < max_cached) {
+                auto obj = static_cast<free_object*>(ptr);
+                obj->next = b.head;
+                b.head = obj;
+                ++b.count;
+                return;
+            }
+        }
+#endif
+        ::operator delete(ptr);
+    }
+    // Frees the cached objects, and stops caching the ones freed later, so
+    // that nothing is left behind when the shard's thread exits.
+    static void drain() noexcept {
+        _drained = true;
+        for (auto& b : _buckets) {
+            while (auto obj = b.head) {
+                b.head = obj->next;
+                ::operator delete(obj);
+            }
+            b.count = 0;
+        }
+    }
+};
+
+// Base for classes whose objects are allocated from task_allocator.
+struct task_allocated {
+    static void* operator new(size_t size) {
+        return task_allocator::allocate(size);
+    }
+    static void operator delete(void* ptr, size_t size) noexcept {
+        task_allocator::free(ptr, size);
+    }
+};
+/// \endcond
+
+class task : public task_allocated {
+    scheduling_group _sg;
+public:
+    explicit task(scheduling_group sg = current_scheduling_group()) noexcept : _sg(sg) {}
     virtual ~task() noexcept {}
     virtual void run() noexcept = 0;
+    scheduling_group group() const { return _sg; }
 };
 
 void schedule(std::unique_ptr<task> t);
@@ -37,6 +125,8 @@ class lambda_task final : public task {
 public:
     lambda_task(const Func& func) : _func(func) {}
     lambda_task(Func&& func) : _func(std::move(func)) {}
+    lambda_task(scheduling_group sg, const Func& func) : task(sg), _func(func) {}
+    lambda_task(scheduling_group sg, Func&& func) : task(sg), _func(std::move(func)) {}
     virtual void run() noexcept override { _func(); }
 };
 
@@ -46,3 +136,10 @@ std::unique_ptr<task>
 make_task(Func&& func) {
     return std::make_unique<lambda_task<Func>>(std::forward<Func>(func));
 }
+
+template <typename Func>
+inline
+std::unique_ptr<task>
+make_task(scheduling_group sg, Func&& func) {
+    return std::make_unique<lambda_task<Func>>(sg, std::forward<Func>(func));
+}
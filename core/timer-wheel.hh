@@ -0,0 +1,355 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include <array>
+#include <limits>
+#include <cassert>
+#include <cstdint>
+#include <boost/intrusive/list.hpp>
+#include "bitops.hh"
+
+namespace bi = boost::intrusive;
+
+namespace seastar {
+
+/**
+ * A hierarchical timing wheel, with the same interface as timer_set.
+ *
+ * Timer timestamps are split into 6-bit digits. A timer is kept on the
+ * level of the most significant digit in which its timestamp differs
+ * from the last expiry time, in the slot given by its own value of that
+ * digit; each level keeps a bitmap of non-empty slots, and each slot the
+ * earliest timeout inserted into it since it was last empty. Inserting and
+ * removing a timer are O(1), and so is finding the next timeout after
+ * expire(). expire() moves whole slots to the expired list, and
+ * redistributes the timers of at most one slot (the one the expiry time
+ * falls into) to lower levels, so each timer is moved at most once per
+ * level over its lifetime.
+ *
+ * Removing the earliest timer of a slot leaves that slot's minimum early,
+ * as removing the earliest timer leaves timer_set's next timeout early:
+ * get_next_timeout() may then be too soon, never too late, and the
+ * expire() it leads to recomputes the minimum.
+ *
+ * Unlike a classic timing wheel there is no tick: the lowest level has a
+ * resolution of one clock unit, so timers expire exactly at their timeout.
+ *
+ * The template type "Timer" should have a method named
+ * get_timeout() which returns Timer::time_point which denotes
+ * timer's expiration.
+ */
+template<typename Timer, bi::list_member_hook<> Timer::*link>
+class timer_wheel {
+public:
+    using time_point = typename Timer::time_point;
+    using timer_list_t = bi::list<Timer, bi::member_hook<Timer, bi::list_member_hook<>, link>>;
+private:
+    using duration = typename Timer::duration;
+    using timestamp_t = typename Timer::duration::rep;
+    using utimestamp_t = std::make_unsigned_t<timestamp_t>;
+
+    static constexpr timestamp_t max_timestamp = std::numeric_limits<timestamp_t>::max();
+    static constexpr int timestamp_bits = std::numeric_limits<timestamp_t>::digits;
+    static constexpr int bits_per_level = 6;
+    static constexpr int slots_per_level = 1 << bits_per_level;
+    static constexpr int n_levels = (timestamp_bits + bits_per_level - 1) / bits_per_level;
+
+    struct level {
+        std::array<timer_list_t, slots_per_level> slots;
+        // Lower bound of the timeouts in each non-empty slot.
+        std::array<timestamp_t, slots_per_level> min;
+        uint64_t non_empty = 0;
+    };
+    std::array<level, n_levels> _levels;
+    // Active timers with timeout <= _last; they expire on the next expire().
+    timer_list_t _due;
+    timestamp_t _last;
+    timestamp_t _next;
+private:
+    static timestamp_t get_timestamp(time_point _time_point)
+    {
+        return _time_point.time_since_epoch().count();
+    }
+
+    static timestamp_t get_timestamp(Timer& timer)
+    {
+        return get_timestamp(timer.get_timeout());
+    }
+
+    // Level of a timestamp greater than _last: that of the most
+    // significant digit in which the two differ.
+    int get_level(timestamp_t timestamp) const
+    {
+        auto diff = utimestamp_t(timestamp) ^ utimestamp_t(_last);
+        return (std::numeric_limits<uint64_t>::digits - 1 - ::count_leading_zeros(uint64_t(diff))) / bits_per_level;
+    }
+
+    static int get_slot(timestamp_t timestamp, int level)
+    {
+        return (utimestamp_t(timestamp) >> (level * bits_per_level)) & (slots_per_level - 1);
+    }
+
+    timer_list_t& get_list(timestamp_t timestamp, int& lvl, int& slot)
+    {
+        lvl = get_level(timestamp);
+        slot = get_slot(timestamp, lvl);
+        return _levels[lvl].slots[slot];
+    }
+
+    // Files a timer with a timeout greater than _last.
+    void add(Timer& timer, timestamp_t timestamp)
+    {
+        int lvl, slot;
+        get_list(timestamp, lvl, slot).push_back(timer);
+        auto& l = _levels[lvl];
+        auto bit = uint64_t(1) << slot;
+        if (!(l.non_empty & bit) || timestamp < l.min[slot]) {
+            l.min[slot] = timestamp;
+        }
+        l.non_empty |= bit;
+    }
+
+    void take_slot(timer_list_t& to, int lvl, int slot)
+    {
+        to.splice(to.end(), _levels[lvl].slots[slot]);
+        _levels[lvl].non_empty &= ~(uint64_t(1) << slot);
+    }
+
+    void update_next()
+    {
+        _next = max_timestamp;
+        if (!_due.empty()) {
+            _next = _last;
+            return;
+        }
+        // The lowest non-empty slot of the lowest non-empty level holds the
+        // earliest timers.
+        for (auto& l : _levels) {
+            if (l.non_empty) {
+                _next = l.min[::count_trailing_zeros(l.non_empty)];
+                return;
+            }
+        }
+    }
+public:
+    timer_wheel()
+        : _last(0)
+        , _next(max_timestamp)
+    {
+    }
+
+    ~timer_wheel() {
+        auto cancel_all = [] (timer_list_t& list) {
+            while (!list.empty()) {
+                auto& timer = *list.begin();
+                timer.cancel();
+            }
+        };
+        cancel_all(_due);
+        for (auto&& l : _levels) {
+            for (auto&& list : l.slots) {
+                cancel_all(list);
+            }
+        }
+    }
+
+    /**
+     * Adds timer to the active set.
+     *
+     * The value returned by timer.get_timeout() is used as timer's expiry. The result
+     * of timer.get_timeout() must not change while the timer is in the active set.
+     *
+     * Preconditions:
+     *  - this timer must not be currently in the active set or in the expired set.
+     *
+     * Postconditions:
+     *  - this timer will be added to the active set until it is expired
+     *    by a call to expire() or removed by a call to remove().
+     *
+     * Returns true if and only if this timer's timeout is less than get_next_timeout().
+     * When this function returns true the caller should reschedule expire() to be
+     * called at timer.get_timeout() to ensure timers are expired in a timely manner.
+     */
+    bool insert(Timer& timer)
+    {
+        auto timestamp = get_timestamp(timer);
+        if (timestamp <= _last) {
+            _due.push_back(timer);
+        } else {
+            add(timer, timestamp);
+        }
+
+        if (timestamp < _next) {
+            _next = timestamp;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Removes timer from the active set.
+     *
+     * Preconditions:
+     *  - timer must be currently in the active set. Note: it must not be in
+     *    the expired set.
+     *
+     * Postconditions:
+     *  - timer is no longer in the active set.
+     *  - this object will no longer hold any references to this timer.
+     */
+    void remove(Timer& timer)
+    {
+        auto timestamp = get_timestamp(timer);
+        if (timestamp <= _last) {
+            _due.erase(_due.iterator_to(timer));
+            return;
+        }
+        int lvl, slot;
+        auto& list = get_list(timestamp, lvl, slot);
+        list.erase(list.iterator_to(timer));
+        if (list.empty()) {
+            _levels[lvl].non_empty &= ~(uint64_t(1) << slot);
+        }
+    }
+
+    /**
+     * Expires active timers.
+     *
+     * The time points passed to this function must be monotonically increasing.
+     * Use get_next_timeout() to query for the next time point.
+     *
+     * Preconditions:
+     *  - the time_point passed to this function must not be lesser than
+     *    the previous one passed to this function.
+     *
+     * Postconditons:
+     *  - all timers from the active set with Timer::get_timeout() <= now are moved
+     *    to the expired set.
+     */
+    timer_list_t expire(time_point now)
+    {
+        timer_list_t exp;
+        auto timestamp = get_timestamp(now);
+
+        if (timestamp < _last) {
+            abort();
+        }
+
+        exp.splice(exp.end(), _due);
+        if (timestamp == _last) {
+            update_next();
+            return exp;
+        }
+
+        // Levels above the top differing digit are unaffected. All timers
+        // below it are earlier than "now". On the top level itself, slots
+        // before the new digit have expired, and the slot of the new digit
+        // straddles "now" and must be redistributed.
+        auto top = get_level(timestamp);
+        for (int lvl = 0; lvl < top; ++lvl) {
+            for (auto& l = _levels[lvl]; l.non_empty; ) {
+                take_slot(exp, lvl, ::count_trailing_zeros(l.non_empty));
+            }
+        }
+        auto new_slot = get_slot(timestamp, top);
+        auto expired_mask = (uint64_t(1) << new_slot) - 1;
+        for (auto& l = _levels[top]; l.non_empty & expired_mask; ) {
+            take_slot(exp, top, ::count_trailing_zeros(l.non_empty & expired_mask));
+        }
+        timer_list_t straddling;
+        take_slot(straddling, top, new_slot);
+
+        _last = timestamp;
+
+        while (!straddling.empty()) {
+            auto& timer = *straddling.begin();
+            straddling.pop_front();
+            if (get_timestamp(timer) <= timestamp) {
+                exp.push_back(timer);
+            } else {
+                add(timer, get_timestamp(timer));
+            }
+        }
+
+        update_next();
+        return exp;
+    }
+
+    /**
+     * Returns a time point at which expire() should be called
+     * in order to ensure timers are expired in a timely manner.
+     *
+     * Returned values are monotonically increasing.
+     */
+    time_point get_next_timeout() const
+    {
+        return time_point(duration(std::max(_last, _next)));
+    }
+
+    /**
+     * Clears both active and expired timer sets.
+     */
+    void clear()
+    {
+        _due.clear();
+        for (auto&& l : _levels) {
+            for (auto&& list : l.slots) {
+                list.clear();
+            }
+            l.non_empty = 0;
+        }
+    }
+
+    size_t size() const
+    {
+        size_t res = _due.size();
+        for (auto&& l : _levels) {
+            for (auto non_empty = l.non_empty; non_empty; non_empty &= non_empty - 1) {
+                res += l.slots[::count_trailing_zeros(non_empty)].size();
+            }
+        }
+        return res;
+    }
+
+    /**
+     * Returns true if and only if there are no timers in the active set.
+     */
+    bool empty() const
+    {
+        if (!_due.empty()) {
+            return false;
+        }
+        for (auto&& l : _levels) {
+            if (l.non_empty) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    time_point now() {
+        return Timer::clock::now();
+    }
+};
+
+}
@@ -26,6 +26,7 @@
 #include <atomic>
 #include "future.hh"
 #include "timer-set.hh"
+#include "timer-wheel.hh"
 
 using steady_clock_type = std::chrono::steady_clock;
 
@@ -67,5 +68,6 @@ class timer {
     time_point get_timeout();
     friend class reactor;
     friend class seastar::timer_set<timer, &timer::_link>;
+    friend class seastar::timer_wheel<timer, &timer::_link>;
 };
 
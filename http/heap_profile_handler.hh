@@ -0,0 +1,70 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#ifndef HTTP_HEAP_PROFILE_HANDLER_HH_
+#define HTTP_HEAP_PROFILE_HANDLER_HH_
+
+#include "handlers.hh"
+#include "exception.hh"
+#include "core/memory.hh"
+#include "core/reactor.hh"
+
+namespace httpd {
+
+/**
+ * Serves the heap profile of a shard (see memory::heap_profile()), in
+ * a format pprof can read directly:
+ *
+ *   pprof <binary> http://host:port/<path>?shard=3
+ *
+ * The shard defaults to the one handling the request. Heap profiling
+ * must be enabled (--heap-profiling-interval) for the profile to contain
+ * any samples.
+ */
+class heap_profile_handler : public handler_base {
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        auto shard = engine().cpu_id();
+        auto param = req->get_query_param("shard");
+        if (!param.empty()) {
+            try {
+                shard = std::stoul(param);
+            } catch (...) {
+                shard = smp::count;
+            }
+            if (shard >= smp::count) {
+                throw bad_param_exception("shard must be a number less than " + std::to_string(smp::count));
+            }
+        }
+        return smp::submit_to(shard, [] {
+            return sstring(memory::heap_profile());
+        }).then([rep = std::move(rep)] (sstring profile) mutable {
+            rep->_content = std::move(profile);
+            rep->done("txt");
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        });
+    }
+};
+
+}
+
+#endif /* HTTP_HEAP_PROFILE_HANDLER_HH_ */
@@ -29,6 +29,7 @@
 #include <experimental/string_view>
 #include "core/app-template.hh"
 #include "core/circular_buffer.hh"
+#include "core/cord.hh"
 #include "core/distributed.hh"
 #include "core/queue.hh"
 #include "core/future-util.hh"
@@ -216,35 +217,24 @@ class http_server {
             _resp->_headers["Date"] = _server._date;
             _resp->_headers["Content-Length"] = to_sstring(
                     _resp->_content.size());
-            return _write_buf.write(_resp->_response_line.begin(),
-                    _resp->_response_line.size()).then([this] {
-                return write_reply_headers(_resp->_headers.begin());
-            }).then([this] {
-                return _write_buf.write("\r\n", 2);
-            }).then([this] {
-                return write_body();
-            }).then([this] {
+            // The status line and headers are copied into a few chunks, and
+            // the body is sent without copying, all in a single write.
+            cord response;
+            response.append(std::move(_resp->_response_line));
+            for (auto& h : _resp->_headers) {
+                response.append(h.first.begin(), h.first.size());
+                response.append(": ", 2);
+                response.append(h.second.begin(), h.second.size());
+                response.append("\r\n", 2);
+            }
+            response.append("\r\n", 2);
+            response.append(std::move(_resp->_content));
+            return _write_buf.write(std::move(response)).then([this] {
                 return _write_buf.flush();
             }).then([this] {
                 _resp.reset();
             });
         }
-        future<> write_reply_headers(
-                std::unordered_map<sstring, sstring>::iterator hi) {
-            if (hi == _resp->_headers.end()) {
-                return make_ready_future<>();
-            }
-            return _write_buf.write(hi->first.begin(), hi->first.size()).then(
-                    [this] {
-                        return _write_buf.write(": ", 2);
-                    }).then([hi, this] {
-                return _write_buf.write(hi->second.begin(), hi->second.size());
-            }).then([this] {
-                return _write_buf.write("\r\n", 2);
-            }).then([hi, this] () mutable {
-                return write_reply_headers(++hi);
-            });
-        }
 
         static short hex_to_byte(char c) {
             if (c >='a' && c <= 'z') {
@@ -367,10 +357,6 @@ class http_server {
                 return make_ready_future<bool>(should_close);
             });
         }
-        future<> write_body() {
-            return _write_buf.write(_resp->_content.begin(),
-                    _resp->_content.size());
-        }
     };
     uint64_t total_connections() const {
         return _total_connections;
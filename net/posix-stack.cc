@@ -23,6 +23,8 @@
 #include "net.hh"
 #include "packet.hh"
 #include "api.hh"
+#include "core/bitops.hh"
+#include "core/scollectd.hh"
 #include <netinet/tcp.h>
 #include <netinet/sctp.h>
 
@@ -275,16 +277,181 @@ data_source posix_data_source(pollable_fd& fd) {
     return data_source(std::make_unique<posix_data_source_impl>(fd));
 }
 
+constexpr size_t receive_buffer_pool::min_size;
+constexpr size_t receive_buffer_pool::max_size;
+
+namespace {
+
+constexpr unsigned nr_receive_buffer_classes =
+        receive_buffer_pool::max_size_shift - receive_buffer_pool::min_size_shift + 1;
+
+// A pooled block is laid out as a header, the deleter::impl that owns the
+// buffer, and the buffer itself.  The header lives outside the impl object
+// so that operator delete can still read it after the impl is destroyed.
+struct receive_buffer_free_lists;
+
+struct receive_buffer_header {
+    receive_buffer_header* next;
+    // Pool of the shard that allocated the block
+    receive_buffer_free_lists* owner;
+    unsigned size_class;
+};
+
+constexpr size_t receive_buffer_header_size = 32;
+static_assert(sizeof(receive_buffer_header) <= receive_buffer_header_size, "header too large");
+
+// Memory held by cached blocks.  It is accounted to a budget, to report it,
+// and given back before other memory when memory runs low, since cached
+// blocks only save a malloc().
+struct receive_buffer_cache_memory {
+    memory::budget budget;
+    memory::reclaimer reclaimer;
+    scollectd::registrations metrics;
+    receive_buffer_cache_memory();
+};
+
+struct receive_buffer_free_lists {
+    receive_buffer_header* head[nr_receive_buffer_classes];
+    size_t count[nr_receive_buffer_classes];
+    bool drained;
+    // Created by the first get(), destroyed by drain()
+    receive_buffer_cache_memory* memory;
+};
+
+// Trivially destructible, so that buffers dropped late in a thread's life
+// never see it destroyed; receive_buffer_pool::drain() frees the cached
+// blocks when the reactor exits.
+thread_local receive_buffer_free_lists receive_buffers;
+
+size_t receive_buffer_class_size(unsigned size_class) {
+    return receive_buffer_pool::min_size << size_class;
+}
+
+// Frees cached blocks, largest first, until at least \c bytes are freed.
+size_t free_cached_receive_buffers(size_t bytes) {
+    size_t freed = 0;
+    for (unsigned i = nr_receive_buffer_classes; i-- > 0 && freed < bytes; ) {
+        while (auto h = receive_buffers.head[i]) {
+            if (freed >= bytes) {
+                break;
+            }
+            receive_buffers.head[i] = h->next;
+            --receive_buffers.count[i];
+            ::free(h);
+            freed += receive_buffer_class_size(i);
+        }
+    }
+    if (receive_buffers.memory) {
+        receive_buffers.memory->budget.release(freed);
+    }
+    return freed;
+}
+
+receive_buffer_cache_memory::receive_buffer_cache_memory()
+    : budget("receive_buffers", nr_receive_buffer_classes * receive_buffer_pool::max_cached_bytes_per_class)
+    , reclaimer([] (memory::reclaimer::request r) {
+        return free_cached_receive_buffers(r.bytes_to_reclaim)
+                ? memory::reclaiming_result::reclaimed_something
+                : memory::reclaiming_result::reclaimed_nothing;
+    }, memory::reclaimer_scope::sync, memory::reclaimer::default_priority - 1, &budget)
+    , metrics(scollectd::add_budget_metrics(budget)) {
+}
+
+unsigned receive_buffer_class_of(size_t size) {
+    size = std::max(size, receive_buffer_pool::min_size);
+    return std::numeric_limits<size_t>::digits - count_leading_zeros(size - 1) - receive_buffer_pool::min_size_shift;
+}
+
+struct pooled_receive_buffer final : deleter::impl {
+    pooled_receive_buffer() : impl(deleter()) {}
+    char* data() {
+        return reinterpret_cast<char*>(this + 1);
+    }
+    static void operator delete(void* p) {
+        auto h = reinterpret_cast<receive_buffer_header*>(static_cast<char*>(p) - receive_buffer_header_size);
+        auto size_class = h->size_class;
+        auto& count = receive_buffers.count[size_class];
+        if (h->owner != &receive_buffers || receive_buffers.drained
+                || (count + 1) * receive_buffer_class_size(size_class) > receive_buffer_pool::max_cached_bytes_per_class) {
+            ::free(h);
+            return;
+        }
+        h->next = receive_buffers.head[size_class];
+        receive_buffers.head[size_class] = h;
+        ++count;
+        receive_buffers.memory->budget.consume(receive_buffer_class_size(size_class));
+    }
+};
+
+}
+
+temporary_buffer<char>
+receive_buffer_pool::get(size_t size) {
+    if (size > max_size) {
+        return temporary_buffer<char>(size);
+    }
+    if (!receive_buffers.memory && !receive_buffers.drained) {
+        receive_buffers.memory = new receive_buffer_cache_memory();
+    }
+    auto size_class = receive_buffer_class_of(size);
+    auto class_size = receive_buffer_class_size(size_class);
+    auto h = receive_buffers.head[size_class];
+    if (h) {
+        receive_buffers.head[size_class] = h->next;
+        --receive_buffers.count[size_class];
+        receive_buffers.memory->budget.release(class_size);
+    } else {
+        h = static_cast<receive_buffer_header*>(::malloc(receive_buffer_header_size
+                + sizeof(pooled_receive_buffer) + class_size));
+        if (!h) {
+            throw std::bad_alloc();
+        }
+    }
+    h->next = nullptr;
+    h->owner = &receive_buffers;
+    h->size_class = size_class;
+    auto b = ::new (reinterpret_cast<char*>(h) + receive_buffer_header_size) pooled_receive_buffer();
+    return temporary_buffer<char>(b->data(), class_size, deleter(b));
+}
+
+size_t
+receive_buffer_pool::cached_buffers(size_t size) {
+    return size > max_size ? 0 : receive_buffers.count[receive_buffer_class_of(size)];
+}
+
+void
+receive_buffer_pool::drain() {
+    receive_buffers.drained = true;
+    free_cached_receive_buffers(std::numeric_limits<size_t>::max());
+    delete receive_buffers.memory;
+    receive_buffers.memory = nullptr;
+}
+
 future<temporary_buffer<char>>
 posix_data_source_impl::get() {
-    return _fd.read_some(_buf.get_write(), _buf_size).then([this] (size_t size) {
-        _buf.trim(size);
-        auto ret = std::move(_buf);
-        _buf = temporary_buffer<char>(_buf_size);
-        return make_ready_future<temporary_buffer<char>>(std::move(ret));
+    auto buf = receive_buffer_pool::get(_buf_size);
+    auto p = buf.get_write();
+    auto size = buf.size();
+    return _fd.read_some(p, size).then([this, buf = std::move(buf)] (size_t size) mutable {
+        adapt_buffer_size(size, buf.size());
+        buf.trim(size);
+        return make_ready_future<temporary_buffer<char>>(std::move(buf));
     });
 }
 
+// Reads that fill the buffer double the next read, up to the largest pooled
+// size; otherwise the read size follows twice the recent average, so that
+// connections carrying small messages do not pin large buffers.
+void
+posix_data_source_impl::adapt_buffer_size(size_t bytes_read, size_t capacity) {
+    _avg_read_size = (_avg_read_size * 3 + bytes_read) / 4;
+    if (bytes_read == capacity) {
+        _buf_size = std::min(capacity * 2, receive_buffer_pool::max_size);
+    } else {
+        _buf_size = std::max(std::min(_avg_read_size * 2, capacity), receive_buffer_pool::min_size);
+    }
+}
+
 data_sink posix_data_sink(pollable_fd& fd) {
     return data_sink(std::make_unique<posix_data_sink_impl>(fd));
 }
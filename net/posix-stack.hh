@@ -33,14 +33,41 @@ using namespace seastar;
 data_source posix_data_source(pollable_fd& fd);
 data_sink posix_data_sink(pollable_fd& fd);
 
+// Per-shard cache of receive buffers in power-of-two size classes, so that
+// reading from a socket does not cost a malloc()/free() pair per read.  A
+// buffer goes back to the pool of the shard that allocated it, through its
+// deleter, when dropped there; buffers dropped on another shard are freed.
+// Each size class caches at most max_cached_bytes_per_class.
+class receive_buffer_pool {
+public:
+    static constexpr unsigned min_size_shift = 10;
+    static constexpr unsigned max_size_shift = 17;
+    static constexpr size_t min_size = size_t(1) << min_size_shift;
+    static constexpr size_t max_size = size_t(1) << max_size_shift;
+    static constexpr size_t max_cached_bytes_per_class = 1 << 20;
+    // Returns a buffer of at least the requested size: the whole size class
+    // it is taken from, or exactly the requested size above max_size.
+    static temporary_buffer<char> get(size_t size);
+    // Number of buffers cached for the size class serving \c size.
+    static size_t cached_buffers(size_t size);
+    // Frees the cached buffers, and stops caching the ones dropped later;
+    // called when the shard's reactor exits.
+    static void drain();
+};
+
 class posix_data_source_impl final : public data_source_impl {
     pollable_fd& _fd;
-    temporary_buffer<char> _buf;
     size_t _buf_size;
+    size_t _avg_read_size;
 public:
     explicit posix_data_source_impl(pollable_fd& fd, size_t buf_size = 8192)
-        : _fd(fd), _buf(buf_size), _buf_size(buf_size) {}
+        : _fd(fd), _buf_size(buf_size), _avg_read_size(buf_size / 2) {}
     virtual future<temporary_buffer<char>> get() override;
+    // Size of the next read.
+    size_t buffer_size() const {
+        return _buf_size;
+    }
+    void adapt_buffer_size(size_t bytes_read, size_t capacity);
 };
 
 class posix_data_sink_impl : public data_sink_impl {
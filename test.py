@@ -26,6 +26,7 @@ import re
 boost_tests = [
     'alloc_test',
     'futures_test',
+    'coroutines_test',
     'thread_test',
     'memcached/test_ascii_parser',
     'sstring_test',
@@ -37,9 +38,13 @@ boost_tests = [
     'shared_ptr_test',
     'fileiotest',
     'packet_test',
+    'cord_test',
     'tls_test',
     'rpc_test',
     'connect_test',
+    'receive_buffer_test',
+    'io_queue_test',
+    'timer_wheel_test',
 ]
 
 other_tests = [
@@ -52,6 +57,12 @@ other_tests = [
     'fair_queue_test',
 ]
 
+# Also run under the io_uring reactor backend, where it is available.
+uring_tests = [
+    'connect_test',
+    'fileiotest',
+]
+
 last_len = 0
 
 def print_status_short(msg):
@@ -62,6 +73,16 @@ def print_status_short(msg):
 
 print_status_verbose = print
 
+def have_uring_backend(prefix):
+    # The help of any seastar application lists the usable reactor backends.
+    try:
+        out = subprocess.check_output([os.path.join(prefix, 'timertest'), '--help'], stderr=subprocess.STDOUT)
+    except subprocess.CalledProcessError as e:
+        out = e.output
+    except OSError:
+        return False
+    return b'io_uring' in out
+
 class Alarm(Exception):
     pass
 def alarm_handler(signum, frame):
@@ -91,8 +112,16 @@ if __name__ == "__main__":
             test_to_run.append((os.path.join(prefix, test),'other'))
         for test in boost_tests:
             test_to_run.append((os.path.join(prefix, test),'boost'))
+        if have_uring_backend(prefix):
+            for test in uring_tests:
+                test_to_run.append((os.path.join(prefix, test) + ' -- --reactor-backend=io_uring','boost'))
         test_to_run.append(('tests/memcached/test.py --mode ' + mode + (' --fast' if args.fast else ''),'other'))
         test_to_run.append((os.path.join(prefix, 'distributed_test') + ' -c 2','other'))
+        # Enough shards for broadcast trees of fanout 2 to be more than one level deep.
+        tree_shards = min(os.cpu_count() or 1, 7)
+        if tree_shards > 3:
+            test_to_run.append((os.path.join(prefix, 'distributed_test') + ' -c %d' % tree_shards,'other'))
+        test_to_run.append((os.path.join(prefix, 'stall_detector_test') + ' -- --stall-report-threshold=5','boost'))
 
 
         allocator_test_path = os.path.join(prefix, 'allocator_test')
@@ -123,8 +152,11 @@ if __name__ == "__main__":
            mode = 'release'
            if test[0].startswith(os.path.join('build','debug')):
               mode = 'debug'
-           xmlout = args.jenkins+"."+mode+"."+os.path.basename(test[0])+".boost.xml"
-           path = path + " --output_format=XML --log_level=all --report_level=no --log_sink=" + xmlout
+           # boost options go before the ones for seastar, after "--"
+           binary, sep, app_args = test[0].partition(' -- ')
+           variant = '.' + re.sub(r'\W+', '_', app_args.lstrip('-')) if app_args else ''
+           xmlout = args.jenkins+"."+mode+"."+os.path.basename(binary)+variant+".boost.xml"
+           path = binary + " --output_format=XML --log_level=all --report_level=no --log_sink=" + xmlout + sep + app_args
            print(path)
         if os.path.isfile('tmp.out'):
            os.remove('tmp.out')
@@ -42,6 +42,198 @@ void test_aligned_allocator() {
     }
 }
 
+void test_heap_profile() {
+#ifndef DEFAULT_ALLOCATOR
+    memory::set_heap_profiling_interval(4096);
+    {
+        std::vector<std::unique_ptr<char[]>> v;
+        for (unsigned i = 0; i < 1000; ++i) {
+            v.emplace_back(new char[1000]);
+        }
+        auto profile = memory::heap_profile();
+        assert(profile.find("@ heap_v2/4096\n") != std::string::npos);
+        assert(profile.find("heap profile: 0: 0 ") != 0);
+        assert(profile.find("MAPPED_LIBRARIES:") != std::string::npos);
+    }
+    // everything sampled has been freed
+    memory::set_heap_profiling_interval(0);
+    auto profile = memory::heap_profile();
+    assert(profile.find("heap profile: 0: 0 [0: 0] @ heap_v2/0\n") == 0);
+#endif
+}
+
+void test_size_class_stats() {
+#ifndef DEFAULT_ALLOCATOR
+    unsigned idx = 0;
+    while (memory::get_size_class_stats(idx).object_size < 1000) {
+        ++idx;
+    }
+    auto before = memory::get_size_class_stats(idx);
+    auto large_before = memory::large_allocations(4);
+    {
+        std::vector<std::unique_ptr<char[]>> v;
+        v.reserve(100);
+        for (unsigned i = 0; i < 100; ++i) {
+            v.emplace_back(new char[1000]);
+        }
+        std::unique_ptr<char[]> large(new char[memory::large_allocation_bucket_size(4) + 1]);
+        auto during = memory::get_size_class_stats(idx);
+        assert(during.allocs - before.allocs == 100);
+        assert(during.objects_in_use() - before.objects_in_use() == 100);
+        assert(during.spans >= 1);
+        assert(during.fragmentation() >= 0 && during.fragmentation() < 1);
+        assert(memory::large_allocations(4) - large_before == 1);
+    }
+    auto after = memory::get_size_class_stats(idx);
+    assert(after.frees - before.frees == 100);
+    assert(after.objects_in_use() == before.objects_in_use());
+#endif
+}
+
+void test_large_allocation_warning() {
+#ifndef DEFAULT_ALLOCATOR
+    memory::set_large_allocation_warning_threshold(100000);
+    assert(memory::large_allocation_warning_threshold() == 100000);
+    std::vector<std::unique_ptr<char[]>> v;
+    v.reserve(3);
+    auto before = memory::stats().large_allocations_over_threshold();
+    v.emplace_back(new char[100000]);
+    assert(memory::stats().large_allocations_over_threshold() == before);
+    v.emplace_back(new char[200000]);
+    assert(memory::stats().large_allocations_over_threshold() == before + 1);
+    memory::set_large_allocation_warning_threshold(0);
+    assert(memory::large_allocation_warning_threshold() == 0);
+    v.emplace_back(new char[200000]);
+    assert(memory::stats().large_allocations_over_threshold() == before + 1);
+#endif
+}
+
+void test_budget() {
+    memory::budget b("test", 1000);
+    assert(b.try_consume(600));
+    assert(!b.try_consume(600));
+    assert(b.used() == 600 && b.available() == 400);
+    b.consume(600);
+    assert(b.over_limit() && b.available() == 0);
+    b.release(700);
+    assert(!b.over_limit() && b.used() == 500);
+    b.set_limit(400);
+    assert(b.over_limit());
+    b.release(1000);
+    assert(b.used() == 0);
+}
+
+#ifndef DEFAULT_ALLOCATOR
+// Holds a few megabytes, and frees them a megabyte at a time when asked.
+// Records which reclaimers were asked, and for how much, in order.
+struct test_reclaimer {
+    static constexpr size_t chunk_size = 1 << 20;
+    using log_type = std::vector<std::pair<const char*, size_t>>;
+    const char* name;
+    log_type& log;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    memory::reclaimer reclaimer;
+    test_reclaimer(const char* name, log_type& log, unsigned nr_chunks, int priority, const memory::budget* b = nullptr)
+        : name(name), log(log)
+        , reclaimer([this] (memory::reclaimer::request r) { return reclaim(r.bytes_to_reclaim); },
+                memory::reclaimer_scope::sync, priority, b) {
+        for (unsigned i = 0; i < nr_chunks; ++i) {
+            chunks.emplace_back(new char[chunk_size]);
+        }
+    }
+    memory::reclaiming_result reclaim(size_t bytes) {
+        log.emplace_back(name, bytes);
+        size_t freed = 0;
+        while (freed < bytes && !chunks.empty()) {
+            chunks.pop_back();
+            freed += chunk_size;
+        }
+        return freed ? memory::reclaiming_result::reclaimed_something : memory::reclaiming_result::reclaimed_nothing;
+    }
+};
+#endif
+
+void test_reclaimer_order() {
+#ifndef DEFAULT_ALLOCATOR
+    constexpr size_t mb = test_reclaimer::chunk_size;
+    test_reclaimer::log_type log;
+    log.reserve(100);
+    memory::budget budget("test", mb);
+    test_reclaimer a("a", log, 4, 1);
+    test_reclaimer b("b", log, 4, 0);
+    test_reclaimer c("c", log, 4, 0);
+    test_reclaimer d("d", log, 4, 2, &budget);
+    using entry = test_reclaimer::log_type::value_type;
+
+    // The lowest priority goes first, and nobody else is asked once the
+    // target is met.
+    memory::reclaim(2 * mb);
+    assert((log == test_reclaimer::log_type{ entry("b", 2 * mb) }));
+    log.clear();
+
+    // Reclaimers of a priority are asked in turn for what is still missing.
+    memory::reclaim(6 * mb);
+    assert((log == test_reclaimer::log_type{ entry("b", 6 * mb), entry("c", 4 * mb) }));
+    log.clear();
+
+    // A higher priority is only asked once the lower ones have nothing left.
+    memory::reclaim(3 * mb);
+    assert((log == test_reclaimer::log_type{ entry("b", 3 * mb), entry("c", 3 * mb), entry("a", 3 * mb) }));
+    assert(a.chunks.size() == 1 && b.chunks.empty() && c.chunks.empty() && d.chunks.size() == 4);
+    log.clear();
+
+    // Over its budget, a reclaimer goes first, whatever its priority.
+    budget.consume(2 * mb);
+    memory::reclaim(mb);
+    assert((log == test_reclaimer::log_type{ entry("d", mb) }));
+    assert(a.chunks.size() == 1 && d.chunks.size() == 3);
+    log.clear();
+
+    // Back within it, it waits for its turn again.
+    budget.release(2 * mb);
+    memory::reclaim(mb);
+    assert((log == test_reclaimer::log_type{ entry("b", mb), entry("c", mb), entry("a", mb) }));
+    assert(a.chunks.empty() && d.chunks.size() == 3);
+#endif
+}
+
+void test_free_memory_release() {
+#ifndef DEFAULT_ALLOCATOR
+    constexpr size_t size = 64 << 20;
+    auto before = memory::stats();
+    auto p = std::unique_ptr<char[]>(new char[size]);
+    std::fill_n(p.get(), size, 1);
+    p.reset();
+
+    // Nothing is released until a threshold is set.
+    assert(!memory::release_free_memory(size));
+    memory::set_free_memory_release_threshold(size / 2);
+    // At most max_bytes per call.
+    assert(memory::release_free_memory(memory::huge_page_size));
+    auto one = memory::stats();
+    assert(one.total_released_memory() == before.total_released_memory() + memory::huge_page_size);
+    assert(one.released_memory() == before.released_memory() + memory::huge_page_size);
+    while (memory::release_free_memory(size)) {
+    }
+    auto released = memory::stats();
+    // The freed span is released too, so at least its whole hugepages are.
+    assert(released.total_released_memory() >= before.total_released_memory() + size - memory::huge_page_size);
+    assert(released.released_memory() <= released.free_memory());
+    assert(released.total_refaulted_memory() == before.total_refaulted_memory());
+
+    // Any span that fits is now released, and reusing it faults it back in.
+    p.reset(new char[size]);
+    std::fill_n(p.get(), size, 2);
+    assert(std::count(p.get(), p.get() + size, 2) == std::ptrdiff_t(size));
+    auto reused = memory::stats();
+    assert(reused.total_refaulted_memory() >= released.total_refaulted_memory() + size - memory::huge_page_size);
+    assert(reused.released_memory() < released.released_memory());
+    p.reset();
+    memory::set_free_memory_release_threshold(0);
+    assert(!memory::release_free_memory(size));
+#endif
+}
+
 struct allocation {
     size_t n;
     std::unique_ptr<char[]> data;
@@ -82,6 +274,12 @@ int main(int ac, char** av) {
     bpo::variables_map vm;
     bpo::store(bpo::parse_command_line(ac, av, opts), vm);
     bpo::notify(vm);
+    test_heap_profile();
+    test_size_class_stats();
+    test_large_allocation_warning();
+    test_budget();
+    test_reclaimer_order();
+    test_free_memory_release();
     test_aligned_allocator<1>();
     test_aligned_allocator<4>();
     test_aligned_allocator<80>();
@@ -0,0 +1,125 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/cord.hh"
+
+BOOST_AUTO_TEST_CASE(test_small_copies_share_a_fragment) {
+    cord c;
+    c.append("abc", 3);
+    c.append("def");
+    c.append(to_sstring(42));
+    BOOST_REQUIRE_EQUAL(c.fragment_count(), 1);
+    BOOST_REQUIRE_EQUAL(c.size(), 8);
+    BOOST_REQUIRE_EQUAL(c.linearize(), sstring("abcdef42"));
+}
+
+BOOST_AUTO_TEST_CASE(test_buffers_are_not_copied) {
+    temporary_buffer<char> body(1000);
+    std::fill_n(body.get_write(), body.size(), 'x');
+    auto data = body.get();
+    cord c;
+    c.append("head", 4);
+    c.append(std::move(body));
+    c.append("tail", 4);
+    c.prepend(temporary_buffer<char>("first", 5));
+    BOOST_REQUIRE_EQUAL(c.fragment_count(), 4);
+    BOOST_REQUIRE_EQUAL(c.size(), 1013);
+    auto it = c.begin();
+    BOOST_REQUIRE_EQUAL(sstring(it->get(), it->size()), sstring("first"));
+    ++it;
+    BOOST_REQUIRE_EQUAL(sstring(it->get(), it->size()), sstring("head"));
+    ++it;
+    BOOST_REQUIRE(it->get() == data);
+    ++it;
+    BOOST_REQUIRE_EQUAL(sstring(it->get(), it->size()), sstring("tail"));
+}
+
+BOOST_AUTO_TEST_CASE(test_large_strings_are_moved) {
+    sstring s(1000, 'y');
+    auto data = s.begin();
+    cord c;
+    c.append(std::move(s));
+    BOOST_REQUIRE_EQUAL(c.fragment_count(), 1);
+    BOOST_REQUIRE(c.begin()->get() == data);
+}
+
+BOOST_AUTO_TEST_CASE(test_chunk_overflow) {
+    cord c;
+    sstring expected;
+    for (auto i = 0; i < 1000; ++i) {
+        auto s = to_sstring(i) + ",";
+        c.append(s.begin(), s.size());
+        expected += s;
+    }
+    BOOST_REQUIRE_EQUAL(c.size(), expected.size());
+    BOOST_REQUIRE_EQUAL(c.linearize(), expected);
+    BOOST_REQUIRE(c.fragment_count() <= expected.size() / (cord::chunk_size - cord::max_copy_size) + 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_release_to_packet) {
+    cord c;
+    c.append_static("static ");
+    c.append("copied ", 7);
+    c.append(sstring(200, 'z'));
+    auto size = c.size();
+    auto frags = c.fragment_count();
+    auto p = std::move(c).release();
+    BOOST_REQUIRE(c.empty());
+    BOOST_REQUIRE_EQUAL(p.len(), size);
+    BOOST_REQUIRE_EQUAL(p.nr_frags(), frags);
+    BOOST_REQUIRE_EQUAL(sstring(p.frag(0).base, p.frag(0).size), sstring("static "));
+}
+
+BOOST_AUTO_TEST_CASE(test_release_into_scattered_message) {
+    cord c;
+    c.append("abc", 3);
+    c.append(sstring(200, 'z'));
+    scattered_message<char> msg;
+    msg.append_static("head ");
+    std::move(c).release_into(msg);
+    BOOST_REQUIRE_EQUAL(msg.size(), 208);
+}
+
+BOOST_AUTO_TEST_CASE(test_share) {
+    cord c;
+    c.append("abc", 3);
+    c.append(sstring(200, 'z'));
+    auto shared = c.share();
+    BOOST_REQUIRE_EQUAL(shared.linearize(), c.linearize());
+    BOOST_REQUIRE(shared.begin()->get() == c.begin()->get());
+}
+
+BOOST_AUTO_TEST_CASE(test_move_assignment) {
+    cord a;
+    a.append("abc", 3);
+    a.append(temporary_buffer<char>(1000));
+    cord b;
+    b.append("old", 3);
+    b = std::move(a);
+    BOOST_REQUIRE_EQUAL(b.size(), 1003);
+    BOOST_REQUIRE_EQUAL(b.fragment_count(), 2);
+    b.append("def", 3);
+    BOOST_REQUIRE_EQUAL(b.fragment_count(), 3);
+}
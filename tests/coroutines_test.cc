@@ -0,0 +1,93 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/future-util.hh"
+#include "core/sleep.hh"
+
+using namespace std::chrono_literals;
+
+#ifndef SEASTAR_COROUTINES_ENABLED
+
+SEASTAR_TEST_CASE(test_coroutines_not_compiled_in) {
+    return make_ready_future<>();
+}
+
+#else
+
+#include "core/coroutine.hh"
+
+namespace {
+
+class expected_exception : public std::runtime_error {
+public:
+    expected_exception() : runtime_error("expected") {}
+};
+
+future<int> ready_coroutine() {
+    co_return 42;
+}
+
+future<int> suspending_coroutine() {
+    co_await sleep(1ms);
+    co_return 43;
+}
+
+future<int, sstring> tuple_coroutine() {
+    auto x = co_await suspending_coroutine();
+    co_return std::make_tuple(x, sstring("foo"));
+}
+
+future<> throwing_coroutine() {
+    co_await later();
+    throw expected_exception();
+}
+
+}
+
+SEASTAR_TEST_CASE(test_co_return) {
+    auto f = ready_coroutine();
+    // nothing suspended, so the result is available immediately
+    BOOST_REQUIRE(f.available());
+    BOOST_REQUIRE_EQUAL(f.get0(), 42);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_co_await) {
+    BOOST_REQUIRE_EQUAL(co_await suspending_coroutine(), 43);
+    auto t = co_await tuple_coroutine();
+    BOOST_REQUIRE_EQUAL(std::get<0>(t), 43);
+    BOOST_REQUIRE_EQUAL(std::get<1>(t), "foo");
+}
+
+SEASTAR_TEST_CASE(test_co_await_exception) {
+    try {
+        co_await throwing_coroutine();
+        BOOST_FAIL("should have thrown");
+    } catch (expected_exception&) {
+    }
+    auto f = throwing_coroutine();
+    co_await later();
+    BOOST_REQUIRE(f.failed());
+    f.ignore_ready_future();
+}
+
+#endif
@@ -120,6 +120,79 @@ future<> test_map_reduce() {
     });
 }
 
+future<> test_map_reduce_tree() {
+    return do_with_distributed<X>([] (distributed<X>& x) {
+        return x.start().then([&x] {
+            return x.map_reduce0(seastar::broadcast_tree(2),
+                                 std::mem_fn(&X::cpu_id_squared),
+                                 0,
+                                 std::plus<int>()).then([] (int result) {
+                int n = smp::count - 1;
+                if (result != (n * (n + 1) * (2*n + 1)) / 6) {
+                    throw std::runtime_error("tree map_reduce failed");
+                }
+            });
+        });
+    });
+}
+
+struct Z {
+    unsigned calls = 0;
+    future<> stop() { return make_ready_future<>(); }
+};
+
+future<> test_invoke_on_all_tree() {
+    return do_with_distributed<Z>([] (distributed<Z>& z) {
+        return z.start().then([&z] {
+            // Start from the last shard to exercise wrap-around.
+            return smp::submit_to(smp::count - 1, [&z] {
+                return z.invoke_on_all(seastar::broadcast_tree(2), [] (Z& z) {
+                    ++z.calls;
+                });
+            });
+        }).then([&z] {
+            return z.map_reduce0([] (Z& z) { return z.calls; }, std::vector<unsigned>(), [] (std::vector<unsigned> v, unsigned calls) {
+                v.push_back(calls);
+                return v;
+            });
+        }).then([] (std::vector<unsigned> calls) {
+            if (calls != std::vector<unsigned>(smp::count, 1)) {
+                throw std::runtime_error("tree invoke_on_all must call every shard exactly once");
+            }
+        });
+    });
+}
+
+// The futures returned by func refer to func's own captures, which must
+// stay alive until they resolve.
+future<> test_tree_keeps_func_alive() {
+    return do_with_distributed<Z>([] (distributed<Z>& z) {
+        return z.start().then([&z] {
+            return z.invoke_on_all(seastar::broadcast_tree(2), [msg = sstring("hello")] (Z& z) {
+                return sleep(std::chrono::milliseconds(10)).then([&z, &msg] {
+                    if (msg != "hello") {
+                        throw std::runtime_error("tree invoke_on_all destroyed func too early");
+                    }
+                    ++z.calls;
+                });
+            });
+        }).then([&z] {
+            return z.map_reduce0(seastar::broadcast_tree(2), [msg = sstring("hello")] (Z& z) {
+                return sleep(std::chrono::milliseconds(10)).then([&z, &msg] {
+                    if (msg != "hello") {
+                        throw std::runtime_error("tree map_reduce destroyed map too early");
+                    }
+                    return z.calls;
+                });
+            }, 0u, std::plus<unsigned>());
+        }).then([] (unsigned calls) {
+            if (calls != smp::count) {
+                throw std::runtime_error("tree invoke_on_all must call every shard exactly once");
+            }
+        });
+    });
+}
+
 future<> test_async() {
     return do_with_distributed<async>([] (distributed<async>& x) {
         return x.start().then([&x] {
@@ -139,6 +212,12 @@ int main(int argc, char** argv) {
             return test_constructor_argument_is_passed_to_each_core();
         }).then([] {
             return test_map_reduce();
+        }).then([] {
+            return test_map_reduce_tree();
+        }).then([] {
+            return test_invoke_on_all_tree();
+        }).then([] {
+            return test_tree_keeps_func_alive();
         }).then([] {
             return test_async();
         });
@@ -48,9 +48,9 @@ struct test_env {
         classes.push_back(fq.register_priority_class(shares));
         return classes.size() - 1;
     }
-    void do_op(unsigned index, unsigned weight)  {
+    void do_op(unsigned index, unsigned weight, size_t size = 0)  {
         auto cl = classes[index];
-        auto f = fq.queue(cl, weight, [this, index] {
+        auto f = fq.queue(cl, weight, size, [this, index] {
             results[index]++;
             return sleep(100us);
         });
@@ -60,6 +60,9 @@ struct test_env {
         auto cl = classes[index];
         fq.update_shares(cl, shares);
     }
+    void set_rate_limits(unsigned index, double bytes_per_second, double ops_per_second) {
+        fq.set_rate_limits(classes[index], bytes_per_second, ops_per_second);
+    }
     // Verify if the ratios are what we expect. Because we can't be sure about
     // precise timing issues, we can always be off by some percentage. In simpler
     // tests we really expect it to very low, but in more complex tests, with share
@@ -328,3 +331,169 @@ SEASTAR_TEST_CASE(test_fair_queue_random_run) {
        return env->verify(sprint("random_run (%d msec)", reqs / 10), {1, 1}, expected_error);
     }).then([env] {});
 }
+
+// Class1 is capped at 1000 requests per second. Over 100ms it must not get much
+// more than 100 requests (plus its 10ms burst), and Class2 takes the capacity it
+// leaves. Once the cap is lifted, the held back requests go through.
+SEASTAR_TEST_CASE(test_fair_queue_rate_limit) {
+    auto env = make_lw_shared<test_env>(1);
+
+    auto a = env->register_priority_class(10);
+    auto b = env->register_priority_class(10);
+    env->set_rate_limits(a, 0, 1000);
+
+    for (int i = 0; i < 1000; ++i) {
+        env->do_op(a, 1);
+        env->do_op(b, 1);
+    }
+    return sleep(100ms).then([env, a, b] {
+        auto r = env->results;
+        std::cout << sprint("rate_limit: r[0] = %d r[1] = %d", r[a], r[b]) << std::endl;
+        BOOST_REQUIRE(r[a] <= 100 + 10 + 10);
+        BOOST_REQUIRE(r[b] > 2 * r[a]);
+        BOOST_REQUIRE(fair_queue::throttled_time(env->classes[a]) > 50ms);
+        env->set_rate_limits(a, 0, 0);
+        return env->wait_on_pending();
+    }).then([env, a, b] {
+        BOOST_REQUIRE_EQUAL(env->results[a], 1000);
+        BOOST_REQUIRE_EQUAL(env->results[b], 1000);
+        for (auto& p: env->classes) {
+            env->fq.unregister_priority_class(p);
+        }
+    });
+}
+
+// Class1 is capped at 100KB/s, with requests of 1000 bytes: over 100ms it must
+// not get much more than 10 requests (plus its 10ms burst), while Class2 is not
+// held back.
+SEASTAR_TEST_CASE(test_fair_queue_bandwidth_limit) {
+    auto env = make_lw_shared<test_env>(1);
+
+    auto a = env->register_priority_class(10);
+    auto b = env->register_priority_class(10);
+    env->set_rate_limits(a, 100000, 0);
+
+    for (int i = 0; i < 200; ++i) {
+        env->do_op(a, 1, 1000);
+        env->do_op(b, 1, 1000);
+    }
+    return sleep(100ms).then([env, a, b] {
+        auto r = env->results;
+        std::cout << sprint("bandwidth_limit: r[0] = %d r[1] = %d", r[a], r[b]) << std::endl;
+        BOOST_REQUIRE(r[a] <= 10 + 1 + 5);
+        BOOST_REQUIRE(r[b] > 2 * r[a]);
+        env->set_rate_limits(a, 0, 0);
+        return env->wait_on_pending();
+    }).then([env, a, b] {
+        BOOST_REQUIRE_EQUAL(env->results[a], 200);
+        BOOST_REQUIRE_EQUAL(env->results[b], 200);
+        for (auto& p: env->classes) {
+            env->fq.unregister_priority_class(p);
+        }
+    });
+}
+
+// A deep backlog of a rate limited class must not be looked at again for
+// every request: the class waits aside until its bucket refills, so the
+// number of dispatch attempts follows the requests actually dispatched.
+SEASTAR_TEST_CASE(test_fair_queue_rate_limit_deep_backlog) {
+    auto env = make_lw_shared<test_env>(10);
+
+    auto a = env->register_priority_class(10);
+    env->set_rate_limits(a, 0, 100);
+
+    for (int i = 0; i < 10000; ++i) {
+        env->do_op(a, 1);
+    }
+    return sleep(100ms).then([env, a] {
+        auto dispatched = env->results[a];
+        auto attempts = env->fq.dispatch_attempts();
+        std::cout << sprint("rate_limit_deep_backlog: dispatched = %d attempts = %d", dispatched, attempts) << std::endl;
+        BOOST_REQUIRE(dispatched <= 10 + 1 + 5);
+        // One attempt per dispatch, and one per refill of the bucket.
+        BOOST_REQUIRE(attempts <= uint64_t(2 * dispatched + 2));
+        env->set_rate_limits(a, 0, 0);
+        return env->wait_on_pending();
+    }).then([env, a] {
+        BOOST_REQUIRE_EQUAL(env->results[a], 10000);
+        for (auto& p: env->classes) {
+            env->fq.unregister_priority_class(p);
+        }
+    });
+}
+
+// The capacity is lowered to 1 while 4 requests execute: the requests
+// started after that must run alone, even though the ones already executing
+// complete later. Raised to 3, up to 3 requests run together again.
+SEASTAR_TEST_CASE(test_fair_queue_set_capacity) {
+    struct state {
+        fair_queue fq{4};
+        priority_class_ptr pc = fq.register_priority_class(10);
+        unsigned in_flight = 0;
+        unsigned max_in_flight = 0;
+        std::vector<future<>> inflight;
+    };
+    auto s = make_lw_shared<state>();
+    for (int i = 0; i < 40; ++i) {
+        s->inflight.push_back(s->fq.queue(s->pc, 1, [s] {
+            s->max_in_flight = std::max(s->max_in_flight, ++s->in_flight);
+            return sleep(1ms).then([s] {
+                s->in_flight--;
+            });
+        }));
+    }
+    return sleep(2ms).then([s] {
+        s->fq.set_capacity(1);
+        BOOST_REQUIRE_EQUAL(s->fq.capacity(), 1);
+        s->max_in_flight = 0;
+        return sleep(10ms);
+    }).then([s] {
+        BOOST_REQUIRE_EQUAL(s->max_in_flight, 1);
+        s->fq.set_capacity(3);
+        s->max_in_flight = 0;
+        return when_all(s->inflight.begin(), s->inflight.end()).discard_result();
+    }).then([s] {
+        BOOST_REQUIRE(s->max_in_flight > 1);
+        BOOST_REQUIRE(s->max_in_flight <= 3);
+        s->fq.unregister_priority_class(s->pc);
+    });
+}
+
+// A backlog held back by its rate limit does not wait for the capacity, so
+// it must not look like a saturated queue to the adaptive queue depth; a
+// backlog within its limits must.
+SEASTAR_TEST_CASE(test_fair_queue_capacity_waits) {
+    using namespace std::chrono;
+    auto env = make_lw_shared<test_env>(4);
+    auto a = env->register_priority_class(10);
+    auto b = env->register_priority_class(10);
+    env->set_rate_limits(a, 0, 100);
+    for (int i = 0; i < 1000; ++i) {
+        env->do_op(a, 1);
+    }
+    auto target = microseconds(1000);
+    auto fast = microseconds(500);
+    // Let the initial burst go by.
+    return sleep(50ms).then([env] {
+        auto before = env->fq.capacity_waits();
+        return sleep(50ms).then([env, before] {
+            return before;
+        });
+    }).then([env, a, b, target, fast] (uint64_t before) {
+        BOOST_REQUIRE_EQUAL(env->fq.capacity_waits(), before);
+        BOOST_REQUIRE(env->fq.waiters() > 0);
+        auto saturated = env->fq.capacity_waits() != before;
+        BOOST_REQUIRE_EQUAL(io_queue::next_limit(4, 128, fast, target, saturated), 4);
+        for (int i = 0; i < 100; ++i) {
+            env->do_op(b, 1);
+        }
+        saturated = env->fq.capacity_waits() != before;
+        BOOST_REQUIRE_EQUAL(io_queue::next_limit(4, 128, fast, target, saturated), 5);
+        env->set_rate_limits(a, 0, 0);
+        return env->wait_on_pending();
+    }).then([env] {
+        for (auto& p: env->classes) {
+            env->fq.unregister_priority_class(p);
+        }
+    });
+}
@@ -24,6 +24,8 @@
 #include "core/semaphore.hh"
 #include "core/file.hh"
 #include "core/reactor.hh"
+#include "core/future-util.hh"
+#include <boost/range/irange.hpp>
 
 struct file_test {
     file_test(file&& f) : f(std::move(f)) {}
@@ -68,4 +70,106 @@ SEASTAR_TEST_CASE(test1) {
     });
 }
 
+// Reads of adjacent blocks issued together are merged into one vectored
+// request; each must still get its own block, and the read past the end of
+// the file nothing.
+SEASTAR_TEST_CASE(test_adjacent_reads) {
+    static constexpr size_t block = 4096;
+    static constexpr size_t nr = 16;
+    return open_file_dma("testfile2.tmp", open_flags::rw | open_flags::create | open_flags::truncate).then([] (file f) {
+        auto wbuf = allocate_aligned_buffer<unsigned char>(block * nr, block);
+        for (size_t i = 0; i < nr; ++i) {
+            std::fill(wbuf.get() + i * block, wbuf.get() + (i + 1) * block, i);
+        }
+        auto wb = wbuf.get();
+        return f.dma_write(0, wb, block * nr).then([f, wbuf = std::move(wbuf)] (size_t ret) mutable {
+            BOOST_REQUIRE_EQUAL(ret, block * nr);
+            auto merged = engine().merged_aio_requests();
+            return parallel_for_each(boost::irange<size_t>(0, nr + 1), [f] (size_t i) mutable {
+                auto rbuf = allocate_aligned_buffer<unsigned char>(block, block);
+                auto rb = rbuf.get();
+                return f.dma_read(i * block, rb, block).then([i, rbuf = std::move(rbuf)] (size_t ret) {
+                    if (i == nr) {
+                        BOOST_REQUIRE_EQUAL(ret, 0);
+                        return;
+                    }
+                    BOOST_REQUIRE_EQUAL(ret, block);
+                    BOOST_REQUIRE(std::all_of(rbuf.get(), rbuf.get() + block, [i] (unsigned char c) { return c == i; }));
+                });
+            }).then([merged] {
+                BOOST_REQUIRE_GT(engine().merged_aio_requests(), merged);
+            });
+        }).then([f] () mutable {
+            return f.close();
+        });
+    });
+}
 
+SEASTAR_TEST_CASE(test_adjacent_writes) {
+    static constexpr size_t block = 4096;
+    static constexpr size_t nr = 16;
+    return open_file_dma("testfile3.tmp", open_flags::rw | open_flags::create | open_flags::truncate).then([] (file f) {
+        // Fill the file first: some filesystems serialize writes that extend it.
+        auto zbuf = allocate_aligned_buffer<unsigned char>(block * nr, block);
+        std::fill(zbuf.get(), zbuf.get() + block * nr, 0xff);
+        auto zb = zbuf.get();
+        return f.dma_write(0, zb, block * nr).then([f, zbuf = std::move(zbuf)] (size_t ret) {
+            BOOST_REQUIRE_EQUAL(ret, block * nr);
+            return f;
+        });
+    }).then([] (file f) {
+        auto merged = engine().merged_aio_requests();
+        return parallel_for_each(boost::irange<size_t>(0, nr), [f] (size_t i) mutable {
+            auto wbuf = allocate_aligned_buffer<unsigned char>(block, block);
+            std::fill(wbuf.get(), wbuf.get() + block, i);
+            auto wb = wbuf.get();
+            return f.dma_write(i * block, wb, block).then([wbuf = std::move(wbuf)] (size_t ret) {
+                BOOST_REQUIRE_EQUAL(ret, block);
+            });
+        }).then([f, merged] () mutable {
+            BOOST_REQUIRE_GT(engine().merged_aio_requests(), merged);
+            auto rbuf = allocate_aligned_buffer<unsigned char>(block * nr, block);
+            auto rb = rbuf.get();
+            return f.dma_read(0, rb, block * nr).then([rbuf = std::move(rbuf)] (size_t ret) {
+                BOOST_REQUIRE_EQUAL(ret, block * nr);
+                for (size_t i = 0; i < nr; ++i) {
+                    BOOST_REQUIRE(std::all_of(rbuf.get() + i * block, rbuf.get() + (i + 1) * block,
+                            [i] (unsigned char c) { return c == i; }));
+                }
+            });
+        }).then([f] () mutable {
+            return f.close();
+        });
+    });
+}
+
+// Adjacent writes to a file opened read-only are merged, and the merged
+// request is rejected with EBADF; every write it covers must see the error.
+SEASTAR_TEST_CASE(test_merged_request_failure) {
+    static constexpr size_t block = 4096;
+    static constexpr size_t nr = 8;
+    return open_file_dma("testfile4.tmp", open_flags::rw | open_flags::create | open_flags::truncate).then([] (file f) {
+        return f.close();
+    }).then([] {
+        return open_file_dma("testfile4.tmp", open_flags::ro);
+    }).then([] (file f) {
+        auto merged = engine().merged_aio_requests();
+        auto failed = make_lw_shared<size_t>(0);
+        return parallel_for_each(boost::irange<size_t>(0, nr), [f, failed] (size_t i) mutable {
+            auto wbuf = allocate_aligned_buffer<unsigned char>(block, block);
+            auto wb = wbuf.get();
+            return f.dma_write(i * block, wb, block).then_wrapped([failed, wbuf = std::move(wbuf)] (future<size_t> f) {
+                try {
+                    f.get();
+                } catch (std::system_error& e) {
+                    BOOST_REQUIRE_EQUAL(e.code().value(), EBADF);
+                    ++*failed;
+                }
+            });
+        }).then([f, merged, failed] () mutable {
+            BOOST_REQUIRE_EQUAL(*failed, nr);
+            BOOST_REQUIRE_GT(engine().merged_aio_requests(), merged);
+            return f.close();
+        });
+    });
+}
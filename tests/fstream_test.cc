@@ -251,3 +251,38 @@ SEASTAR_TEST_CASE(test_input_stream_esp_around_eof) {
         f.close().get();
     });
 }
+
+// With dynamic_adjustments, a reader that keeps up with the disk gets larger
+// buffers, unless the shard has no read-ahead budget to give.
+SEASTAR_TEST_CASE(test_fstream_dynamic_adjustments) {
+    return seastar::async([] {
+        auto flen = uint64_t(4 << 20) + 1;
+        auto data = std::vector<char>(flen);
+        std::iota(data.begin(), data.end(), 0);
+        auto f = open_file_dma("file.tmp",
+                open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto out = make_file_output_stream(f);
+        out.write(data.data(), data.size()).get();
+        out.flush().get();
+        auto read_all = [&] {
+            auto opt = file_input_stream_options();
+            opt.dynamic_adjustments = true;
+            auto in = make_file_input_stream(f, opt);
+            size_t pos = 0;
+            size_t max_read = 0;
+            while (auto buf = in.read().get0()) {
+                BOOST_REQUIRE(std::equal(buf.begin(), buf.end(), data.begin() + pos));
+                pos += buf.size();
+                max_read = std::max(max_read, buf.size());
+            }
+            in.close().get();
+            BOOST_REQUIRE_EQUAL(pos, flen);
+            return max_read;
+        };
+        BOOST_REQUIRE(read_all() > 8192);
+        set_file_input_stream_read_ahead_budget(0);
+        BOOST_REQUIRE_EQUAL(read_all(), 8192);
+        set_file_input_stream_read_ahead_budget(16 << 20);
+        f.close().get();
+    });
+}
@@ -27,6 +27,7 @@
 #include "core/do_with.hh"
 #include "core/shared_future.hh"
 #include "core/thread.hh"
+#include "core/scollectd_api.hh"
 #include <boost/iterator/counting_iterator.hpp>
 
 class expected_exception : std::runtime_error {
@@ -453,6 +454,86 @@ SEASTAR_TEST_CASE(test_parallel_for_each_waits_for_all_fibers_even_if_one_of_the
     });
 }
 
+SEASTAR_TEST_CASE(test_max_concurrent_for_each) {
+    struct counters {
+        int in_flight = 0;
+        int max_in_flight = 0;
+        int done = 0;
+    };
+    return do_with(counters(), [] (counters& c) {
+        return max_concurrent_for_each(boost::irange(0, 1000), 7, [&c] (int i) {
+            c.max_in_flight = std::max(c.max_in_flight, ++c.in_flight);
+            using namespace std::chrono_literals;
+            return sleep((i % 3) * 1ms).then([&c] {
+                --c.in_flight;
+                ++c.done;
+            });
+        }).then([&c] {
+            BOOST_REQUIRE_EQUAL(c.done, 1000);
+            BOOST_REQUIRE_EQUAL(c.in_flight, 0);
+            BOOST_REQUIRE_EQUAL(c.max_in_flight, 7);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_max_concurrent_for_each_stops_on_failure) {
+    struct counters {
+        int in_flight = 0;
+        int started = 0;
+    };
+    return do_with(counters(), [] (counters& c) {
+        return max_concurrent_for_each(boost::irange(0, 1000), 4, [&c] (int i) {
+            ++c.in_flight;
+            ++c.started;
+            return later().then([&c, i] {
+                --c.in_flight;
+                if (i == 10) {
+                    throw expected_exception();
+                }
+            });
+        }).then_wrapped([&c] (future<> f) {
+            BOOST_REQUIRE_THROW(f.get(), expected_exception);
+            BOOST_REQUIRE_EQUAL(c.in_flight, 0);
+            BOOST_REQUIRE_LT(c.started, 1000);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_max_concurrent_for_each_rejects_zero) {
+    auto called = make_lw_shared<bool>(false);
+    return max_concurrent_for_each(boost::irange(0, 10), 0, [called] (int i) {
+        *called = true;
+        return make_ready_future<>();
+    }).then_wrapped([called] (future<> f) {
+        BOOST_REQUIRE_THROW(f.get(), std::invalid_argument);
+        BOOST_REQUIRE(!*called);
+        return map_reduce(boost::irange(0, 10), 0, [] (int i) {
+            return make_ready_future<int>(i);
+        }, 0, std::plus<int>());
+    }).then_wrapped([] (future<int> f) {
+        BOOST_REQUIRE_THROW(f.get(), std::invalid_argument);
+    });
+}
+
+SEASTAR_TEST_CASE(test_bounded_map_reduce) {
+    auto in_flight = make_lw_shared<long>(0);
+    auto max_in_flight = make_lw_shared<long>(0);
+    auto square = [in_flight, max_in_flight] (long x) {
+        *max_in_flight = std::max(*max_in_flight, ++*in_flight);
+        return later().then([in_flight, x] {
+            --*in_flight;
+            return x*x;
+        });
+    };
+    long n = 1000;
+    return map_reduce(boost::make_counting_iterator<long>(0), boost::make_counting_iterator<long>(n), 10,
+            square, long(0), std::plus<long>()).then([n, max_in_flight] (auto result) {
+        auto m = n - 1; // counting does not include upper bound
+        BOOST_REQUIRE_EQUAL(result, (m * (m + 1) * (2*m + 1)) / 6);
+        BOOST_REQUIRE_EQUAL(*max_in_flight, 10);
+    });
+}
+
 SEASTAR_TEST_CASE(test_high_priority_task_runs_before_ready_continuations) {
     return now().then([] {
         auto flag = make_lw_shared<bool>(false);
@@ -691,3 +772,63 @@ SEASTAR_TEST_CASE(test_repeat_until_value) {
 SEASTAR_TEST_CASE(test_when_allx) {
     return when_all(later(), later(), make_ready_future()).discard_result();
 }
+
+SEASTAR_TEST_CASE(test_scheduling_group_is_inherited) {
+    auto sg = create_scheduling_group("test", 200);
+    BOOST_REQUIRE(sg != current_scheduling_group());
+    BOOST_REQUIRE_EQUAL(sg.shares(), 200u);
+    return with_scheduling_group(sg, [sg] {
+        BOOST_REQUIRE(current_scheduling_group() == sg);
+        return later().then([sg] {
+            BOOST_REQUIRE(current_scheduling_group() == sg);
+            return current_scheduling_group();
+        });
+    }).then([sg] (scheduling_group inner) {
+        BOOST_REQUIRE(inner == sg);
+        BOOST_REQUIRE(current_scheduling_group() == default_scheduling_group());
+    });
+}
+
+// The CPU time the scheduler accounts to each group, in microseconds.
+static int64_t scheduling_group_runtime_us(sstring name) {
+    auto values = scollectd::get_collectd_value(scollectd::type_instance_id("scheduler",
+            scollectd::per_cpu_plugin_instance, "derive", name + "-runtime-us"));
+    return values.empty() ? 0 : values[0].i();
+}
+
+SEASTAR_TEST_CASE(test_scheduling_group_shares_ratio) {
+    // Two CPU-bound loops that run until the group with more shares has
+    // run a fixed number of tasks; then the CPU time the scheduler
+    // accounted to each group must follow their shares. The scheduler
+    // balances its own accounting, so this holds on a loaded machine too.
+    struct state {
+        bool done = false;
+        uint64_t runs[2] = {};
+    };
+    auto st = make_lw_shared<state>();
+    auto loop = [st] (scheduling_group sg, unsigned i) {
+        return with_scheduling_group(sg, [st, i] {
+            return do_until([st] { return st->done; }, [st, i] {
+                auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+                while (std::chrono::steady_clock::now() < end) {
+                }
+                if (++st->runs[i] == 2000 && i == 1) {
+                    st->done = true;
+                }
+                return later();
+            });
+        });
+    };
+    auto f1 = loop(create_scheduling_group("ratio-shares-100", 100), 0);
+    auto f2 = loop(create_scheduling_group("ratio-shares-400", 400), 1);
+    return when_all(std::move(f1), std::move(f2)).discard_result().then([st] {
+        auto runtime_100 = scheduling_group_runtime_us("ratio-shares-100");
+        auto runtime_400 = scheduling_group_runtime_us("ratio-shares-400");
+        BOOST_TEST_MESSAGE("runs: " << st->runs[0] << " vs " << st->runs[1]
+                << ", runtime: " << runtime_100 << "us vs " << runtime_400 << "us");
+        BOOST_REQUIRE_GT(runtime_100, 0);
+        auto ratio = double(runtime_400) / runtime_100;
+        BOOST_REQUIRE_GE(ratio, 2.5);
+        BOOST_REQUIRE_LE(ratio, 6.0);
+    });
+}
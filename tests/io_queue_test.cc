@@ -0,0 +1,171 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/reactor.hh"
+#include <fstream>
+
+static void write_properties(const char* path, const char* content) {
+    std::ofstream ofs(path);
+    ofs << content;
+}
+
+SEASTAR_TEST_CASE(test_io_properties_load) {
+    write_properties("io-properties.tmp",
+            "read-iops=100000\n"
+            "read-bandwidth=1000000000\n"
+            "write-iops=50000\n"
+            "write-bandwidth=500000000\n");
+    auto p = io_properties::load("io-properties.tmp");
+    BOOST_REQUIRE_EQUAL(p.read_iops, 100000);
+    BOOST_REQUIRE_EQUAL(p.write_bandwidth, 500000000);
+    BOOST_REQUIRE(p.valid());
+
+    write_properties("io-properties.tmp",
+            "read-iops=100000\n"
+            "read-bandwidth=1000000000\n"
+            "write-iops=50000\n");
+    BOOST_REQUIRE_THROW(io_properties::load("io-properties.tmp"), std::exception);
+
+    write_properties("io-properties.tmp",
+            "read-iops=100000\n"
+            "read-bandwidth=1000000000\n"
+            "write-iops=0\n"
+            "write-bandwidth=500000000\n");
+    BOOST_REQUIRE_THROW(io_properties::load("io-properties.tmp"), std::runtime_error);
+
+    ::unlink("io-properties.tmp");
+    BOOST_REQUIRE_THROW(io_properties::load("io-properties.tmp"), std::runtime_error);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_request_weight) {
+    io_properties p;
+    p.read_iops = 100000;
+    p.read_bandwidth = 1e9;
+    p.write_iops = 50000;
+    p.write_bandwidth = 5e8;
+    io_queue q(0, 128, {0}, p);
+    BOOST_REQUIRE_EQUAL(io_queue::read_4k_weight, 16);
+    // A 4k read weighs 16; a 4k write takes twice as long on this disk.
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::read, 4096), 16);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::write, 4096), 32);
+    // 4k more take 4us to read, on top of the 10us seek.
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::read, 8 << 10), 23);
+    // 128k more take 131us to read and 262us to write, on top of the seek.
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::read, 132 << 10), 226);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::write, 132 << 10), 451);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::read, 512), 16);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_request_weight_small_writes) {
+    // Writes cost 1.4 times as much as reads: 4k requests must still weigh
+    // differently.
+    io_properties p;
+    p.read_iops = 100000;
+    p.read_bandwidth = 1e9;
+    p.write_iops = 100000 / 1.4;
+    p.write_bandwidth = 1e9 / 1.4;
+    io_queue q(0, 128, {0}, p);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::read, 4096), 16);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::write, 4096), 22);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::write, 8 << 10), 32);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_request_weight_without_properties) {
+    io_queue q(0, 128, {0});
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::read, 4096), 16);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::write, 4096), 16);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::read, 64 << 10), 80);
+    BOOST_REQUIRE_EQUAL(q.request_weight(io_direction::write, 128 << 10), 144);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_latency_histogram_buckets) {
+    using histogram = io_queue::latency_histogram;
+    for (unsigned usec = 0; usec < 4; ++usec) {
+        BOOST_REQUIRE_EQUAL(histogram::bucket_of(usec), usec);
+        BOOST_REQUIRE_EQUAL(histogram::upper_bound_of(usec), usec + 1);
+    }
+    // Four buckets per power of two from 4us on.
+    BOOST_REQUIRE_EQUAL(histogram::bucket_of(4), 8);
+    BOOST_REQUIRE_EQUAL(histogram::bucket_of(7), 11);
+    BOOST_REQUIRE_EQUAL(histogram::bucket_of(8), 12);
+    BOOST_REQUIRE_EQUAL(histogram::bucket_of(9), 12);
+    BOOST_REQUIRE_EQUAL(histogram::bucket_of(10), 13);
+    BOOST_REQUIRE_EQUAL(histogram::upper_bound_of(8), 5);
+    BOOST_REQUIRE_EQUAL(histogram::upper_bound_of(12), 10);
+    BOOST_REQUIRE_EQUAL(histogram::bucket_of(100), 26);
+    BOOST_REQUIRE_EQUAL(histogram::upper_bound_of(26), 112);
+    // Everything from 2^32us on lands in the last bucket.
+    BOOST_REQUIRE_EQUAL(histogram::bucket_of(uint64_t(1) << 40), 127);
+    BOOST_REQUIRE_EQUAL(histogram::upper_bound_of(127), uint64_t(1) << 32);
+    // Each value lies below its bucket's bound and at or above the previous one's.
+    for (uint64_t usec = 8; usec < 100000; usec += 7) {
+        auto b = histogram::bucket_of(usec);
+        BOOST_REQUIRE_LT(usec, histogram::upper_bound_of(b));
+        BOOST_REQUIRE_GE(usec, histogram::upper_bound_of(b - 1));
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_latency_histogram_percentile) {
+    using namespace std::chrono;
+    io_queue::latency_histogram h;
+    BOOST_REQUIRE_EQUAL(h.percentile(95).count(), 0);
+    for (int i = 0; i < 95; ++i) {
+        h.add(microseconds(100));
+    }
+    for (int i = 0; i < 5; ++i) {
+        h.add(microseconds(10000));
+    }
+    BOOST_REQUIRE_EQUAL(h.count(), 100);
+    BOOST_REQUIRE_EQUAL(h.percentile(50).count(), 112);
+    BOOST_REQUIRE_EQUAL(h.percentile(95).count(), 112);
+    BOOST_REQUIRE_EQUAL(h.percentile(96).count(), 10240);
+    BOOST_REQUIRE_EQUAL(h.percentile(99).count(), 10240);
+    h.clear();
+    BOOST_REQUIRE_EQUAL(h.count(), 0);
+    BOOST_REQUIRE_EQUAL(h.percentile(95).count(), 0);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_adaptive_limit_step) {
+    using namespace std::chrono;
+    auto target = microseconds(1000);
+    auto fast = microseconds(500);
+    auto slow = microseconds(2000);
+    // Over the target: shrink by a tenth, but never below one request.
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(100, 128, slow, target, false), 90);
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(100, 128, slow, target, true), 90);
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(5, 128, slow, target, false), 4);
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(1, 128, slow, target, false), 1);
+    // Under the target and saturated: grow by one, up to the cap.
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(90, 128, fast, target, true), 91);
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(127, 128, fast, target, true), 128);
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(128, 128, fast, target, true), 128);
+    // Under the target and not saturated, or exactly at it: unchanged.
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(90, 128, fast, target, false), 90);
+    BOOST_REQUIRE_EQUAL(io_queue::next_limit(90, 128, target, target, false), 90);
+    return make_ready_future<>();
+}
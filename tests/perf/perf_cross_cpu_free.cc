@@ -0,0 +1,77 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Measures cross-shard alloc/free throughput: every shard allocates
+// objects and sends them to the next shard to be freed, as happens with
+// foreign_ptr.  Needs at least two shards.
+
+#include <vector>
+#include "core/reactor.hh"
+#include "core/app-template.hh"
+#include "core/future-util.hh"
+#include "core/print.hh"
+
+static future<> send_frees(unsigned iterations, unsigned batch, size_t size) {
+    return do_with(unsigned(0), [=] (unsigned& i) {
+        return do_until([&i, iterations] { return i == iterations; }, [&i, batch, size] {
+            ++i;
+            std::vector<void*> objs;
+            objs.reserve(batch);
+            for (unsigned j = 0; j < batch; ++j) {
+                objs.push_back(::malloc(size));
+            }
+            auto to = (engine().cpu_id() + 1) % smp::count;
+            return smp::submit_to(to, [objs = std::move(objs)] {
+                for (auto p : objs) {
+                    ::free(p);
+                }
+            });
+        });
+    });
+}
+
+int main(int ac, char** av) {
+    app_template app;
+    namespace bpo = boost::program_options;
+    app.add_options()
+            ("iterations", bpo::value<unsigned>()->default_value(100000), "Batches sent by each shard")
+            ("batch", bpo::value<unsigned>()->default_value(100), "Objects per batch")
+            ("size", bpo::value<size_t>()->default_value(64), "Object size")
+            ;
+    return app.run(ac, av, [&app] {
+        auto iterations = app.configuration()["iterations"].as<unsigned>();
+        auto batch = app.configuration()["batch"].as<unsigned>();
+        auto size = app.configuration()["size"].as<size_t>();
+        if (smp::count < 2) {
+            print("perf_cross_cpu_free needs at least two shards (-c2)\n");
+            return make_ready_future<>();
+        }
+        auto start = std::chrono::steady_clock::now();
+        return smp::invoke_on_all([=] {
+            return send_frees(iterations, batch, size);
+        }).then([=] {
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            auto frees = double(iterations) * batch * smp::count;
+            print("%10s %10s %10s %16s\n", "shards", "batch", "size", "frees/s");
+            print("%10d %10d %10d %16.0f\n", smp::count, batch, size, frees / elapsed);
+        });
+    });
+}
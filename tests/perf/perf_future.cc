@@ -0,0 +1,75 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Measures continuation throughput: then() chains attached to futures that
+// are not yet available (so each step allocates and schedules a
+// continuation), and, with more than one shard, smp::submit_to() round
+// trips.
+
+#include "core/reactor.hh"
+#include "core/app-template.hh"
+#include "core/future-util.hh"
+#include "core/print.hh"
+
+using namespace std::chrono_literals;
+
+template <typename Func>
+static future<> measure(const char* name, unsigned iterations, unsigned ops_per_iteration, Func func) {
+    return do_with(unsigned(0), [=] (unsigned& i) {
+        auto start = std::chrono::steady_clock::now();
+        return do_until([&i, iterations] { return i == iterations; }, [&i, func] () mutable {
+            ++i;
+            return func();
+        }).then([=] {
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            print("%-16s %12.0f ops/s\n", name, iterations * ops_per_iteration / elapsed);
+        });
+    });
+}
+
+int main(int ac, char** av) {
+    app_template app;
+    namespace bpo = boost::program_options;
+    app.add_options()
+            ("iterations", bpo::value<unsigned>()->default_value(1000000), "Iterations of each test")
+            ("chain-length", bpo::value<unsigned>()->default_value(10), "Continuations attached per iteration")
+            ;
+    return app.run(ac, av, [&app] {
+        auto iterations = app.configuration()["iterations"].as<unsigned>();
+        auto chain_length = app.configuration()["chain-length"].as<unsigned>();
+        return measure("continuations", iterations, chain_length, [chain_length] {
+            promise<> pr;
+            auto f = pr.get_future();
+            for (unsigned j = 0; j < chain_length; ++j) {
+                f = f.then([] {});
+            }
+            pr.set_value();
+            return f;
+        }).then([iterations] {
+            if (smp::count < 2) {
+                return make_ready_future<>();
+            }
+            return measure("submit_to", iterations / 10, 1, [] {
+                return smp::submit_to(1, [] {});
+            });
+        });
+    });
+}
@@ -0,0 +1,123 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Compares arm/cancel/expire throughput of timer_set and timer_wheel.
+// Uses a synthetic clock, so no reactor is needed.
+
+#include <cassert>
+#include <random>
+#include <vector>
+#include "core/timer-set.hh"
+#include "core/timer-wheel.hh"
+#include "core/print.hh"
+
+using namespace std::chrono_literals;
+
+struct test_timer {
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+    using duration = clock::duration;
+    bi::list_member_hook<> link;
+    time_point timeout;
+    time_point get_timeout() const { return timeout; }
+    void cancel() { abort(); }  // the benchmark empties the set first
+};
+
+using timer_set_type = seastar::timer_set<test_timer, &test_timer::link>;
+using timer_wheel_type = seastar::timer_wheel<test_timer, &test_timer::link>;
+
+// Timers are spread over this interval (think TCP retransmit and
+// keep-alive timeouts), and expired in steps of expire_step.
+static constexpr auto spread = 10s;
+static constexpr auto expire_step = 1ms;
+
+template <typename Func>
+static double ns_per_op(size_t ops, Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / ops;
+}
+
+template <typename Set>
+static void run(const char* name, size_t n) {
+    std::mt19937 rng(n);
+    std::uniform_int_distribution<int64_t> dist(1, std::chrono::nanoseconds(spread).count());
+    auto base = test_timer::time_point(1h);
+    std::vector<test_timer> timers(n);
+    auto randomize = [&] {
+        for (auto& t : timers) {
+            t.timeout = base + std::chrono::nanoseconds(dist(rng));
+        }
+    };
+
+    Set set;
+    set.expire(base);
+
+    randomize();
+    auto arm = ns_per_op(n, [&] {
+        for (auto& t : timers) {
+            set.insert(t);
+        }
+    });
+    auto cancel = ns_per_op(n, [&] {
+        for (auto& t : timers) {
+            set.remove(t);
+        }
+    });
+    assert(set.empty());
+
+    // Re-arming: what a TCP connection does on every ack.
+    for (auto& t : timers) {
+        set.insert(t);
+    }
+    auto rearm = ns_per_op(n, [&] {
+        for (auto& t : timers) {
+            set.remove(t);
+            t.timeout = base + std::chrono::nanoseconds(dist(rng));
+            set.insert(t);
+        }
+    });
+
+    size_t expired = 0;
+    auto expire = ns_per_op(n, [&] {
+        for (auto now = base; now <= base + spread; now += expire_step) {
+            auto exp = set.expire(now);
+            while (!exp.empty()) {
+                assert(exp.front().timeout <= now);
+                exp.pop_front();
+                ++expired;
+            }
+        }
+    });
+    assert(expired == n);
+    assert(set.empty());
+
+    print("%-12s %10d %12.1f %12.1f %12.1f %12.1f\n", name, n, arm, cancel, rearm, expire);
+}
+
+int main(int ac, char** av) {
+    print("%-12s %10s %12s %12s %12s %12s\n", "impl", "timers", "arm(ns)", "cancel(ns)", "rearm(ns)", "expire(ns)");
+    for (size_t n : { 10000, 100000, 1000000 }) {
+        run<timer_set_type>("timer_set", n);
+        run<timer_wheel_type>("timer_wheel", n);
+    }
+}
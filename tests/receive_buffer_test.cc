@@ -0,0 +1,93 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "net/posix-stack.hh"
+#include <vector>
+
+using namespace net;
+
+SEASTAR_TEST_CASE(test_size_classes) {
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::get(1).size(), 1024);
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::get(1024).size(), 1024);
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::get(1025).size(), 2048);
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::get(128 << 10).size(), 128 << 10);
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::get((128 << 10) + 1).size(), (128 << 10) + 1);
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::cached_buffers((128 << 10) + 1), 0);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_buffers_are_reused) {
+    auto buf = receive_buffer_pool::get(4096);
+    auto p = buf.get();
+    auto cached = receive_buffer_pool::cached_buffers(4096);
+    buf = {};
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::cached_buffers(4096), cached + 1);
+    BOOST_REQUIRE(receive_buffer_pool::get(4096).get() == p);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_cache_is_capped_per_class) {
+    constexpr size_t size = 128 << 10;
+    auto max_cached = receive_buffer_pool::max_cached_bytes_per_class / size;
+    std::vector<temporary_buffer<char>> bufs;
+    for (size_t i = 0; i < max_cached + 2; ++i) {
+        bufs.push_back(receive_buffer_pool::get(size));
+    }
+    bufs.clear();
+    BOOST_REQUIRE_EQUAL(receive_buffer_pool::cached_buffers(size), max_cached);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_foreign_buffers_are_not_cached) {
+    if (smp::count < 2) {
+        return make_ready_future<>();
+    }
+    return smp::submit_to(1, [] {
+        return receive_buffer_pool::get(2048);
+    }).then([] (temporary_buffer<char> buf) {
+        auto cached = receive_buffer_pool::cached_buffers(2048);
+        buf = {};
+        BOOST_REQUIRE_EQUAL(receive_buffer_pool::cached_buffers(2048), cached);
+    });
+}
+
+SEASTAR_TEST_CASE(test_adapt_buffer_size) {
+    pollable_fd fd(file_desc::eventfd(0, 0));
+    posix_data_source_impl src(fd, 8192);
+    // Full reads double the buffer, up to the largest size class.
+    for (auto expected : {16384, 32768, 65536, 131072, 131072}) {
+        src.adapt_buffer_size(src.buffer_size(), src.buffer_size());
+        BOOST_REQUIRE_EQUAL(src.buffer_size(), expected);
+    }
+    // Small reads bring it down to twice their average, but not below the
+    // smallest size class.
+    for (int i = 0; i < 50; ++i) {
+        src.adapt_buffer_size(100, src.buffer_size());
+    }
+    BOOST_REQUIRE_EQUAL(src.buffer_size(), receive_buffer_pool::min_size);
+    for (int i = 0; i < 50; ++i) {
+        src.adapt_buffer_size(3000, 8192);
+    }
+    BOOST_REQUIRE_GE(src.buffer_size(), 5500);
+    BOOST_REQUIRE_LE(src.buffer_size(), 6000);
+    return make_ready_future<>();
+}
@@ -114,10 +114,55 @@ static void test_allocation_with_lru(const double growth_factor, const unsigned
     std::cout << __FUNCTION__ << " done!\n";
 }
 
+static slab_class_stats stats_of(slab_allocator<item>& slab, size_t size) {
+    for (auto& s : slab.class_stats()) {
+        if (s.object_size == slab.class_size(size)) {
+            return s;
+        }
+    }
+    abort();
+}
+
+static void test_rebalancing(const double growth_factor, const unsigned slab_limit_size) {
+    bi::list<item, bi::member_hook<item, bi::list_member_hook<>, &item::_cache_link>> _cache;
+
+    slab_allocator<item> slab(growth_factor, slab_limit_size, max_object_size,
+        [&](item& item_ref) { _cache.erase(_cache.iterator_to(item_ref)); });
+    size_t old_size = 1024;
+    size_t new_size = 64 * 1024;
+
+    // fill the whole limit with objects of one size, which are then never used again.
+    auto old_objects = (slab_limit_size / max_object_size) * (max_object_size / slab.class_size(old_size));
+    for (auto i = 0u; i < old_objects; i++) {
+        _cache.push_front(*slab.create(old_size));
+    }
+    assert(stats_of(slab, old_size).pages == slab_limit_size / max_object_size);
+
+    // switch the workload to another size: its class starts with a single page,
+    // and has to get more from the idle class through eviction pressure.
+    for (auto i = 0u; i < old_objects; i++) {
+        auto item = slab.create(new_size);
+        assert(item != nullptr);
+        _cache.push_front(*item);
+    }
+    auto old_stats = stats_of(slab, old_size);
+    auto new_stats = stats_of(slab, new_size);
+    assert(old_stats.pages_moved_out > 0);
+    assert(new_stats.pages_moved_in == old_stats.pages_moved_out);
+    assert(new_stats.pages > 1);
+    assert(old_stats.pages >= 1);
+    assert(new_stats.evictions > 0);
+
+    _cache.clear();
+
+    std::cout << __FUNCTION__ << " done!\n";
+}
+
 int main(int ac, char** av) {
     test_allocation_1(1.25, 5*1024*1024);
     test_allocation_2(1.07, 5*1024*1024); // 1.07 is the growth factor used by facebook.
     test_allocation_with_lru(1.25, 5*1024*1024);
+    test_rebalancing(1.25, 5*1024*1024);
 
     return 0;
 }
@@ -0,0 +1,63 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/reactor.hh"
+#include "core/scollectd.hh"
+#include "core/scollectd_api.hh"
+#include <time.h>
+
+// test.py runs this with a low --stall-report-threshold, so that the
+// test does not have to stall for long.
+
+static uint64_t stalls() {
+    return scollectd::get_collectd_value(scollectd::type_instance_id("reactor",
+            scollectd::per_cpu_plugin_instance, "total_operations", "stalls"))[0].i();
+}
+
+static double max_stall_ms() {
+    return scollectd::get_collectd_value(scollectd::type_instance_id("reactor",
+            scollectd::per_cpu_plugin_instance, "gauge", "max-stall-ms"))[0].d();
+}
+
+static std::chrono::nanoseconds thread_cpu_time() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+SEASTAR_TEST_CASE(test_stall_is_accounted) {
+    using namespace std::chrono;
+    auto threshold = engine().stall_report_threshold();
+    BOOST_REQUIRE(threshold.count() > 0);
+    auto stalls_before = stalls();
+    return later().then([threshold] {
+        // The task quota timer counts the cpu time of the thread, so spin
+        // for that long rather than for wall clock time.
+        auto end = thread_cpu_time() + duration_cast<nanoseconds>(threshold * 2);
+        while (thread_cpu_time() < end) {
+        }
+    }).then([threshold, stalls_before] {
+        BOOST_REQUIRE_GT(stalls(), stalls_before);
+        auto threshold_ms = duration_cast<duration<double, std::milli>>(threshold).count();
+        BOOST_REQUIRE_GE(max_stall_ms(), threshold_ms);
+    });
+}
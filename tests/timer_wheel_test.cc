@@ -0,0 +1,148 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+#include "core/timer-set.hh"
+#include "core/timer-wheel.hh"
+
+using namespace std::chrono_literals;
+
+// Lives in a timer_set and a timer_wheel at once, so that both can be
+// driven through the same operations.
+struct test_timer {
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+    using duration = clock::duration;
+    bi::list_member_hook<> set_link;
+    bi::list_member_hook<> wheel_link;
+    time_point timeout;
+    bool armed = false;
+    time_point get_timeout() const { return timeout; }
+    void cancel() { abort(); }  // the tests empty the sets first
+};
+
+using timer_set_type = seastar::timer_set<test_timer, &test_timer::set_link>;
+using timer_wheel_type = seastar::timer_wheel<test_timer, &test_timer::wheel_link>;
+
+template <typename List>
+static std::vector<test_timer*> sorted(List&& list) {
+    std::vector<test_timer*> ret;
+    for (auto& t : list) {
+        ret.push_back(&t);
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_wheel_matches_timer_set) {
+    std::mt19937 rng(1234);
+    std::vector<test_timer> timers(1000);
+    std::multiset<test_timer::time_point> armed;
+    timer_set_type set;
+    timer_wheel_type wheel;
+    auto now = test_timer::time_point(1h + 12345ns);
+    // Delays from nothing to days, so that every level of the wheel is used.
+    auto random_delay = [&] {
+        auto bits = std::uniform_int_distribution<int>(0, 48)(rng);
+        return std::chrono::nanoseconds(std::uniform_int_distribution<int64_t>(0, (int64_t(1) << bits) - 1)(rng));
+    };
+    auto random_timer = [&] () -> test_timer& {
+        return timers[std::uniform_int_distribution<size_t>(0, timers.size() - 1)(rng)];
+    };
+
+    for (int step = 0; step < 200000; ++step) {
+        auto op = std::uniform_int_distribution<int>(0, 9)(rng);
+        if (op < 5) {
+            auto& t = random_timer();
+            if (!t.armed) {
+                t.timeout = now + random_delay();
+                t.armed = true;
+                armed.insert(t.timeout);
+                set.insert(t);
+                wheel.insert(t);
+            }
+        } else if (op < 7) {
+            auto& t = random_timer();
+            if (t.armed) {
+                t.armed = false;
+                armed.erase(armed.find(t.timeout));
+                set.remove(t);
+                wheel.remove(t);
+            }
+        } else {
+            // Advance as the reactor does, to the next timeout, or further.
+            auto next = wheel.get_next_timeout();
+            now = op == 7 && !wheel.empty() && next > now ? next : now + random_delay();
+            auto set_expired = set.expire(now);
+            auto wheel_expired = wheel.expire(now);
+            auto fired = sorted(wheel_expired);
+            BOOST_REQUIRE(fired == sorted(set_expired));
+            for (auto t : fired) {
+                BOOST_REQUIRE(t->timeout <= now);
+                t->armed = false;
+                armed.erase(armed.find(t->timeout));
+            }
+            set_expired.clear();
+            wheel_expired.clear();
+            // Everything due has fired.
+            BOOST_REQUIRE(armed.empty() || *armed.begin() > now);
+        }
+        BOOST_REQUIRE_EQUAL(wheel.size(), armed.size());
+        BOOST_REQUIRE_EQUAL(wheel.empty(), armed.empty());
+        // The next timeout may be early, but never late.
+        if (!armed.empty()) {
+            BOOST_REQUIRE(wheel.get_next_timeout() <= *armed.begin());
+        }
+    }
+
+    set.clear();
+    wheel.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_wheel_next_timeout_after_expire) {
+    std::vector<test_timer> timers(3);
+    timer_wheel_type wheel;
+    auto base = test_timer::time_point(1h);
+    timers[0].timeout = base + 1s;
+    timers[1].timeout = base + 2s;
+    timers[2].timeout = base + 3s + 5ns;
+    for (auto& t : timers) {
+        wheel.insert(t);
+    }
+    BOOST_REQUIRE(wheel.get_next_timeout() == base + 1s);
+    BOOST_REQUIRE_EQUAL(wheel.expire(base + 1s).size(), 1u);
+    BOOST_REQUIRE(wheel.get_next_timeout() == base + 2s);
+    // Cancelling the earliest timer leaves the next timeout early; the
+    // expire() at that time finds nothing and moves on to the next one.
+    wheel.remove(timers[1]);
+    BOOST_REQUIRE(wheel.get_next_timeout() == base + 2s);
+    BOOST_REQUIRE_EQUAL(wheel.expire(base + 2s).size(), 0u);
+    BOOST_REQUIRE(wheel.get_next_timeout() == base + 3s + 5ns);
+    BOOST_REQUIRE_EQUAL(wheel.expire(base + 3s + 5ns).size(), 1u);
+    BOOST_REQUIRE(wheel.empty());
+}